@@ -0,0 +1,135 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.hpp"
+#include "memory.hpp"
+
+#ifndef _ATA_H_
+# define _ATA_H_
+
+// https://wiki.osdev.org/ATA_PIO_Mode, https://wiki.osdev.org/ATA/ATAPI_using_DMA
+# define ATA_SECTOR_SIZE		512
+# define ATA_CHANNELS			2
+# define ATA_DRIVES				(ATA_CHANNELS * 2)
+# define ATA_PRIMARY_IO			0x1F0
+# define ATA_PRIMARY_CTRL		0x3F6
+# define ATA_SECONDARY_IO		0x170
+# define ATA_SECONDARY_CTRL		0x376
+
+/* Task file registers, offsets from the channel I/O base */
+# define ATA_REG_DATA			0x00
+# define ATA_REG_ERROR			0x01
+# define ATA_REG_SECCOUNT		0x02
+# define ATA_REG_LBA0			0x03
+# define ATA_REG_LBA1			0x04
+# define ATA_REG_LBA2			0x05
+# define ATA_REG_DRIVE			0x06
+# define ATA_REG_STATUS			0x07
+# define ATA_REG_COMMAND		0x07
+/* Control block register, at the channel control base */
+# define ATA_REG_ALTSTATUS		0x00
+# define ATA_REG_DEVCTRL		0x00
+
+# define ATA_STATUS_ERR			0x01
+# define ATA_STATUS_DRQ			0x08
+# define ATA_STATUS_DF			0x20
+# define ATA_STATUS_BSY			0x80
+# define ATA_DEVCTRL_NIEN		0x02
+# define ATA_DRIVE_LBA			0xE0
+
+# define ATA_CMD_READ_DMA		0xC8
+# define ATA_CMD_READ_DMA_EXT	0x25
+# define ATA_CMD_WRITE_DMA		0xCA
+# define ATA_CMD_WRITE_DMA_EXT	0x35
+# define ATA_CMD_IDENTIFY		0xEC
+
+/* Bus master IDE registers, offsets from PCI BAR4 (+8 for the secondary channel) */
+# define BM_REG_COMMAND			0x00
+# define BM_REG_STATUS			0x02
+# define BM_REG_PRD				0x04
+# define BM_CHANNEL_STRIDE		0x08
+# define BM_CMD_START			0x01
+# define BM_CMD_READ			0x08	// the bus master writes to memory
+# define BM_STATUS_ERROR		0x02
+# define BM_STATUS_IRQ			0x04
+
+# define ATA_PRD_END			0x8000
+# define ATA_PRD_BOUNDARY		0x10000	// a PRD entry can neither cross nor exceed 64K
+# define ATA_MAX_SECTORS_LBA28	256
+# define ATA_MAX_MERGE_SECTORS	2048	// upper bound of a merged command, 1 MB
+
+# define ATA_SECTORS_PER_BLOCK	(BLOCK_SIZE / ATA_SECTOR_SIZE)
+# define ATA_BLOCK_BATCH		64		// block I/Os queued at once by the block device backend
+
+# define ATA_BENCH_DEPTH		64		// requests in flight during disk bench
+# define ATA_BENCH_SEQ_PAGES	4096	// 16 MB of sequential transfers
+# define ATA_BENCH_RANDOM_OPS	2048
+
+/* Physical Region Descriptor: one contiguous piece of a DMA transfer */
+typedef struct AtaPrd {
+	uint32_t	address;
+	uint16_t	byte_count;		// 0 means 64K
+	uint16_t	flags;
+} __attribute__((packed)) ata_prd_t;
+
+# define ATA_PRD_MAX			(PAGE_SIZE / sizeof(ata_prd_t))
+
+enum ata_request_status {
+	ATA_REQUEST_QUEUED,
+	ATA_REQUEST_DONE,
+	ATA_REQUEST_ERROR,
+};
+
+/* A transfer of count sectors between the disk and a physically contiguous,
+   2-byte aligned buffer. Queued requests are kept sorted by drive and LBA,
+   and adjacent ones are merged into a single DMA command. */
+typedef struct AtaRequest {
+	uint64_t				lba;
+	void*					buffer;
+	uint32_t				count;
+	uint8_t					drive;
+	bool					write;
+	volatile uint8_t		status;
+	struct AtaRequest*		next;
+} ata_request_t;
+
+typedef struct AtaDrive {
+	bool		present;
+	bool		lba48;
+	uint8_t		channel;
+	uint8_t		slave;
+	uint64_t	sectors;
+	char		model[41];
+} ata_drive_t;
+
+typedef struct AtaChannel {
+	bool			present;
+	bool			polled;		// no interrupt line: completions are polled
+	uint8_t			irq;
+	uint8_t			selected;
+	uint16_t		io_base;
+	uint16_t		ctrl_base;
+	uint16_t		bm_base;
+	ata_prd_t*		prd;
+	ata_request_t*	queue;		// sorted by drive then LBA
+	ata_request_t*	active;		// merged requests of the command in flight
+	uint64_t		position;	// end of the last command, for the C-LOOK order
+} ata_channel_t;
+
+typedef struct AtaStats {
+	uint32_t	requests;
+	uint32_t	commands;
+	uint32_t	merged;
+	uint32_t	errors;
+} ata_stats_t;
+
+void				ata_init(void);
+const ata_drive_t*	ata_drive(const uint8_t drive);
+void				ata_submit(ata_request_t* request);
+void				ata_wait(ata_request_t* request);
+int					ata_read(const uint8_t drive, const uint64_t lba, const uint32_t count, void* buffer);
+int					ata_write(const uint8_t drive, const uint64_t lba, const uint32_t count, const void* buffer);
+void				ata_list(void);
+void				ata_bench(void);
+
+#endif // _ATA_H_
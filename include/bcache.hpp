@@ -0,0 +1,55 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.hpp"
+
+#ifndef _BCACHE_H_
+# define _BCACHE_H_
+
+# define BCACHE_BUFFERS			256		// one page each, 1 MB of cache
+# define BCACHE_HASH_BITS		9
+# define BCACHE_HASH_SIZE		(1 << BCACHE_HASH_BITS)	// at least twice BCACHE_BUFFERS
+# define BCACHE_FLUSH_BATCH		32		// dirty buffers written per flush
+# define BCACHE_FLUSH_AGE		50		// ticks a buffer may stay dirty before the background flush
+# define BCACHE_FLUSH_THRESHOLD	(BCACHE_BUFFERS / 4)
+# define BCACHE_READAHEAD		16		// blocks fetched ahead of a sequential reader
+# define BCACHE_SCAN_BLOCKS		4096	// blocks read by 'bcache scan'
+# define BCACHE_REWRITE_BLOCKS	64		// blocks dirtied by 'bcache rewrite'
+
+# define BUFFER_VALID			0x01
+# define BUFFER_DIRTY			0x02
+# define BUFFER_REFERENCED		0x04	// clock bit, set on every access
+# define BUFFER_READAHEAD		0x08	// brought in by read-ahead and not used yet
+
+typedef struct Buffer {
+	block_device_t*	dev;
+	uint64_t		block;
+	uint8_t*		data;
+	uint32_t		dirty_tick;
+	uint16_t		refcount;
+	uint8_t			flags;
+	struct Buffer*	dirty_next;
+} buffer_t;
+
+typedef struct BcacheStats {
+	uint32_t	hits;
+	uint32_t	misses;
+	uint32_t	readahead;
+	uint32_t	readahead_hits;
+	uint32_t	evictions;
+	uint32_t	writebacks;
+	uint32_t	flushes;
+	uint32_t	errors;
+} bcache_stats_t;
+
+void		bcache_init(void);
+buffer_t*	bcache_read(block_device_t* dev, const uint64_t block);
+void		bcache_mark_dirty(buffer_t* buffer);
+void		bcache_release(buffer_t* buffer);
+void		bcache_sync(void);
+void		bcache_flush_background(void);
+void		bcache_print_stats(void);
+void		bcache_scan(block_device_t* dev);
+void		bcache_rewrite(block_device_t* dev);
+
+#endif // _BCACHE_H_
@@ -0,0 +1,37 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _BLOCK_H_
+# define _BLOCK_H_
+
+# define BLOCK_SIZE			4096
+# define BLOCK_DEVICES		8
+# define BLOCK_NAME_LEN		8
+
+/* One block of a batched transfer */
+typedef struct BlockIo {
+	uint64_t	block;
+	void*		buffer;
+	bool		write;
+	bool		error;
+} block_io_t;
+
+/* A device addressed in BLOCK_SIZE blocks. transfer() runs a whole batch of
+   block I/Os at once so that the driver can reorder and merge them, and
+   returns the number of failed ones. */
+typedef struct BlockDevice {
+	char		name[BLOCK_NAME_LEN];
+	uint8_t		id;
+	bool		read_only;
+	uint64_t	blocks;
+	void*		data;
+	size_t		(*transfer)(struct BlockDevice* dev, block_io_t* ios, const size_t count);
+} block_device_t;
+
+block_device_t*	block_register(const char* name, const uint64_t blocks, const bool read_only, void* data,
+					size_t (*transfer)(block_device_t* dev, block_io_t* ios, const size_t count));
+block_device_t*	block_find(const char* name);
+block_device_t*	block_device(const size_t index);
+block_device_t*	ramdisk_create(const char* name, const uintptr_t start, const uintptr_t end, const bool read_only);
+
+#endif // _BLOCK_H_
@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _CONSOLE_H_
+# define _CONSOLE_H_
+
+/* With CONSOLE_FB (make CONSOLE=fb, the default), the terminal draws in a
+   RAM copy of the cells, rendered into the linear framebuffer GRUB set up.
+   Otherwise it writes straight into the VGA text buffer, and the functions
+   below do nothing. */
+
+# ifdef KFS_HOST
+extern uint16_t	host_text_aperture[];
+#  define CONSOLE_TEXT_BUFFER	((uintptr_t) host_text_aperture)
+# else
+#  define CONSOLE_TEXT_BUFFER	0xB8000
+# endif
+# define CONSOLE_TEXT_WIDTH		80
+# define CONSOLE_TEXT_HEIGHT	25
+# define CONSOLE_TEXT_APERTURE	0x8000		// what the CRTC start address can pan across
+
+# ifdef CONSOLE_FB
+
+/* Requested by the multiboot header in boot.asm, which must be kept in sync:
+   160x64 cells of 8x16 pixels */
+#  define CONSOLE_WIDTH			160
+#  define CONSOLE_HEIGHT		64
+#  define CONSOLE_CELL_WIDTH	8
+#  define CONSOLE_CELL_HEIGHT	16
+#  define CONSOLE_DEPTH			32
+
+/* The 8x8 font is drawn with every row doubled */
+#  define FONT_WIDTH			8
+#  define FONT_HEIGHT			8
+#  define FONT_SCALE			(CONSOLE_CELL_HEIGHT / FONT_HEIGHT)
+#  define FONT_FIRST			0x20
+#  define FONT_LAST				0x7E
+#  define FONT_GLYPHS			(FONT_LAST - FONT_FIRST + 1)
+
+/* Color pairs with their glyphs expanded to pixels at once */
+#  define CONSOLE_GLYPH_SLOTS	8
+/* Timer ticks between two flushes while a command keeps the CPU busy */
+#  define CONSOLE_FLUSH_TICKS	4
+#  define CONSOLE_CURSOR_ROWS	2
+
+extern const uint8_t	font_8x8[FONT_GLYPHS][FONT_HEIGHT];
+
+uint16_t*	console_init(void);
+void		console_dirty(const size_t y, const size_t height);
+void		console_cursor(const size_t x, const size_t y);
+void		console_flush(void);
+void		console_tick(const uint32_t ticks);
+void		console_poll(void);
+void		console_print(void);
+
+# else
+
+#  define CONSOLE_WIDTH			CONSOLE_TEXT_WIDTH
+#  define CONSOLE_HEIGHT		CONSOLE_TEXT_HEIGHT
+
+inline uint16_t* console_init(void) {
+	return (uint16_t*) CONSOLE_TEXT_BUFFER;
+}
+
+inline void console_dirty(const size_t, const size_t) {
+}
+
+inline void console_flush(void) {
+}
+
+inline void console_tick(const uint32_t) {
+}
+
+inline void console_poll(void) {
+}
+
+# endif
+
+#endif // _CONSOLE_H_
@@ -0,0 +1,18 @@
+#include <stdint.h>
+
+#ifndef _CPUSTATS_H_
+# define _CPUSTATS_H_
+
+/* Events counted as they happen, for time to report what a command cost.
+   Plain increments on the one CPU: an interrupt landing in the middle of
+   one can at worst make it lose a count. */
+typedef struct CpuStats {
+	uint32_t	port_io;			// in and out of any width
+	uint32_t	cursor_updates;
+	uint32_t	cells;				// written to the screen
+	uint32_t	interrupts;			// IRQs and MSIs
+} cpu_stats_t;
+
+extern cpu_stats_t	cpu_stats;
+
+#endif // _CPUSTATS_H_
@@ -0,0 +1,48 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _ELF_H_
+# define _ELF_H_
+
+# define ELF_MAGIC			0x464C457F	// "\x7FELF"
+# define ELF_CLASS_32		1
+# define ELF_DATA_LSB		1
+# define ELF_TYPE_EXEC		2
+# define ELF_MACHINE_386	3
+# define ELF_PT_LOAD		1
+
+typedef struct Elf32Header {
+	uint32_t	magic;
+	uint8_t		elf_class;
+	uint8_t		data;
+	uint8_t		ident_version;
+	uint8_t		ident_pad[9];
+	uint16_t	type;
+	uint16_t	machine;
+	uint32_t	version;
+	uint32_t	entry;
+	uint32_t	phoff;
+	uint32_t	shoff;
+	uint32_t	flags;
+	uint16_t	ehsize;
+	uint16_t	phentsize;
+	uint16_t	phnum;
+	uint16_t	shentsize;
+	uint16_t	shnum;
+	uint16_t	shstrndx;
+} __attribute__((packed)) elf32_header_t;
+
+typedef struct Elf32ProgramHeader {
+	uint32_t	type;
+	uint32_t	offset;
+	uint32_t	vaddr;
+	uint32_t	paddr;
+	uint32_t	filesz;
+	uint32_t	memsz;
+	uint32_t	flags;
+	uint32_t	align;
+} __attribute__((packed)) elf32_program_header_t;
+
+const char*	elf_load(const uint8_t* image, const size_t size, const uintptr_t start, const uintptr_t end, uint32_t* entry);
+
+#endif // _ELF_H_
@@ -0,0 +1,37 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _FPU_H_
+# define _FPU_H_
+
+# define FPU_STATE_SIZE		512		// FXSAVE area, FSAVE only needs 108 bytes
+# define MXCSR_DEFAULT		0x1F80	// all SIMD exceptions masked, round to nearest
+
+# define CR0_MP				(1 << 1)
+# define CR0_EM				(1 << 2)
+# define CR0_TS				(1 << 3)
+# define CR0_NE				(1 << 5)
+# define CR4_OSFXSR			(1 << 9)
+# define CR4_OSXMMEXCPT		(1 << 10)
+# define CPUID_FPU			(1 << 0)
+# define CPUID_FXSR			(1 << 24)
+# define CPUID_SSE			(1 << 25)
+# define CPUID_SSE2			(1 << 26)
+
+/* FPU/SSE registers of one execution context. They are only saved when
+   another context needs the unit: switching just sets CR0.TS, and the first
+   FPU instruction after it traps (#NM) to do the actual swap. */
+typedef struct alignas(16) FpuContext {
+	uint8_t	state[FPU_STATE_SIZE];
+	bool	initialized;
+} fpu_context_t;
+
+void		fpu_init(void);
+bool		fpu_has_sse2(void);
+void		fpu_context_init(fpu_context_t* context);
+void		fpu_switch(fpu_context_t* context);
+void		fpu_release(fpu_context_t* context);
+uint32_t	fpu_kernel_begin(void);
+void		fpu_kernel_end(const uint32_t flags);
+
+#endif // _FPU_H_
@@ -0,0 +1,16 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _HEXDUMP_H_
+# define _HEXDUMP_H_
+
+/* "address  hex bytes  |ascii|", 16 bytes a row: 78 characters with byte units */
+# define HEXDUMP_ROW_BYTES	16
+# define HEXDUMP_LINE		96
+# define HEXDUMP_MAX_UNIT	8
+
+void	hexdump(const uintptr_t addr, const size_t len, const size_t unit, const bool serial);
+void	hexdump_command(const char* addr, const char* len, const char* target);
+void	examine_command(const char* format, const char* addr);
+
+#endif // _HEXDUMP_H_
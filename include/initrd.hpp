@@ -0,0 +1,59 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _INITRD_H_
+# define _INITRD_H_
+
+# define INITRD_MODULE		"initrd"
+# define INITRD_MAX_FILES	128
+# define INITRD_HASH_SIZE	256		// power of two, at least twice INITRD_MAX_FILES
+# define INITRD_PATH_MAX	256
+
+# define TAR_BLOCK_SIZE		512
+# define TAR_TYPE_FILE		'0'
+# define TAR_TYPE_OLD_FILE	'\0'
+# define TAR_TYPE_DIRECTORY	'5'
+
+typedef struct TarHeader {
+	char	name[100];
+	char	mode[8];
+	char	uid[8];
+	char	gid[8];
+	char	size[12];
+	char	mtime[12];
+	char	checksum[8];
+	char	typeflag;
+	char	linkname[100];
+	char	magic[6];
+	char	version[2];
+	char	uname[32];
+	char	gname[32];
+	char	devmajor[8];
+	char	devminor[8];
+	char	prefix[155];
+	char	pad[12];
+} __attribute__((packed)) tar_header_t;
+
+/* A file of the initrd. Its path and its content both point straight into
+   the module memory: nothing is ever copied out of the archive. */
+typedef struct InitrdFile {
+	const char*		prefix;
+	const char*		name;
+	const uint8_t*	data;
+	size_t			size;
+	uint32_t		hash;
+	uint8_t			prefix_len;
+	uint8_t			name_len;
+	bool			directory;
+} initrd_file_t;
+
+bool					initrd_init(const uintptr_t start, const uintptr_t end);
+const initrd_file_t*	initrd_lookup(const char* path);
+size_t					initrd_read(const initrd_file_t* file, const size_t offset, const uint8_t** data);
+size_t					initrd_file_count(void);
+const initrd_file_t*	initrd_file(const size_t index);
+size_t					initrd_path(const initrd_file_t* file, char* buf, const size_t size);
+void					initrd_ls(const char* path);
+void					initrd_cat(const char* path);
+
+#endif // _INITRD_H_
@@ -0,0 +1,120 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _INTERRUPTS_H_
+# define _INTERRUPTS_H_
+
+# define EXCEPTION_COUNT	32
+# define EXCEPTION_UD	6		// invalid opcode
+# define EXCEPTION_NM	7		// device not available
+# define EXCEPTION_GP	13		// general protection
+# define EXCEPTION_PF	14		// page fault
+# define IRQ_COUNT		16
+# define IRQ_HANDLERS	4		// drivers sharing a line
+# define IRQ_CASCADE	2
+# define IRQ_ATA_PRIMARY	14
+# define IRQ_ATA_SECONDARY	15
+# define PIC_EOI		0x20
+# define PIC_READ_ISR	0x0B
+# define EFLAGS_IF		(1 << 9)
+
+/* The local APIC receives the MSI messages. The PICs stay connected through
+   LINT0 in virtual wire mode. */
+# define CPUID_APIC				(1 << 9)
+# define MSR_APIC_BASE			0x1B
+# define APIC_BASE_ENABLE		(1 << 11)
+# define APIC_BASE_FRAME		0xFFFFF000
+# define LAPIC_ID				0x20
+# define LAPIC_TPR				0x80
+# define LAPIC_EOI				0xB0
+# define LAPIC_SVR				0xF0
+# define LAPIC_LVT_TIMER		0x320
+# define LAPIC_LVT_LINT0		0x350
+# define LAPIC_LVT_LINT1		0x360
+# define LAPIC_LVT_ERROR		0x370
+# define LAPIC_SVR_ENABLE		0x100
+# define LAPIC_LVT_MASKED		0x10000
+# define LAPIC_LVT_NMI			0x400
+# define LAPIC_LVT_EXTINT		0x700
+# define LAPIC_SPURIOUS_VECTOR	0xFF
+
+// Fixed delivery to the boot processor, edge triggered: the vector is the whole message data
+# define MSI_ADDRESS			0xFEE00000
+# define MSI_VECTOR_START		0x30
+# define MSI_COUNT				16
+
+typedef void (*irq_handler_t)(const uint8_t irq);
+
+/* Stack built by the exception stubs, up to what the CPU pushed. user_esp
+   and user_ss are only there when the exception came from ring 3. */
+typedef struct ExceptionFrame {
+	uint32_t	edi, esi, ebp, esp, ebx, edx, ecx, eax;
+	uint32_t	vector;
+	uint32_t	error;
+	uint32_t	eip;
+	uint32_t	cs;
+	uint32_t	eflags;
+	uint32_t	user_esp;
+	uint32_t	user_ss;
+} exception_frame_t;
+
+/* Returns true if the exception was handled and execution can resume */
+typedef bool (*exception_handler_t)(exception_frame_t* frame);
+
+extern "C" void (*const irq_stubs[IRQ_COUNT])();
+extern "C" void (*const exception_stubs[EXCEPTION_COUNT])();
+extern "C" void (*const msi_stubs[MSI_COUNT])();
+extern "C" void lapic_spurious_stub();
+
+extern "C" void	exception_dispatch(exception_frame_t* frame);
+void	exception_register(const uint8_t vector, const exception_handler_t handler);
+
+bool	irq_register(const uint8_t irq, const irq_handler_t handler);
+void	irq_unmask(const uint8_t irq);
+void	irq_mask(const uint8_t irq);
+
+void		msi_init(void);
+uint8_t		msi_register(const irq_handler_t handler);
+uint32_t	msi_address(void);
+
+# ifdef KFS_HOST
+
+/* The host build has no interrupts to mask: the harness calls isr_keyboard()
+   itself, between two commands */
+inline uint32_t irq_save(void) {
+	return EFLAGS_IF;
+}
+
+inline void irq_restore(const uint32_t) {
+}
+
+inline void irq_wait(void) {
+}
+
+# else
+
+/* Disables interrupts and returns the previous EFLAGS, to be given back to
+   irq_restore() */
+inline uint32_t irq_save(void) {
+	uint32_t flags;
+
+	__asm__ volatile ("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+	return flags;
+}
+
+inline void irq_restore(const uint32_t flags) {
+	if (flags & EFLAGS_IF) {
+		__asm__ volatile ("sti" : : : "memory");
+	}
+}
+
+/* Sleeps until the next interrupt. Must be called with interrupts disabled
+   after checking the wake up condition: sti only takes effect after hlt
+   starts, so an interrupt can't slip in between. */
+inline void irq_wait(void) {
+	__asm__ volatile ("sti\n\thlt\n\tcli" : : : "memory");
+}
+
+# endif
+
+#endif // _INTERRUPTS_H_
@@ -2,11 +2,25 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "console.hpp"
+#include "cpustats.hpp"
+
 #ifndef _KERNEL_H_
 # define _KERNEL_H_
 
 # define EMPTY	' '
 
+/* Boot-only code and data: placed in .init.text/.init.data by linker.ld and
+   released by free_init_memory() once kmain() is done initializing. */
+# define __init		__attribute__((section(".init.text"), cold))
+# define __initdata	__attribute__((section(".init.data")))
+/* Code run on every interrupt, packed at the start of .text */
+# define __hot		__attribute__((hot))
+/* Built-in code and data run in ring 3, kept apart in the .user section.
+   Such code may only call always_inline helpers. */
+# define __user		__attribute__((section(".user.text"), noinline))
+# define __userdata	__attribute__((section(".user.data")))
+
 # define PIC1			0x20		/* IO base address for master PIC */
 # define PIC2			0xA0		/* IO base address for slave PIC */
 # define IRQ_START		0x20
@@ -32,22 +46,26 @@
 # define ICW4_SFNM		0x10		/* Special fully nested (not) */
 
 # define IDT_ENTRIES		256
-# define GDT_ENTRIES		7
+# define GDT_ENTRIES		12
 # define KEYBOARD_INTERRUPT_IRQ	1
 # define GDT_CODE_SEGMENT	0x8
+# define GDT_DATA_SEGMENT	0x10
+# define GDT_SYSENTER_CODE	0x38		// entries 7 to 10 follow the layout SYSENTER/SYSEXIT expect
+# define GDT_USER_CODE		(0x48 | 3)
+# define GDT_USER_DATA		(0x50 | 3)
+# define GDT_TSS			0x58
 # define TYPE_INTERRUPT_GATE 0xE
 # define DPL_KERNEL 0x0			// full privileges
+# define DPL_USER 0x60			// reachable with int from ring 3
 # define P_PRESENT 0b10000000	// bit 7 set to 1
 # define DEFAULT_FLAG	TYPE_INTERRUPT_GATE | DPL_KERNEL | P_PRESENT
 
-# define VGA_WIDTH		80
-# define VGA_HEIGHT		25
+# define VGA_WIDTH		CONSOLE_WIDTH
+# define VGA_HEIGHT		CONSOLE_HEIGHT
 # define MAX_TTY		10
 # define MAX_HISTORY	32
 # define TERMINAL_PROMPT		"kfs> "
 # define TERMINAL_PROMPT_LEN	5 // kstrlen of TERMINAL_PROMPT
-# define TERMINAL_BUFFER	0xB8000
-# define TERMINAL_LIMIT		TERMINAL_BUFFER + (VGA_WIDTH * VGA_HEIGHT * 2)
 
 typedef struct InterruptDescriptorRegister32 {
 	uint16_t	size;
@@ -76,6 +94,26 @@ typedef struct GlobalDescriptor32 {
     uint8_t		base_high;		// Base (8 bits)
 } __attribute__((packed)) GDT_t;
 
+/* Only esp0/ss0 are used: the stack the CPU switches to when ring 3 is
+   interrupted. There is no I/O bitmap, so user code can't touch any port. */
+typedef struct TaskStateSegment {
+	uint32_t	prev_task;
+	uint32_t	esp0;
+	uint32_t	ss0;
+	uint32_t	esp1;
+	uint32_t	ss1;
+	uint32_t	esp2;
+	uint32_t	ss2;
+	uint32_t	cr3;
+	uint32_t	eip;
+	uint32_t	eflags;
+	uint32_t	eax, ecx, edx, ebx, esp, ebp, esi, edi;
+	uint32_t	es, cs, ss, ds, fs, gs;
+	uint32_t	ldt;
+	uint16_t	trap;
+	uint16_t	iomap_base;
+} __attribute__((packed)) tss_t;
+
 /* Hardware text mode color constants. */
 enum vga_color {
 	VGA_COLOR_BLACK = 0,
@@ -98,23 +136,74 @@ enum vga_color {
 
 # define DEFAULT_COLOR	vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK)
 
-extern size_t		terminal_row[MAX_TTY];
-extern size_t		terminal_column[MAX_TTY];
-extern size_t		terminal_written_column[MAX_TTY];
-extern uint8_t		terminal_color[MAX_TTY];
+# define CACHE_LINE_SIZE	64
+
+/* State of one virtual terminal. The geometry is a template parameter so that
+   every index computation and bound check below folds to a constant.
+   Everything a keystroke reads or writes sits in the first cache line; the
+   screen backup and the history are only touched on tty swap and history
+   navigation. */
+template <size_t Width, size_t Height>
+struct alignas(CACHE_LINE_SIZE) Tty {
+	static constexpr size_t	width = Width;
+	static constexpr size_t	height = Height;
+	static constexpr size_t	cells = Width * Height;
+	static constexpr size_t	prompt_row = Height - 1;
+
+	size_t		row;
+	size_t		column;
+	size_t		written_column;
+	size_t		history_total_index;
+	int			history_current_index;
+	uint8_t		color;
+	uint8_t		prompt_color;
+
+	alignas(CACHE_LINE_SIZE) uint16_t	screen[cells];
+	uint16_t	history[MAX_HISTORY][Width];
+
+	static constexpr size_t index(const size_t x, const size_t y) {
+		return y * Width + x;
+	}
+
+	static constexpr size_t prompt_index(const size_t x) {
+		return index(x, prompt_row);
+	}
+
+	size_t cursor_index(void) const {
+		return index(column, row);
+	}
+};
+
+typedef Tty<VGA_WIDTH, VGA_HEIGHT> tty_t;
+
+static_assert(offsetof(tty_t, screen) == CACHE_LINE_SIZE, "tty metadata must fit in one cache line");
+
 extern uint16_t*	terminal_buffer;
-extern uint16_t		tty[MAX_TTY][VGA_WIDTH * VGA_HEIGHT];
-extern uint8_t		curr_tty;
+extern tty_t		ttys[MAX_TTY];
+extern tty_t*		curr_tty;
 
 
 extern "C" void isr_wrapper();
 
-void terminal_putentryat(const char c, const uint8_t color, const size_t x, const size_t y);
+inline uint8_t vga_entry_color(const enum vga_color fg, const enum vga_color bg) {
+	return fg | bg << 4;
+}
+
+inline uint16_t vga_entry(const unsigned char uc, const uint8_t color) {
+	return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+inline void terminal_putentryat(const char c, const uint8_t color, const size_t x, const size_t y) {
+	terminal_buffer[tty_t::index(x, y)] = vga_entry(c, color);
+	++cpu_stats.cells;
+	console_dirty(y, 1);
+}
+
+void terminal_initialize(void);
 void terminal_putchar(const char c);
 void terminal_insert_char(const char c);
 void terminal_writestring(const char* data);
-uint8_t vga_entry_color(const enum vga_color fg, const enum vga_color bg);
-uint16_t vga_entry(const unsigned char uc, const uint8_t color);
+void terminal_scroll(const size_t lines);
 size_t kstrlen(const char* str);
 void display_42(void);
 
@@ -1,25 +1,6 @@
 #ifndef _KEYBOARD_H_
 # define _KEYBOARD_H_
 
-# define QWERTY_KEYBOARD_TABLE { \
-    {0, 0}, {0, 0}, {'1', '!'}, {'2', '@'}, {'3', '#'}, {'4', '$'}, {'5', '%'}, {'6', '^'}, \
-    {'7', '&'}, {'8', '*'}, {'9', '('}, {'0', ')'}, {'-', '_'}, {'=', '+'}, {0, 0}, {0, 0}, \
-    {'q', 'Q'}, {'w', 'W'}, {'e', 'E'}, {'r', 'R'}, {'t', 'T'}, {'y', 'Y'}, {'u', 'U'}, {'i', 'I'}, \
-    {'o', 'O'}, {'p', 'P'}, {'[', '{'}, {']', '}'}, {0, 0}, {0, 0}, {'a', 'A'}, {'s', 'S'}, \
-    {'d', 'D'}, {'f', 'F'}, {'g', 'G'}, {'h', 'H'}, {'j', 'J'}, {'k', 'K'}, {'l', 'L'}, {';', ':'}, \
-    {'\'', '"'}, {'`', '~'}, {0, 0}, {'\\', '|'}, {'z', 'Z'}, {'x', 'X'}, {'c', 'C'}, {'v', 'V'}, \
-    {'b', 'B'}, {'n', 'N'}, {'m', 'M'}, {',', '<'}, {'.', '>'}, {'/', '?'}, {0, 0}, {'*', '*'}, \
-    {0, 0}, {' ', ' '}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
-    {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
-    {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
-    {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
-    {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
-    {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
-    {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
-    {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
-    {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0} \
-};
-
 # define TERMINAL_PROMPT_COLORS { \
     { VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK }, \
     { VGA_COLOR_BLUE, VGA_COLOR_BLACK }, \
@@ -77,10 +58,14 @@
 
 
 
+# define KEYBOARD_QUEUE_SIZE	64	// scan codes kept while a command runs, divides 256
+
 # define EXTENDED_BYTE	0xE0
 /* Extended Bytes sent after 0xE0 */
 # define EXTENDED_ENTER_PRESS	0x1C
 # define DELETE_PRESS 	0x53
+# define RALT_PRESS		0x38		// AltGr
+# define RALT_RELEASE	0xB8
 
 # define CURSOR_RIGHT_PRESS	0x4d
 # define CURSOR_LEFT_PRESS	0x4B
@@ -89,8 +74,14 @@
 
 
 void terminal_prompt(void);
+void terminal_print_line(const char* str);
+void terminal_printf(const char* format, ...);
 void swap_tty(const uint8_t new_tty);
 void init_colors(void);
 void init_history(void);
+void keyboard_reset(void);
+bool has_pending_command(void);
+void run_pending_command(void);
+void keyboard_inject(const uint8_t scan_code);
 
 #endif // _KEYBOARD_H_
\ No newline at end of file
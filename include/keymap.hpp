@@ -0,0 +1,36 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _KEYMAP_H_
+# define _KEYMAP_H_
+
+/* Modifier state, the first index of a keymap */
+# define KEYMAP_SHIFT		0x1
+# define KEYMAP_CAPS		0x2
+# define KEYMAP_ALTGR		0x4
+# define KEYMAP_STATES		8
+
+/* Second index: the scan code, plus KEYMAP_EXTENDED when it came after the
+   0xE0 prefix. Release codes have bit 7 set and map to nothing. */
+# define KEYMAP_EXTENDED	0x100
+# define KEYMAP_KEYS		0x200
+
+/* Characters a layout lists for scan codes 0x00 (none) to 0x39 (space) */
+# define KEYMAP_SOURCE_KEYS	0x3A
+# define KEYMAP_ALTGR_KEYS	16
+# define KEYMAP_ISO_KEY		0x56		// between left shift and Z on ISO keyboards
+# define KEYMAP_COUNT		3
+
+/* Every character a key gives in every modifier state, computed at compile
+   time: decoding a key press is a single load, 0 when there's no character */
+typedef struct Keymap {
+	const char*	name;
+	uint8_t		keys[KEYMAP_STATES][KEYMAP_KEYS];
+} keymap_t;
+
+extern const keymap_t*	keymap;
+
+bool	keymap_select(const char* name);
+void	keymap_print(void);
+
+#endif // _KEYMAP_H_
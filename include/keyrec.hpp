@@ -0,0 +1,34 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _KEYREC_H_
+# define _KEYREC_H_
+
+/* Scan codes as read from port 0x60, with the TSC at the interrupt */
+# define KEYREC_EVENTS		4096
+# define KEYREC_LINE		32
+
+/* Built-in streams type at about 10 keys a second, like a person */
+# define KEYREC_KEY_US		60000	// from a press to its release
+# define KEYREC_GAP_US		40000	// from a release to the next press
+
+typedef struct KeyrecEvent {
+	uint64_t	tsc;
+	uint8_t		code;
+} keyrec_event_t;
+
+extern bool	keyrec_recording;
+
+void	keyrec_store(const uint8_t code);
+
+// Called by the keyboard interrupt for every scan code: nothing to do but a test when not recording
+inline void keyrec_capture(const uint8_t code) {
+	if (keyrec_recording) {
+		keyrec_store(code);
+	}
+}
+
+void	keyrec_command(const char* action);
+void	replay_command(const char* source, const char* speed);
+
+#endif // _KEYREC_H_
@@ -0,0 +1,43 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#ifndef _KLOG_H_
+# define _KLOG_H_
+
+/* Severity levels, as in syslog */
+# define KLOG_ERR		3
+# define KLOG_WARN		4
+# define KLOG_INFO		6
+# define KLOG_DEBUG		7
+
+/* A fixed number of fixed size records: the oldest is overwritten */
+# define KLOG_RECORDS		256
+# define KLOG_RECORD_SIZE	128
+# define KLOG_TEXT_SIZE		(KLOG_RECORD_SIZE - 14)
+# define KLOG_BENCH_RECORDS	4096
+
+typedef struct KlogRecord {
+	uint64_t			tsc;
+	volatile uint32_t	commit;		// sequence number + 1 once written, 0 while being written
+	uint8_t				level;
+	uint8_t				len;
+	char				text[KLOG_TEXT_SIZE];
+} klog_record_t;
+
+/* Every consumer keeps its own position, and counts the records it missed
+   because writers went around the ring before it read them */
+typedef struct KlogReader {
+	uint32_t	seq;
+	uint32_t	lost;
+} klog_reader_t;
+
+void		klog(const uint8_t level, const char* format, ...);
+void		vklog(const uint8_t level, const char* format, va_list va_params);
+void		klog_reader_init(klog_reader_t* reader, const bool oldest);
+bool		klog_read(klog_reader_t* reader, klog_record_t* record);
+size_t		klog_format(const klog_record_t* record, char* buf, const size_t size);
+void		klog_dmesg(void);
+void		klog_bench(void);
+
+#endif // _KLOG_H_
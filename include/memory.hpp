@@ -0,0 +1,31 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _MEMORY_H_
+# define _MEMORY_H_
+
+# define PAGE_SIZE		4096
+# define PAGE_ALIGN_UP(addr)	(((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+# define PAGE_ALIGN_DOWN(addr)	((addr) & ~(PAGE_SIZE - 1))
+
+/* Bounds of the kernel image, provided by linker.ld */
+extern "C" uint8_t	__kernel_start[], __kernel_end[];
+extern "C" uint8_t	__text_start[], __text_end[];
+extern "C" uint8_t	__rodata_start[], __rodata_end[];
+extern "C" uint8_t	__data_start[], __data_end[];
+extern "C" uint8_t	__bss_start[], __bss_end[];
+extern "C" uint8_t	__user_start[], __user_end[];
+extern "C" uint8_t	__init_start[], __init_end[];
+extern "C" uint8_t	__init_text_start[], __init_text_end[];
+extern "C" uint8_t	__init_data_start[], __init_data_end[];
+
+void	init_memory(void);
+void	free_pages(uintptr_t start, uintptr_t end);
+void*	page_alloc(void);
+void	page_free(void* page);
+size_t	pages_free_count(void);
+void	free_init_memory(void);
+bool	init_memory_freed(void);
+void	print_sections(void);
+
+#endif // _MEMORY_H_
@@ -0,0 +1,65 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "paging.hpp"
+
+#ifndef _MEMTYPE_H_
+# define _MEMTYPE_H_
+
+# define CPUID_MTRR				(1 << 12)
+# define CPUID_PAT				(1 << 16)
+# define CR0_NW					(1 << 29)
+# define CR0_CD					(1 << 30)
+
+# define MSR_MTRRCAP			0xFE
+# define MSR_MTRR_PHYSBASE0		0x200
+# define MSR_MTRR_PHYSMASK0		0x201
+# define MSR_MTRR_FIX16K_A0000	0x259
+# define MSR_PAT				0x277
+# define MSR_MTRR_DEF_TYPE		0x2FF
+# define MTRRCAP_VCNT			0xFF
+# define MTRRCAP_FIX			(1 << 8)
+# define MTRRCAP_WC				(1 << 10)
+# define MTRR_ENABLE			(1 << 11)
+# define MTRR_FIXED_ENABLE		(1 << 10)
+# define MTRR_MASK_VALID		(1 << 11)
+
+# define MEMTYPE_UC				0x00
+# define MEMTYPE_WC				0x01
+# define MEMTYPE_WT				0x04
+# define MEMTYPE_WP				0x05
+# define MEMTYPE_WB				0x06
+# define MEMTYPE_UC_MINUS		0x07
+
+/* PAT entries as reprogrammed by memtype_init(), indexed by the PAT, PCD
+   and PWT page bits: entry 1 becomes WC in place of WT, which moves to 7.
+   Mappings that never set PWT alone keep their usual meaning. */
+# define PAT_LAYOUT	((uint64_t) MEMTYPE_WB | (uint64_t) MEMTYPE_WC << 8 | (uint64_t) MEMTYPE_UC_MINUS << 16 \
+	| (uint64_t) MEMTYPE_UC << 24 | (uint64_t) MEMTYPE_WB << 32 | (uint64_t) MEMTYPE_WP << 40 \
+	| (uint64_t) MEMTYPE_UC_MINUS << 48 | (uint64_t) MEMTYPE_WT << 56)
+# define PAGE_CACHE_WC			PAGE_PWT
+# define PAGE_CACHE_UC			(PAGE_PCD | PAGE_PWT)
+
+# define VGA_APERTURE_START		0xA0000
+# define VGA_APERTURE_END		0xC0000
+# define VGA_TEXT_START			0xB8000
+# define VGA_TEXT_END			0xC0000
+# define WC_BENCH_FRAMES		500
+
+/* Drains the write-combining buffers, so that the screen is up to date
+   before telling the CRTC about it. A locked operation is a full barrier
+   on every x86, unlike sfence which needs SSE. */
+inline __attribute__((always_inline)) void wc_barrier(void) {
+# ifdef KFS_HOST
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+# else
+	__asm__ volatile ("lock; orl $0, (%%esp)" : : : "memory", "cc");
+# endif
+}
+
+void		memtype_init(void);
+bool		memtype_set(const uintptr_t start, const uintptr_t end, const uint8_t type);
+const char*	memtype_method(void);
+void		memtype_bench(void);
+
+#endif // _MEMTYPE_H_
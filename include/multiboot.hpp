@@ -0,0 +1,106 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _MULTIBOOT_H_
+# define _MULTIBOOT_H_
+
+// https://www.gnu.org/software/grub/manual/multiboot/multiboot.html
+# define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+
+# define MULTIBOOT_INFO_MEMORY		(1 << 0)
+# define MULTIBOOT_INFO_CMDLINE		(1 << 2)
+# define MULTIBOOT_INFO_MODS		(1 << 3)
+# define MULTIBOOT_INFO_MEM_MAP		(1 << 6)
+# define MULTIBOOT_INFO_FRAMEBUFFER	(1 << 12)
+
+# define MULTIBOOT_MEMORY_AVAILABLE	1
+# define MULTIBOOT_FRAMEBUFFER_RGB	1
+
+# define MAX_MODULES			8
+# define MAX_MMAP_ENTRIES		32
+# define MODULE_CMDLINE_LEN		64
+
+typedef struct MultibootInfo {
+	uint32_t	flags;
+	uint32_t	mem_lower;
+	uint32_t	mem_upper;
+	uint32_t	boot_device;
+	uint32_t	cmdline;
+	uint32_t	mods_count;
+	uint32_t	mods_addr;
+	uint32_t	syms[4];
+	uint32_t	mmap_length;
+	uint32_t	mmap_addr;
+	uint32_t	drives_length;
+	uint32_t	drives_addr;
+	uint32_t	config_table;
+	uint32_t	boot_loader_name;
+	uint32_t	apm_table;
+	uint32_t	vbe_control_info;
+	uint32_t	vbe_mode_info;
+	uint16_t	vbe_mode;
+	uint16_t	vbe_interface_seg;
+	uint16_t	vbe_interface_off;
+	uint16_t	vbe_interface_len;
+	uint64_t	framebuffer_addr;
+	uint32_t	framebuffer_pitch;
+	uint32_t	framebuffer_width;
+	uint32_t	framebuffer_height;
+	uint8_t		framebuffer_bpp;
+	uint8_t		framebuffer_type;
+	uint8_t		red_position;		// direct RGB color layout, when framebuffer_type is RGB
+	uint8_t		red_size;
+	uint8_t		green_position;
+	uint8_t		green_size;
+	uint8_t		blue_position;
+	uint8_t		blue_size;
+} __attribute__((packed)) multiboot_info_t;
+
+typedef struct MultibootModule {
+	uint32_t	mod_start;
+	uint32_t	mod_end;
+	uint32_t	cmdline;
+	uint32_t	reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+typedef struct MultibootMmapEntry {
+	uint32_t	size;			// size of the entry, not counting this field
+	uint64_t	addr;
+	uint64_t	len;
+	uint32_t	type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+/* Boot information copied out of the multiboot structures, which live in
+   memory the page allocator is about to take over */
+typedef struct BootModule {
+	uintptr_t	start;
+	uintptr_t	end;
+	char		cmdline[MODULE_CMDLINE_LEN];
+} boot_module_t;
+
+/* Direct color framebuffer set up by the bootloader */
+typedef struct BootFramebuffer {
+	uintptr_t	addr;
+	uint32_t	pitch;
+	uint32_t	width;
+	uint32_t	height;
+	uint8_t		bpp;
+	uint8_t		red_position;
+	uint8_t		green_position;
+	uint8_t		blue_position;
+} boot_framebuffer_t;
+
+typedef struct BootMemoryRegion {
+	uint64_t	start;
+	uint64_t	end;
+} boot_memory_region_t;
+
+bool					multiboot_init(const uint32_t magic, const multiboot_info_t* mbi);
+size_t					boot_module_count(void);
+const boot_module_t*	boot_module(const size_t index);
+const boot_module_t*	boot_module_find(const char* cmdline);
+size_t					boot_memory_region_count(void);
+const boot_memory_region_t*	boot_memory_region(const size_t index);
+const boot_framebuffer_t*	boot_framebuffer(void);
+
+#endif // _MULTIBOOT_H_
@@ -0,0 +1,69 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _PAGING_H_
+# define _PAGING_H_
+
+# define PAGE_PRESENT		0x001
+# define PAGE_WRITE			0x002
+# define PAGE_USER			0x004
+# define PAGE_PWT			0x008
+# define PAGE_PCD			0x010
+# define PAGE_ACCESSED		0x020
+# define PAGE_DIRTY			0x040
+# define PAGE_LARGE			0x080		// PDE only: maps 4 MB directly (PSE)
+# define PAGE_GLOBAL		0x100		// kept in the TLB across CR3 loads (PGE)
+# define PAGE_FRAME			0xFFFFF000
+# define PAGE_LARGE_FRAME	0xFFC00000
+
+# define PAGE_ENTRIES		1024
+# define LARGE_PAGE_SIZE	0x400000
+# define PAGE_TABLE_INDEX(addr)		(((addr) >> 12) & (PAGE_ENTRIES - 1))
+# define PAGE_DIRECTORY_INDEX(addr)	((addr) >> 22)
+
+/* Past this many pages, a range is invalidated by reloading CR3 rather than
+   one invlpg per page. Global kernel entries survive it either way. */
+# define TLB_INVALIDATE_MAX	32
+
+# define CR0_WP				(1 << 16)
+# define CR0_PG				(1U << 31)
+# define CR4_PSE			(1 << 4)
+# define CR4_PGE			(1 << 7)
+# define CPUID_PSE			(1 << 3)
+# define CPUID_PGE			(1 << 13)
+
+/* A page directory. The kernel entries are shared by every address space,
+   only the user window [USER_BASE, USER_END[ belongs to each one. */
+typedef struct AddressSpace {
+	uint32_t*	directory;
+} address_space_t;
+
+inline __attribute__((always_inline)) void tlb_invalidate_page(const uintptr_t addr) {
+	__asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+/* Drops every non global entry */
+inline void tlb_flush(void) {
+	uint32_t cr3;
+
+	__asm__ volatile ("mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+void				paging_init(void);
+address_space_t*	kernel_space(void);
+address_space_t*	current_space(void);
+bool				address_space_create(address_space_t* space);
+void				address_space_destroy(address_space_t* space);
+void				address_space_switch(address_space_t* space);
+bool				paging_map(address_space_t* space, const uintptr_t virt, const uintptr_t phys, const uint32_t flags);
+void				paging_unmap(address_space_t* space, const uintptr_t virt);
+bool				paging_mapped(const address_space_t* space, const uintptr_t virt);
+bool				paging_map_large(address_space_t* space, const uintptr_t virt, const uintptr_t phys, const uint32_t flags);
+bool				paging_map_device(const uintptr_t start, const uintptr_t end);
+void				paging_set_cache(const uintptr_t start, const uintptr_t end, const uint32_t cache);
+void				tlb_invalidate_range(const uintptr_t start, const uintptr_t end);
+void				tlb_invalidate_table(address_space_t* space, const size_t table);
+void				tlb_flush_global(void);
+void				paging_print(void);
+
+#endif // _PAGING_H_
@@ -0,0 +1,113 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "interrupts.hpp"
+
+#ifndef _PCI_H_
+# define _PCI_H_
+
+// https://wiki.osdev.org/PCI, configuration space access mechanism #1
+# define PCI_CONFIG_ADDRESS	0xCF8
+# define PCI_CONFIG_DATA	0xCFC
+# define PCI_MAX_BUS		256
+# define PCI_MAX_DEVICE		32
+# define PCI_MAX_FUNCTION	8
+
+# define PCI_VENDOR_ID		0x00
+# define PCI_DEVICE_ID		0x02
+# define PCI_COMMAND		0x04
+# define PCI_STATUS			0x06
+# define PCI_PROG_IF		0x09
+# define PCI_SUBCLASS		0x0A
+# define PCI_CLASS			0x0B
+# define PCI_REVISION		0x08
+# define PCI_HEADER_TYPE	0x0E
+# define PCI_BAR0			0x10
+# define PCI_CAPABILITIES	0x34
+# define PCI_INTERRUPT_LINE	0x3C
+# define PCI_INTERRUPT_PIN	0x3D
+
+# define PCI_COMMAND_IO				(1 << 0)
+# define PCI_COMMAND_MEMORY			(1 << 1)
+# define PCI_COMMAND_BUS_MASTER		(1 << 2)
+# define PCI_COMMAND_INTX_DISABLE	(1 << 10)
+# define PCI_STATUS_CAPABILITIES	(1 << 4)
+# define PCI_HEADER_MASK			0x7F
+# define PCI_HEADER_MULTIFUNCTION	0x80
+# define PCI_HEADER_BRIDGE			0x01
+
+# define PCI_BAR_IO					0x01
+# define PCI_BAR_TYPE_MASK			0x06
+# define PCI_BAR_TYPE_64			0x04
+# define PCI_BAR_PREFETCH			0x08
+# define PCI_BAR_IO_MASK			0xFFFFFFFC
+# define PCI_BAR_MEMORY_MASK		0xFFFFFFF0
+
+# define PCI_CLASS_STORAGE			0x01
+# define PCI_SUBCLASS_IDE			0x01
+# define PCI_CLASS_NAMES			0x0D
+
+// https://wiki.osdev.org/PCI#Message_Signaled_Interrupts
+# define PCI_CAP_MSI				0x05
+# define PCI_CAP_VENDOR				0x09
+# define PCI_CAP_MSIX				0x11
+# define PCI_MSI_CONTROL			0x02
+# define PCI_MSI_ADDRESS			0x04
+# define PCI_MSI_DATA_32			0x08
+# define PCI_MSI_DATA_64			0x0C
+# define PCI_MSI_ENABLE				(1 << 0)
+# define PCI_MSI_MULTIPLE_MASK		(7 << 4)
+# define PCI_MSI_64					(1 << 7)
+
+/* The table filled once at boot: drivers look their device up there and
+   never scan the configuration space again */
+# define PCI_MAX_DEVICES			32
+# define PCI_BARS					6
+# define PCI_BRIDGE_BARS			2
+# define PCI_MAX_CAPABILITIES		16
+
+typedef struct PciAddress {
+	uint8_t	bus;
+	uint8_t	device;
+	uint8_t	function;
+} pci_address_t;
+
+/* base is 0 for an unimplemented BAR. A 64-bit BAR takes two slots: the
+   second one stays empty. */
+typedef struct PciBar {
+	uint64_t	base;
+	uint64_t	size;
+	uint8_t		flags;		// PCI_BAR_IO, PCI_BAR_TYPE_64, PCI_BAR_PREFETCH
+} pci_bar_t;
+
+typedef struct PciDevice {
+	pci_address_t	address;
+	uint16_t		vendor_id;
+	uint16_t		device_id;
+	uint8_t			class_code;
+	uint8_t			subclass;
+	uint8_t			prog_if;
+	uint8_t			revision;
+	uint8_t			header_type;
+	uint8_t			irq;				// legacy PIC line
+	uint8_t			msi_vector;			// 0 until pci_msi_enable()
+	uint8_t			capability_count;
+	uint8_t			capabilities[PCI_MAX_CAPABILITIES][2];	// id, offset
+	pci_bar_t		bars[PCI_BARS];
+} pci_device_t;
+
+uint32_t	pci_config_read32(const pci_address_t address, const uint8_t offset);
+uint16_t	pci_config_read16(const pci_address_t address, const uint8_t offset);
+uint8_t		pci_config_read8(const pci_address_t address, const uint8_t offset);
+void		pci_config_write32(const pci_address_t address, const uint8_t offset, const uint32_t value);
+void		pci_config_write16(const pci_address_t address, const uint8_t offset, const uint16_t value);
+
+void			pci_init(void);
+pci_device_t*	pci_find_class(const uint8_t class_code, const uint8_t subclass, const pci_device_t* after);
+pci_device_t*	pci_find_device(const uint16_t vendor_id, const uint16_t device_id, const pci_device_t* after);
+uint8_t			pci_find_capability(const pci_device_t* device, const uint8_t id, const uint8_t after);
+void			pci_enable(const pci_device_t* device, const uint16_t command);
+bool			pci_msi_enable(pci_device_t* device, const irq_handler_t handler);
+void			pci_print(void);
+
+#endif // _PCI_H_
@@ -0,0 +1,31 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _SERIAL_H_
+# define _SERIAL_H_
+
+# define SERIAL_COM1		0x3F8
+# define SERIAL_BAUD		115200
+# define SERIAL_DATA		0		// DLAB = 0
+# define SERIAL_IER			1
+# define SERIAL_DIVISOR_LOW	0		// DLAB = 1
+# define SERIAL_DIVISOR_HIGH	1
+# define SERIAL_FCR			2
+# define SERIAL_LCR			3
+# define SERIAL_MCR			4
+# define SERIAL_LSR			5
+# define SERIAL_LCR_8N1		0x03
+# define SERIAL_LCR_DLAB	0x80
+# define SERIAL_FCR_ENABLE	0xC7		// FIFOs on and cleared, 14 byte receive trigger
+# define SERIAL_MCR_NORMAL	0x0B		// DTR, RTS, OUT2
+# define SERIAL_MCR_LOOP	0x1E		// loopback, to check a UART answers
+# define SERIAL_LSR_THRE	0x20		// transmit FIFO empty
+# define SERIAL_FIFO_SIZE	16
+# define SERIAL_PROBE_BYTE	0xAE
+
+void	serial_init(void);
+bool	serial_poll(void);
+void	serial_flush(void);
+void	serial_write(const char* data, const size_t len);
+
+#endif // _SERIAL_H_
@@ -0,0 +1,39 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _SIMD_H_
+# define _SIMD_H_
+
+/* Below this, entering an SSE section costs more than it saves */
+# define SIMD_MIN_SIZE		256
+# define SIMD_BENCH_SIZE	65536
+# define SIMD_BENCH_ROUNDS	64
+
+inline __attribute__((always_inline)) void* memcpy_rep(void* dest, const void* src, size_t n) {
+	void*	d = dest;
+
+	__asm__ volatile ("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+	return dest;
+}
+
+inline __attribute__((always_inline)) void* memset_rep(void* dest, const int value, size_t n) {
+	void*	d = dest;
+
+	__asm__ volatile ("rep stosb" : "+D"(d), "+c"(n) : "a"(value) : "memory");
+	return dest;
+}
+
+inline __attribute__((always_inline)) void fill16_rep(uint16_t* dest, const uint16_t value, size_t count) {
+	__asm__ volatile ("rep stosw" : "+D"(dest), "+c"(count) : "a"(value) : "memory");
+}
+
+/* Implementations picked from CPUID by simd_init(), for large sizes */
+extern void*	(*memcpy_large)(void* dest, const void* src, size_t n);
+extern void*	(*memset_large)(void* dest, int value, size_t n);
+
+extern "C" void*	memchr(const void* ptr, int value, size_t n);
+void				fill16(uint16_t* dest, const uint16_t value, const size_t count);
+void				simd_init(void);
+void				simd_bench(void);
+
+#endif // _SIMD_H_
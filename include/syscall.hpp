@@ -0,0 +1,72 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _SYSCALL_H_
+# define _SYSCALL_H_
+
+/* System call ABI, shared with user programs: the number goes in eax, up to
+   three arguments in ebx, esi and edi, and the result comes back in eax.
+   ecx and edx are clobbered, SYSENTER needs them for the return stack and
+   address. Both entry points follow the same convention. */
+# define SYS_NULL			0
+# define SYS_EXIT			1
+# define SYS_WRITE			2
+# define SYS_COUNT			3
+# define SYSCALL_ERROR		((uint32_t) -1)
+# define SYSCALL_VECTOR		0x80
+
+/* Flags given to a user program as the argument of its entry point */
+# define USER_FLAG_SYSENTER	0x01	// the CPU supports SYSENTER, int 0x80 otherwise
+
+/* User memory: ELF programs must be linked inside it, the stack grows down
+   from its end. The page allocator never hands these pages out. */
+# define USER_BASE			0x400000
+# define USER_END			0x800000
+# define USER_STACK_TOP		USER_END
+# define USER_STACK_SIZE	0x10000		// top of user memory, kept out of the program image
+
+# define SYSCALL_STACK_SIZE		16384
+# define SYSCALL_BENCH_ITERATIONS	100000
+# define SYSCALL_BENCH_WARMUP		1000
+
+# define CPUID_SEP			(1 << 11)
+# define MSR_SYSENTER_CS	0x174
+# define MSR_SYSENTER_ESP	0x175
+# define MSR_SYSENTER_EIP	0x176
+
+inline __attribute__((always_inline)) uint32_t syscall_sysenter(const uint32_t number,
+		const uint32_t arg1 = 0, const uint32_t arg2 = 0, const uint32_t arg3 = 0) {
+	uint32_t ret;
+
+	__asm__ volatile (
+		"movl %%esp, %%ecx\n\t"
+		"leal 1f, %%edx\n\t"
+		"sysenter\n"
+		"1:"
+		: "=a"(ret) : "0"(number), "b"(arg1), "S"(arg2), "D"(arg3) : "ecx", "edx", "memory");
+	return ret;
+}
+
+inline __attribute__((always_inline)) uint32_t syscall_int80(const uint32_t number,
+		const uint32_t arg1 = 0, const uint32_t arg2 = 0, const uint32_t arg3 = 0) {
+	uint32_t ret;
+
+	__asm__ volatile ("int $0x80"
+		: "=a"(ret) : "0"(number), "b"(arg1), "S"(arg2), "D"(arg3) : "ecx", "edx", "memory");
+	return ret;
+}
+
+/* Kernel side */
+extern "C" int		user_enter(const uint32_t eip, const uint32_t esp);
+extern "C" void		user_return(const int status) __attribute__((noreturn));
+extern "C" void		sysenter_entry(void);
+extern "C" void		syscall_int80_entry(void);
+extern "C" uint32_t	syscall_dispatch(const uint32_t number, const uint32_t arg1, const uint32_t arg2, const uint32_t arg3);
+
+void	syscall_init(void);
+bool	user_running(void);
+void	user_kill(const int status) __attribute__((noreturn));
+int		user_exec(const char* path);
+void	syscall_bench(void);
+
+#endif // _SYSCALL_H_
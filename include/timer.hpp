@@ -0,0 +1,36 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _TIMER_H_
+# define _TIMER_H_
+
+# define PIT_FREQUENCY		1193182
+# define PIT_CHANNEL0		0x40
+# define PIT_CHANNEL2		0x42
+# define PIT_COMMAND		0x43
+# define PIT_GATE_PORT		0x61
+# define PIT_GATE			0x01
+# define PIT_SPEAKER		0x02
+# define PIT_OUT2			0x20
+# define TSC_CALIBRATION_MS	10
+# define TIMER_IRQ			0
+# define TIMER_HZ			100
+
+extern uint32_t				tsc_khz;
+extern volatile uint32_t	timer_ticks;
+
+// Always inlined: also used by the ring 3 code of .user.text
+inline __attribute__((always_inline)) uint64_t rdtsc(void) {
+	uint32_t low, high;
+
+	__asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t) high << 32) | low;
+}
+
+void		tsc_calibrate(void);
+void		timer_init(void);
+uint64_t	tsc_to_us(const uint64_t cycles);
+uint64_t	tsc_to_ns(const uint64_t cycles);
+void		udelay(const uint32_t us);
+
+#endif // _TIMER_H_
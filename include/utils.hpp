@@ -1,6 +1,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdarg.h>
+
+#include "cpustats.hpp"
 
 #ifndef _UTILS_H_
 # define _UTILS_H_
@@ -9,18 +12,131 @@ void    update_cursor(size_t x, size_t y);
 void    move_cursor_left();
 void    move_cursor_right();
 
-void    outb(const uint16_t port, const uint8_t val);
-uint8_t inb(uint16_t port);
+# ifdef KFS_HOST
+
+/* The host build (make host-bench) records port accesses instead */
+void		outb(const uint16_t port, const uint8_t val);
+uint8_t		inb(uint16_t port);
+void		outw(const uint16_t port, const uint16_t val);
+uint16_t	inw(uint16_t port);
+void		outl(const uint16_t port, const uint32_t val);
+uint32_t	inl(uint16_t port);
+
+# else
+
+inline void outb(const uint16_t port, const uint8_t val) {
+    ++cpu_stats.port_io;
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port) : "memory");
+}
+
+inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    ++cpu_stats.port_io;
+    __asm__ volatile ( "inb %w1, %b0"
+                   : "=a"(ret)
+                   : "Nd"(port)
+                   : "memory");
+    return ret;
+}
+
+inline void outw(const uint16_t port, const uint16_t val) {
+    ++cpu_stats.port_io;
+    __asm__ volatile ("outw %0, %1" : : "a"(val), "Nd"(port) : "memory");
+}
+
+inline uint16_t inw(uint16_t port) {
+    uint16_t ret;
+    ++cpu_stats.port_io;
+    __asm__ volatile ("inw %w1, %w0" : "=a"(ret) : "Nd"(port) : "memory");
+    return ret;
+}
+
+inline void outl(const uint16_t port, const uint32_t val) {
+    ++cpu_stats.port_io;
+    __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(port) : "memory");
+}
+
+inline uint32_t inl(uint16_t port) {
+    uint32_t ret;
+    ++cpu_stats.port_io;
+    __asm__ volatile ("inl %w1, %0" : "=a"(ret) : "Nd"(port) : "memory");
+    return ret;
+}
+
+# endif
+
+/* Moves the VGA text mode hardware cursor to cell pos */
+inline void crtc_cursor(const uint16_t pos) {
+    outb(0x3D4, 0x0F);
+    outb(0x3D5, (uint8_t) (pos & 0xFF));
+    outb(0x3D4, 0x0E);
+    outb(0x3D5, (uint8_t) ((pos >> 8) & 0xFF));
+}
+
+/* First cell the VGA text mode shows, in the aperture */
+inline void crtc_start(const uint16_t pos) {
+    outb(0x3D4, 0x0D);
+    outb(0x3D5, (uint8_t) (pos & 0xFF));
+    outb(0x3D4, 0x0C);
+    outb(0x3D5, (uint8_t) ((pos >> 8) & 0xFF));
+}
+
+inline void cpuid(const uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+inline uint64_t rdmsr(const uint32_t msr) {
+    uint32_t low, high;
+
+    __asm__ volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t) high << 32) | low;
+}
+
+inline void wrmsr(const uint32_t msr, const uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t) value), "d"((uint32_t) (value >> 32)) : "memory");
+}
+
+inline uint32_t read_cr0(void) {
+    uint32_t value;
+
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+inline void write_cr0(const uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+inline uint32_t read_cr4(void) {
+    uint32_t value;
+
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+inline void write_cr4(const uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
 void    PIC_remap(void);
+void    set_idt_entry(const uint8_t vector, void (*handler)(), const uint8_t flags);
 void    initialize_idt(void);
 void    load_idt();
 void    init_gdt();
+extern "C" void*	memset(void* dest, int value, size_t n);
+extern "C" void*	memcpy(void* dest, const void* src, size_t n);
+extern "C" void*	memmove(void* dest, const void* src, size_t n);
+extern "C" int		memcmp(const void* s1, const void* s2, size_t n);
+
 void    kmemset(void* ptr, const int8_t value, const size_t num);
 void    kprintf(const char* format, ...);
+size_t  kvsnprintf(char* buf, const size_t size, const char* format, va_list va_params);
+size_t  ksnprintf(char* buf, const size_t size, const char* format, ...);
 void*   kmemcpy(void *dest, const void *src, size_t n);
 int     kstrncmp(const uint16_t *s1, const char *s2, const size_t n);
-size_t  terminal_putnbr_base(int n, const char* base, const size_t base_len, size_t pos);
 
 extern GDT_t gdt[GDT_ENTRIES];
+extern GDTR_t* gdt_register;
+extern tss_t tss;
 
 #endif // _UTILS_H_
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.hpp"
+#include "klog.hpp"
+#include "pci.hpp"
+
+#ifndef _VIRTIO_H_
+# define _VIRTIO_H_
+
+// https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html, legacy interface
+# define VIRTIO_VENDOR_ID			0x1AF4
+# define VIRTIO_LEGACY_BLK			0x1001
+# define VIRTIO_LEGACY_CONSOLE		0x1003
+
+/* Legacy PCI registers, offsets from the I/O BAR0 */
+# define VIRTIO_REG_DEVICE_FEATURES	0x00
+# define VIRTIO_REG_DRIVER_FEATURES	0x04
+# define VIRTIO_REG_QUEUE_PFN		0x08
+# define VIRTIO_REG_QUEUE_SIZE		0x0C
+# define VIRTIO_REG_QUEUE_SELECT	0x0E
+# define VIRTIO_REG_QUEUE_NOTIFY	0x10
+# define VIRTIO_REG_STATUS			0x12
+# define VIRTIO_REG_ISR				0x13
+# define VIRTIO_REG_CONFIG			0x14	// without MSI-X
+
+# define VIRTIO_STATUS_ACKNOWLEDGE	0x01
+# define VIRTIO_STATUS_DRIVER		0x02
+# define VIRTIO_STATUS_DRIVER_OK	0x04
+# define VIRTIO_STATUS_FAILED		0x80
+# define VIRTIO_ISR_QUEUE			0x01
+
+/* Device and driver agree on when to notify each other with indexes
+   instead of flags: one interrupt per batch, one kick per batch */
+# define VIRTIO_F_EVENT_IDX			(1 << 29)
+
+# define VIRTQ_DESC_F_NEXT			0x01
+# define VIRTQ_DESC_F_WRITE			0x02	// written by the device
+# define VIRTQ_AVAIL_F_NO_INTERRUPT	0x01
+# define VIRTQ_USED_F_NO_NOTIFY		0x01
+
+/* The legacy interface takes the ring layout from the queue size, which
+   the device chooses: the memory for the largest one is reserved statically,
+   being physically contiguous as the kernel is identity mapped */
+# define VIRTQ_MAX_SIZE				256
+# define VIRTQ_ALIGN				4096
+# define VIRTQ_BYTES				(3 * VIRTQ_ALIGN)
+# define VIRTIO_MAX_QUEUES			4
+# define VIRTIO_MAX_DEVICES			4
+
+# define VIRTIO_BLK_F_SEG_MAX		(1 << 2)
+# define VIRTIO_BLK_F_RO			(1 << 5)
+# define VIRTIO_BLK_CONFIG_CAPACITY	0x00
+# define VIRTIO_BLK_CONFIG_SEG_MAX	0x0C
+# define VIRTIO_BLK_T_IN			0
+# define VIRTIO_BLK_T_OUT			1
+# define VIRTIO_BLK_S_OK			0
+# define VIRTIO_BLK_SECTOR_SIZE		512
+# define VIRTIO_BLK_SECTORS_PER_BLOCK	(BLOCK_SIZE / VIRTIO_BLK_SECTOR_SIZE)
+# define VIRTIO_BLK_MAX_SEGMENTS	32		// data descriptors of one request
+# define VIRTIO_BLK_MAX_REQUESTS	(VIRTQ_MAX_SIZE / 3)
+
+# define VIRTIO_CONSOLE_RECEIVEQ	0
+# define VIRTIO_CONSOLE_TRANSMITQ	1
+# define VIRTIO_CONSOLE_LOG_BATCH	16		// log records sent with one kick
+# define VIRTIO_CONSOLE_LINE		(KLOG_TEXT_SIZE + 32)
+
+# define VIRTIO_BENCH_DEPTH			64		// block I/Os given to each transfer
+# define VIRTIO_BENCH_SEQ_PAGES		4096	// 16 MB
+# define VIRTIO_BENCH_RANDOM_OPS	2048
+# define VIRTIO_BENCH_CONSOLE_OPS	1024
+
+typedef struct VirtqDesc {
+	uint64_t	addr;
+	uint32_t	len;
+	uint16_t	flags;
+	uint16_t	next;
+} virtq_desc_t;
+
+/* used_event follows ring[size] */
+typedef struct VirtqAvail {
+	uint16_t	flags;
+	uint16_t	idx;
+	uint16_t	ring[];
+} virtq_avail_t;
+
+typedef struct VirtqUsedElem {
+	uint32_t	id;
+	uint32_t	len;
+} virtq_used_elem_t;
+
+/* avail_event follows ring[size] */
+typedef struct VirtqUsed {
+	uint16_t			flags;
+	uint16_t			idx;
+	virtq_used_elem_t	ring[];
+} virtq_used_t;
+
+/* A buffer given to the device as is: no copy on either side */
+typedef struct VirtioBuffer {
+	const void*	data;
+	uint32_t	len;
+	bool		device_writes;
+} virtio_buffer_t;
+
+typedef struct Virtqueue {
+	uint16_t			index;
+	uint16_t			size;
+	uint16_t			free_head;
+	uint16_t			free_count;
+	uint16_t			avail_idx;		// not yet published until virtqueue_kick()
+	uint16_t			kicked_idx;		// avail_idx at the last kick
+	uint16_t			last_used;
+	bool				event_idx;
+	uint16_t			notify_port;
+	virtq_desc_t*		desc;
+	virtq_avail_t*		avail;
+	virtq_used_t*		used;
+	void*				cookies[VIRTQ_MAX_SIZE];	// indexed by the head descriptor
+	uint32_t			kicks;
+	uint32_t			interrupts;
+} virtqueue_t;
+
+typedef struct VirtioDevice {
+	const char*			name;
+	pci_device_t*		pci;
+	uint16_t			io_base;
+	uint32_t			features;
+	void				(*interrupt)(struct VirtioDevice* dev);
+	void*				driver;
+} virtio_device_t;
+
+/* Transport and virtqueues */
+virtio_device_t*	virtio_probe(pci_device_t* pci, const uint32_t wanted_features,
+						void (*interrupt)(virtio_device_t* dev), void* driver);
+bool				virtio_queue_init(virtio_device_t* dev, const uint16_t index, virtqueue_t* vq);
+void				virtio_ready(virtio_device_t* dev);
+uint32_t			virtio_config_read32(const virtio_device_t* dev, const uint8_t offset);
+bool				virtqueue_add(virtqueue_t* vq, const virtio_buffer_t* buffers, const size_t count, void* cookie);
+void				virtqueue_kick(virtqueue_t* vq);
+void*				virtqueue_get(virtqueue_t* vq, uint32_t* len);
+
+/* Drivers */
+void	virtio_init(void);
+void	virtio_blk_init(pci_device_t* pci);
+void	virtio_console_init(pci_device_t* pci);
+bool	virtio_console_write(const void* data, const size_t len);
+void	virtio_console_poll(void);
+void	virtio_blk_bench(void);
+void	virtio_console_bench(void);
+void	virtio_list(void);
+void	virtio_bench(void);
+
+#endif // _VIRTIO_H_
@@ -0,0 +1,161 @@
+#include <stdio.h>
+
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "utils.hpp"
+#include "host.hpp"
+
+
+#define BENCH_ROUNDS	20000
+#define BENCH_MAX_CODES	1024
+#define BENCH_LINE		40		// characters typed per line, well within the prompt
+
+#define KEY_RELEASE		0x80
+#define KEY_Q			0x10	// q to p follow
+#define KEY_H			0x23
+#define KEY_E			0x12
+#define KEY_L			0x26
+#define KEY_O			0x18
+
+typedef struct BenchCodes {
+	uint8_t	codes[BENCH_MAX_CODES];
+	size_t	count;
+} bench_codes_t;
+
+
+static void press(bench_codes_t* b, const uint8_t key) {
+	b->codes[b->count++] = key;
+	b->codes[b->count++] = key | KEY_RELEASE;
+}
+
+static void press_extended(bench_codes_t* b, const uint8_t key) {
+	b->codes[b->count++] = EXTENDED_BYTE;
+	b->codes[b->count++] = key;
+	b->codes[b->count++] = EXTENDED_BYTE;
+	b->codes[b->count++] = key | KEY_RELEASE;
+}
+
+static void type_letters(bench_codes_t* b, const size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		press(b, KEY_Q + i % 10);
+	}
+}
+
+/* The prompt line must be empty again once a round is over */
+static bool at_empty_prompt(void) {
+	const tty_t* const t = curr_tty;
+
+	if (t->row != tty_t::prompt_row || t->column != TERMINAL_PROMPT_LEN || t->written_column != TERMINAL_PROMPT_LEN) {
+		return false;
+	}
+	for (size_t x = TERMINAL_PROMPT_LEN; x < tty_t::width; ++x) {
+		if ((terminal_buffer[tty_t::prompt_index(x)] & 0x00FF) != EMPTY) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void report(const char* name, const char* unit, const uint64_t ops, const uint64_t ns, const uint64_t writes) {
+	printf("%-10s %9llu %-9s %8.1f ns each %8.2f M/s %6.2f port writes each\n", name, (unsigned long long) ops, unit,
+		(double) ns / ops, ops * 1000.0 / ns, (double) writes / ops);
+}
+
+/* Feeds the same scan codes for every round, counting ops_per_round of unit */
+static bool bench_feed(const char* name, const char* unit, const bench_codes_t* b, const size_t ops_per_round) {
+	const uint64_t writes = host_port_writes;
+	const uint64_t start = host_ns();
+
+	for (size_t round = 0; round < BENCH_ROUNDS; ++round) {
+		host_feed(b->codes, b->count);
+	}
+
+	const uint64_t ns = host_ns() - start;
+
+	report(name, unit, (uint64_t) BENCH_ROUNDS * ops_per_round, ns, host_port_writes - writes);
+	if (!at_empty_prompt()) {
+		printf("%s: the prompt line isn't empty after a round\n", name);
+		return false;
+	}
+	return true;
+}
+
+static bool bench_scroll(void) {
+	const uint64_t writes = host_port_writes;
+	const uint64_t start = host_ns();
+
+	for (size_t round = 0; round < BENCH_ROUNDS; ++round) {
+		terminal_scroll(1);
+	}
+
+	const uint64_t ns = host_ns() - start;
+
+	report("scroll", "lines", BENCH_ROUNDS, ns, host_port_writes - writes);
+
+	// Every cell must still be inside the aperture
+	const size_t top = terminal_buffer - (uint16_t*) CONSOLE_TEXT_BUFFER;
+
+	if (top + tty_t::cells > CONSOLE_TEXT_APERTURE / sizeof(uint16_t)) {
+		printf("scroll: screen at cell %zu, past the aperture\n", top);
+		return false;
+	}
+	return true;
+}
+
+int main(void) {
+	bench_codes_t	b;
+	bool			ok = true;
+
+	host_init();
+
+	// Typing a line and erasing it
+	b.count = 0;
+	type_letters(&b, BENCH_LINE);
+	for (size_t i = 0; i < BENCH_LINE; ++i) {
+		press(&b, BACKSPACE_PRESS);
+	}
+	ok &= bench_feed("type", "scancodes", &b, b.count);
+
+	// Inserting in the middle of the line and deleting forward, both shifting the rest
+	b.count = 0;
+	type_letters(&b, BENCH_LINE);
+	for (size_t i = 0; i < BENCH_LINE / 2; ++i) {
+		press_extended(&b, CURSOR_LEFT_PRESS);
+	}
+	type_letters(&b, BENCH_LINE / 2);
+	for (size_t i = 0; i < BENCH_LINE / 2; ++i) {
+		press_extended(&b, DELETE_PRESS);
+	}
+	for (size_t i = 0; i < BENCH_LINE; ++i) {
+		press(&b, BACKSPACE_PRESS);
+	}
+	ok &= bench_feed("edit", "scancodes", &b, b.count);
+
+	// An unknown command: history, scroll and a new prompt
+	b.count = 0;
+	press(&b, KEY_H);
+	press(&b, KEY_E);
+	press(&b, KEY_L);
+	press(&b, KEY_L);
+	press(&b, KEY_O);
+	press(&b, ENTER_PRESS);
+	ok &= bench_feed("enter", "commands", &b, 1);
+
+	// Walking the whole history ring, which the previous benchmark filled
+	b.count = 0;
+	for (size_t i = 0; i < MAX_HISTORY; ++i) {
+		press_extended(&b, CURSOR_UP_PRESS);
+	}
+	for (size_t i = 0; i < MAX_HISTORY; ++i) {
+		press_extended(&b, CURSOR_DOWN_PRESS);
+	}
+	ok &= bench_feed("history", "entries", &b, 2 * MAX_HISTORY);
+
+	b.count = 0;
+	press(&b, F2_PRESSED);
+	press(&b, F1_PRESSED);
+	ok &= bench_feed("swap_tty", "swaps", &b, 2);
+
+	ok &= bench_scroll();
+	return ok ? 0 : 1;
+}
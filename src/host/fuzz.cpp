@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "utils.hpp"
+#include "host.hpp"
+
+
+#define FUZZ_MAX_INPUT	65536
+
+
+static void fail(const char* what, const size_t at) {
+	fprintf(stderr, "after scan code %zu: %s\n", at, what);
+	abort();
+}
+
+/* What must hold between two keyboard interrupts, whatever came before */
+static void check(const size_t at) {
+	const tty_t* const t = curr_tty;
+	const uint16_t* const aperture = (uint16_t*) CONSOLE_TEXT_BUFFER;
+
+	if (t < ttys || t >= ttys + MAX_TTY) {
+		fail("curr_tty outside of ttys", at);
+	}
+	if (terminal_buffer < aperture
+			|| terminal_buffer + tty_t::cells > aperture + CONSOLE_TEXT_APERTURE / sizeof(uint16_t)) {
+		fail("screen outside of the text aperture", at);
+	}
+	if (t->row != tty_t::prompt_row) {
+		fail("cursor off the prompt line", at);
+	}
+	if (t->column < TERMINAL_PROMPT_LEN || t->column > t->written_column || t->written_column >= tty_t::width) {
+		fail("cursor outside of the text typed", at);
+	}
+	if (t->history_current_index < -1 || t->history_current_index >= MAX_HISTORY) {
+		fail("history index outside of the ring", at);
+	}
+}
+
+/* Every input starts from freshly booted terminals, so that a crash found
+   replays from its input alone */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	host_init();
+	for (size_t i = 0; i < size; ++i) {
+		host_feed(&data[i], 1);
+		check(i);
+	}
+	return 0;
+}
+
+#ifdef FUZZ_STDIN
+/* One input read from stdin, for AFL or to replay a crash without libFuzzer */
+int main(void) {
+	static uint8_t	data[FUZZ_MAX_INPUT];
+	const size_t	size = fread(data, 1, sizeof(data), stdin);
+
+	return LLVMFuzzerTestOneInput(data, size);
+}
+#endif
@@ -0,0 +1,173 @@
+#include <time.h>
+
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "ata.hpp"
+#include "bcache.hpp"
+#include "block.hpp"
+#include "console.hpp"
+#include "initrd.hpp"
+#include "keymap.hpp"
+#include "memory.hpp"
+#include "memtype.hpp"
+#include "paging.hpp"
+#include "pci.hpp"
+#include "serial.hpp"
+#include "simd.hpp"
+#include "syscall.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+#include "virtio.hpp"
+#include "host.hpp"
+
+
+uint16_t			host_text_aperture[CONSOLE_TEXT_APERTURE / sizeof(uint16_t)];
+uint8_t				host_scancode = 0;
+uint64_t			host_port_reads = 0;
+uint64_t			host_port_writes = 0;
+uint32_t			tsc_khz = 1000000;
+volatile uint32_t	timer_ticks = 0;
+
+
+uint64_t host_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Same measurement as tsc_calibrate(), against the host clock */
+static void host_tsc_calibrate(void) {
+	const uint64_t end = host_ns() + TSC_CALIBRATION_MS * 1000000;
+	const uint64_t start = rdtsc();
+
+	while (host_ns() < end) {
+	}
+	tsc_khz = (rdtsc() - start) / TSC_CALIBRATION_MS;
+}
+
+/* Boots the terminals, with every keyboard state back to its default, so
+   that the same scan codes always give the same screen */
+void host_init(void) {
+	static bool calibrated = false;
+
+	if (!calibrated) {
+		host_tsc_calibrate();
+		calibrated = true;
+	}
+	keyboard_reset();
+	keymap_select("qwerty");
+	terminal_initialize();
+}
+
+/* One keyboard interrupt per scan code, then the main loop's turn */
+void host_feed(const uint8_t* scan_codes, const size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		host_scancode = scan_codes[i];
+		isr_keyboard();
+		run_pending_command();
+	}
+}
+
+/* Port I/O */
+
+void outb(const uint16_t, const uint8_t) {
+	++host_port_writes;
+	++cpu_stats.port_io;
+}
+
+uint8_t inb(uint16_t port) {
+	++host_port_reads;
+	++cpu_stats.port_io;
+	return port == HOST_KEYBOARD_PORT ? host_scancode : 0xFF;
+}
+
+void outw(const uint16_t, const uint16_t) {
+	++host_port_writes;
+	++cpu_stats.port_io;
+}
+
+uint16_t inw(uint16_t) {
+	++host_port_reads;
+	++cpu_stats.port_io;
+	return 0xFFFF;
+}
+
+void outl(const uint16_t, const uint32_t) {
+	++host_port_writes;
+	++cpu_stats.port_io;
+}
+
+uint32_t inl(uint16_t) {
+	++host_port_reads;
+	++cpu_stats.port_io;
+	return 0xFFFFFFFF;
+}
+
+/* The rest of the kernel the shell calls into. Nothing is mapped, so that
+   hexdump refuses every address instead of reading the host's memory. */
+
+// A plain loop rather than rep stosw, for the sanitizers to see the stores
+void fill16(uint16_t* dest, const uint16_t value, const size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		dest[i] = value;
+	}
+}
+
+uint64_t tsc_to_us(const uint64_t cycles) {
+	return cycles * 1000 / tsc_khz;
+}
+
+uint64_t tsc_to_ns(const uint64_t cycles) {
+	return cycles * 1000000 / tsc_khz;
+}
+
+address_space_t* current_space(void) {
+	return NULL;
+}
+
+bool paging_mapped(const address_space_t*, const uintptr_t) {
+	return false;
+}
+
+void serial_write(const char*, const size_t) {
+}
+
+block_device_t* block_find(const char*) {
+	return NULL;
+}
+
+const initrd_file_t* initrd_lookup(const char*) {
+	return NULL;
+}
+
+size_t initrd_read(const initrd_file_t*, const size_t, const uint8_t** data) {
+	*data = NULL;
+	return 0;
+}
+
+static void unavailable(const char* name) {
+	terminal_printf("%s: not in the host build", name);
+}
+
+void ata_list(void) { unavailable("disk"); }
+void ata_bench(void) { unavailable("disk"); }
+void bcache_sync(void) { unavailable("bcache"); }
+void bcache_print_stats(void) { unavailable("bcache"); }
+void bcache_scan(block_device_t*) { unavailable("bcache"); }
+void bcache_rewrite(block_device_t*) { unavailable("bcache"); }
+void initrd_ls(const char*) { unavailable("ls"); }
+void initrd_cat(const char*) { unavailable("cat"); }
+void print_sections(void) { unavailable("sections"); }
+void memtype_bench(void) { unavailable("wcbench"); }
+void paging_print(void) { unavailable("paging"); }
+void pci_print(void) { unavailable("lspci"); }
+void simd_bench(void) { unavailable("simdbench"); }
+void syscall_bench(void) { unavailable("syscallbench"); }
+void virtio_list(void) { unavailable("virtio"); }
+void virtio_bench(void) { unavailable("virtio"); }
+
+int user_exec(const char*) {
+	unavailable("exec");
+	return -1;
+}
@@ -0,0 +1,23 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _HOST_H_
+# define _HOST_H_
+
+/* The terminal and shell core run as a host program: the VGA text aperture
+   is a plain array, port accesses are counted, and the scan code port gives
+   whatever the harness put in host_scancode */
+
+# define HOST_KEYBOARD_PORT	0x60
+
+extern uint8_t		host_scancode;
+extern uint64_t		host_port_reads;
+extern uint64_t		host_port_writes;
+
+extern "C" void	isr_keyboard(void);
+
+void		host_init(void);
+void		host_feed(const uint8_t* scan_codes, const size_t count);
+uint64_t	host_ns(void);
+
+#endif // _HOST_H_
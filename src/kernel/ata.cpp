@@ -0,0 +1,530 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "ata.hpp"
+#include "block.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "pci.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+
+static ata_channel_t	channels[ATA_CHANNELS];
+static ata_drive_t		drives[ATA_DRIVES];
+static ata_stats_t		stats;
+
+
+/* Reading the alternate status register four times gives the drive the
+   400ns it needs after a drive select */
+static inline void ata_delay400(const ata_channel_t* ch) {
+	for (int i = 0; i < 4; ++i) {
+		inb(ch->ctrl_base + ATA_REG_ALTSTATUS);
+	}
+}
+
+static bool ata_poll(const ata_channel_t* ch, const uint8_t mask, const uint8_t value, const uint32_t timeout_us) {
+	const uint64_t end = rdtsc() + (uint64_t) timeout_us * tsc_khz / 1000;
+
+	do {
+		if ((inb(ch->io_base + ATA_REG_STATUS) & mask) == value) {
+			return true;
+		}
+	} while (rdtsc() < end);
+	return false;
+}
+
+__init static bool ata_identify(ata_channel_t* ch, const uint8_t slave, ata_drive_t* drive) {
+	uint16_t id[ATA_SECTOR_SIZE / 2];
+
+	outb(ch->io_base + ATA_REG_DRIVE, 0xA0 | (slave << 4));
+	ata_delay400(ch);
+	outb(ch->io_base + ATA_REG_SECCOUNT, 0);
+	outb(ch->io_base + ATA_REG_LBA0, 0);
+	outb(ch->io_base + ATA_REG_LBA1, 0);
+	outb(ch->io_base + ATA_REG_LBA2, 0);
+	outb(ch->io_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+	if (inb(ch->io_base + ATA_REG_STATUS) == 0 || !ata_poll(ch, ATA_STATUS_BSY, 0, 100000)) {
+		return false;
+	}
+	// ATAPI and SATA devices abort IDENTIFY and leave their signature in LBA1/LBA2
+	if (inb(ch->io_base + ATA_REG_LBA1) || inb(ch->io_base + ATA_REG_LBA2)) {
+		return false;
+	}
+	if (!ata_poll(ch, ATA_STATUS_DRQ | ATA_STATUS_ERR, ATA_STATUS_DRQ, 100000)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < ATA_SECTOR_SIZE / 2; ++i) {
+		id[i] = inw(ch->io_base + ATA_REG_DATA);
+	}
+
+	// Word 49 bit 8: DMA supported, word 83 bit 10: 48-bit addressing supported
+	if (!(id[49] & (1 << 8))) {
+		return false;
+	}
+	drive->lba48 = id[83] & (1 << 10);
+	if (drive->lba48) {
+		drive->sectors = id[100] | ((uint64_t) id[101] << 16) | ((uint64_t) id[102] << 32) | ((uint64_t) id[103] << 48);
+	} else {
+		drive->sectors = id[60] | ((uint32_t) id[61] << 16);
+	}
+
+	// The model string is stored as big endian words, padded with spaces
+	for (size_t i = 0; i < 20; ++i) {
+		drive->model[i * 2] = id[27 + i] >> 8;
+		drive->model[i * 2 + 1] = id[27 + i] & 0xFF;
+	}
+	size_t len = 40;
+	while (len && drive->model[len - 1] == ' ') {
+		--len;
+	}
+	drive->model[len] = '\0';
+
+	drive->channel = ch - channels;
+	drive->slave = slave;
+	drive->present = true;
+	return true;
+}
+
+static inline uint64_t request_key(const uint8_t drive, const uint64_t lba) {
+	return ((uint64_t) drive << 56) | lba;
+}
+
+static inline uint32_t max_sectors(const ata_drive_t* drive) {
+	return drive->lba48 ? ATA_MAX_MERGE_SECTORS : ATA_MAX_SECTORS_LBA28;
+}
+
+static size_t prd_entries(const uintptr_t address, const size_t len) {
+	const uintptr_t end = address + len;
+
+	return ((end - 1) / ATA_PRD_BOUNDARY) - (address / ATA_PRD_BOUNDARY) + 1;
+}
+
+static size_t prd_fill(ata_prd_t* prd, size_t n, uintptr_t address, size_t len) {
+	while (len) {
+		const size_t chunk = ATA_PRD_BOUNDARY - (address & (ATA_PRD_BOUNDARY - 1));
+		const size_t size = chunk < len ? chunk : len;
+
+		prd[n].address = address;
+		prd[n].byte_count = size & 0xFFFF;
+		prd[n].flags = 0;
+		++n;
+		address += size;
+		len -= size;
+	}
+	return n;
+}
+
+/* Takes the next request in C-LOOK order, the first one at or after the end
+   of the previous command, along with every queued request that continues
+   it on disk, as long as they fit in one command */
+static ata_request_t* ata_dequeue_batch(ata_channel_t* ch) {
+	ata_request_t* prev = NULL;
+	ata_request_t* first = ch->queue;
+
+	while (first && request_key(first->drive, first->lba) < ch->position) {
+		prev = first;
+		first = first->next;
+	}
+	if (!first) {
+		prev = NULL;
+		first = ch->queue;
+	}
+
+	ata_request_t** link = prev ? &prev->next : &ch->queue;
+	ata_request_t* tail = first;
+	const uint32_t limit = max_sectors(&drives[first->drive]);
+	uint32_t sectors = first->count;
+	size_t entries = prd_entries((uintptr_t) first->buffer, first->count * ATA_SECTOR_SIZE);
+
+	*link = first->next;
+
+	for (ata_request_t* next = *link; next; next = *link) {
+		const size_t next_entries = prd_entries((uintptr_t) next->buffer, next->count * ATA_SECTOR_SIZE);
+
+		if (next->drive != first->drive || next->write != first->write || next->lba != tail->lba + tail->count
+				|| sectors + next->count > limit || entries + next_entries > ATA_PRD_MAX) {
+			break;
+		}
+
+		*link = next->next;
+		tail->next = next;
+		tail = next;
+		sectors += next->count;
+		entries += next_entries;
+		++stats.merged;
+	}
+
+	tail->next = NULL;
+	ch->position = request_key(tail->drive, tail->lba + tail->count);
+	return first;
+}
+
+/* Starts the next command of the channel if it is idle. Called with
+   interrupts disabled. */
+static void ata_issue(ata_channel_t* ch) {
+	if (ch->active || !ch->queue) {
+		return;
+	}
+
+	ata_request_t* batch = ata_dequeue_batch(ch);
+	const ata_drive_t* drive = &drives[batch->drive];
+	const uint64_t lba = batch->lba;
+	uint32_t sectors = 0;
+	size_t n = 0;
+
+	for (ata_request_t* r = batch; r; r = r->next) {
+		n = prd_fill(ch->prd, n, (uintptr_t) r->buffer, r->count * ATA_SECTOR_SIZE);
+		sectors += r->count;
+	}
+	ch->prd[n - 1].flags = ATA_PRD_END;
+
+	const uint8_t direction = batch->write ? 0 : BM_CMD_READ;
+
+	outb(ch->bm_base + BM_REG_COMMAND, 0);
+	outl(ch->bm_base + BM_REG_PRD, (uint32_t) ch->prd);
+	outb(ch->bm_base + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+	outb(ch->bm_base + BM_REG_COMMAND, direction);
+
+	if (drive->lba48) {
+		outb(ch->io_base + ATA_REG_DRIVE, 0x40 | (drive->slave << 4));
+		if (ch->selected != drive->slave) {
+			ata_delay400(ch);
+		}
+		// High order bytes first, each register is a two deep FIFO
+		outb(ch->io_base + ATA_REG_SECCOUNT, (sectors >> 8) & 0xFF);
+		outb(ch->io_base + ATA_REG_LBA0, (lba >> 24) & 0xFF);
+		outb(ch->io_base + ATA_REG_LBA1, (lba >> 32) & 0xFF);
+		outb(ch->io_base + ATA_REG_LBA2, (lba >> 40) & 0xFF);
+		outb(ch->io_base + ATA_REG_SECCOUNT, sectors & 0xFF);
+		outb(ch->io_base + ATA_REG_LBA0, lba & 0xFF);
+		outb(ch->io_base + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+		outb(ch->io_base + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+		outb(ch->io_base + ATA_REG_COMMAND, batch->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+	} else {
+		outb(ch->io_base + ATA_REG_DRIVE, ATA_DRIVE_LBA | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+		if (ch->selected != drive->slave) {
+			ata_delay400(ch);
+		}
+		outb(ch->io_base + ATA_REG_SECCOUNT, sectors & 0xFF);	// 0 means 256
+		outb(ch->io_base + ATA_REG_LBA0, lba & 0xFF);
+		outb(ch->io_base + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+		outb(ch->io_base + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+		outb(ch->io_base + ATA_REG_COMMAND, batch->write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+	}
+
+	ch->selected = drive->slave;
+	ch->active = batch;
+	++stats.commands;
+	outb(ch->bm_base + BM_REG_COMMAND, direction | BM_CMD_START);
+}
+
+static void ata_complete(ata_channel_t* ch) {
+	const uint8_t bm_status = inb(ch->bm_base + BM_REG_STATUS);
+
+	if (!(bm_status & BM_STATUS_IRQ)) {
+		return;
+	}
+
+	outb(ch->bm_base + BM_REG_COMMAND, 0);
+	// Reading the status register acknowledges the drive interrupt
+	const uint8_t status = inb(ch->io_base + ATA_REG_STATUS);
+	outb(ch->bm_base + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+
+	if (!ch->active) {
+		return;
+	}
+
+	const bool error = (bm_status & BM_STATUS_ERROR) || (status & (ATA_STATUS_ERR | ATA_STATUS_DF));
+	ata_request_t* r = ch->active;
+
+	ch->active = NULL;
+	while (r) {
+		ata_request_t* next = r->next;
+
+		stats.errors += error;
+		r->status = error ? ATA_REQUEST_ERROR : ATA_REQUEST_DONE;
+		r = next;
+	}
+
+	ata_issue(ch);
+}
+
+/* Block device backend: the whole batch is queued before waiting so that
+   adjacent blocks are merged into the same DMA commands */
+static size_t ata_block_transfer(block_device_t* dev, block_io_t* ios, const size_t count) {
+	ata_request_t requests[ATA_BLOCK_BATCH];
+	const uint8_t drive = (uintptr_t) dev->data;
+	size_t errors = 0;
+
+	for (size_t done = 0; done < count; done += ATA_BLOCK_BATCH) {
+		const size_t batch = count - done < ATA_BLOCK_BATCH ? count - done : ATA_BLOCK_BATCH;
+
+		for (size_t i = 0; i < batch; ++i) {
+			requests[i].lba = ios[done + i].block * ATA_SECTORS_PER_BLOCK;
+			requests[i].buffer = ios[done + i].buffer;
+			requests[i].count = ATA_SECTORS_PER_BLOCK;
+			requests[i].drive = drive;
+			requests[i].write = ios[done + i].write;
+			ata_submit(&requests[i]);
+		}
+		for (size_t i = 0; i < batch; ++i) {
+			ata_wait(&requests[i]);
+			ios[done + i].error = requests[i].status != ATA_REQUEST_DONE;
+			errors += ios[done + i].error;
+		}
+	}
+	return errors;
+}
+
+static void ata_irq(const uint8_t irq) {
+	for (size_t i = 0; i < ATA_CHANNELS; ++i) {
+		if (channels[i].present && !channels[i].polled && channels[i].irq == irq) {
+			ata_complete(&channels[i]);
+		}
+	}
+}
+
+__init void ata_init(void) {
+	const pci_device_t* const pci = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, NULL);
+
+	if (!pci) {
+		return;
+	}
+
+	const uint8_t prog_if = pci->prog_if;
+	const uint16_t bm_base = pci->bars[4].base;
+
+	// prog_if bit 7: bus master IDE. Without it, BAR4 is empty and port 0 is the 8237 DMA controller.
+	if (!(prog_if & 0x80) || !(pci->bars[4].flags & PCI_BAR_IO) || !bm_base) {
+		klog(KLOG_WARN, "ata: controller without bus mastering, ignored");
+		return;
+	}
+
+	pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+	for (uint8_t i = 0; i < ATA_CHANNELS; ++i) {
+		ata_channel_t* ch = &channels[i];
+		// prog_if bit 0 (primary) and bit 2 (secondary): channel in PCI native mode
+		const bool native = prog_if & (1 << (i * 2));
+
+		if (native) {
+			ch->io_base = pci->bars[i * 2].base;
+			ch->ctrl_base = pci->bars[i * 2 + 1].base + 2;
+			ch->irq = pci->irq;
+		} else {
+			ch->io_base = i ? ATA_SECONDARY_IO : ATA_PRIMARY_IO;
+			ch->ctrl_base = i ? ATA_SECONDARY_CTRL : ATA_PRIMARY_CTRL;
+			ch->irq = i ? IRQ_ATA_SECONDARY : IRQ_ATA_PRIMARY;
+		}
+		ch->bm_base = bm_base + i * BM_CHANNEL_STRIDE;
+		ch->selected = 0xFF;
+
+		outb(ch->ctrl_base + ATA_REG_DEVCTRL, ATA_DEVCTRL_NIEN);
+		for (uint8_t slave = 0; slave < 2; ++slave) {
+			ch->present |= ata_identify(ch, slave, &drives[i * 2 + slave]);
+		}
+		outb(ch->ctrl_base + ATA_REG_DEVCTRL, 0);
+
+		if (ch->present) {
+			ch->prd = reinterpret_cast<ata_prd_t *>(page_alloc());
+			if (!ch->prd) {
+				ch->present = false;
+				drives[i * 2].present = drives[i * 2 + 1].present = false;
+				continue;
+			}
+			// 0xFF in native mode: the function isn't connected to a line
+			ch->polled = !irq_register(ch->irq, ata_irq);
+			if (!ch->polled) {
+				irq_unmask(ch->irq);
+			}
+		}
+	}
+
+	for (uint8_t i = 0; i < ATA_DRIVES; ++i) {
+		if (drives[i].present) {
+			const char name[] = { 'h', 'd', (char) ('a' + i), '\0' };
+
+			block_register(name, drives[i].sectors / ATA_SECTORS_PER_BLOCK, false,
+				reinterpret_cast<void *>((uintptr_t) i), ata_block_transfer);
+			klog(KLOG_INFO, "ata: %s: %s, %u MB", name, drives[i].model, (uint32_t) (drives[i].sectors / 2048));
+		}
+	}
+}
+
+const ata_drive_t* ata_drive(const uint8_t drive) {
+	return drive < ATA_DRIVES && drives[drive].present ? &drives[drive] : NULL;
+}
+
+void ata_submit(ata_request_t* request) {
+	const ata_drive_t* drive = ata_drive(request->drive);
+
+	if (!drive || !request->count || request->count > max_sectors(drive)
+			|| request->lba + request->count > drive->sectors || ((uintptr_t) request->buffer & 1)) {
+		request->status = ATA_REQUEST_ERROR;
+		return;
+	}
+
+	ata_channel_t* ch = &channels[drive->channel];
+	const uint64_t key = request_key(request->drive, request->lba);
+	const uint32_t flags = irq_save();
+	ata_request_t** link = &ch->queue;
+
+	while (*link && request_key((*link)->drive, (*link)->lba) <= key) {
+		link = &(*link)->next;
+	}
+	request->status = ATA_REQUEST_QUEUED;
+	request->next = *link;
+	*link = request;
+	++stats.requests;
+
+	ata_issue(ch);
+	irq_restore(flags);
+}
+
+/* Sleeps until the request completes. Without interrupts, for instance from
+   an interrupt handler or on a channel without a line, the completion is
+   polled instead. */
+void ata_wait(ata_request_t* request) {
+	const uint32_t flags = irq_save();
+
+	while (request->status == ATA_REQUEST_QUEUED) {
+		ata_channel_t* const ch = &channels[drives[request->drive].channel];
+
+		if ((flags & EFLAGS_IF) && !ch->polled) {
+			irq_wait();
+		} else {
+			ata_complete(ch);
+		}
+	}
+	irq_restore(flags);
+}
+
+static int ata_transfer(const uint8_t drive, const uint64_t lba, const uint32_t count, void* buffer, const bool write) {
+	ata_request_t request;
+
+	request.lba = lba;
+	request.buffer = buffer;
+	request.count = count;
+	request.drive = drive;
+	request.write = write;
+	ata_submit(&request);
+	ata_wait(&request);
+	return request.status == ATA_REQUEST_DONE ? 0 : -1;
+}
+
+int ata_read(const uint8_t drive, const uint64_t lba, const uint32_t count, void* buffer) {
+	return ata_transfer(drive, lba, count, buffer, false);
+}
+
+int ata_write(const uint8_t drive, const uint64_t lba, const uint32_t count, const void* buffer) {
+	return ata_transfer(drive, lba, count, const_cast<void *>(buffer), true);
+}
+
+void ata_list(void) {
+	bool found = false;
+
+	for (uint8_t i = 0; i < ATA_DRIVES; ++i) {
+		if (drives[i].present) {
+			terminal_printf("hd%c  %u MB  %s  %s", 'a' + i, (uint32_t) (drives[i].sectors / 2048),
+				drives[i].lba48 ? "LBA48" : "LBA28", drives[i].model);
+			found = true;
+		}
+	}
+	if (!found) {
+		terminal_printf("disk: no ATA drive found");
+	}
+}
+
+/* Issues ops page sized requests, ATA_BENCH_DEPTH at a time. Write patterns
+   first read back each batch, untimed, and rewrite the same data so that the
+   benchmark leaves the disk unchanged. */
+static void bench_pattern(const char* name, const uint8_t drive, void* pages[ATA_BENCH_DEPTH],
+		const uint32_t ops, const uint32_t span, const bool random, const bool write) {
+	static ata_request_t requests[ATA_BENCH_DEPTH];
+	const uint32_t sectors = PAGE_SIZE / ATA_SECTOR_SIZE;
+	const uint32_t commands = stats.commands;
+	uint32_t seed = 0x2545F491;
+	uint32_t errors = 0;
+	uint64_t cycles = 0;
+
+	for (uint32_t done = 0; done < ops; done += ATA_BENCH_DEPTH) {
+		const uint32_t batch = ops - done < ATA_BENCH_DEPTH ? ops - done : ATA_BENCH_DEPTH;
+
+		for (uint32_t i = 0; i < batch; ++i) {
+			seed = seed * 1664525 + 1013904223;
+			requests[i].lba = (uint64_t) (random ? seed % span : done + i) * sectors;
+			requests[i].buffer = pages[i];
+			requests[i].count = sectors;
+			requests[i].drive = drive;
+			requests[i].write = false;
+		}
+
+		if (write) {
+			for (uint32_t i = 0; i < batch; ++i) {
+				ata_submit(&requests[i]);
+			}
+			for (uint32_t i = 0; i < batch; ++i) {
+				ata_wait(&requests[i]);
+				requests[i].write = true;
+			}
+		}
+
+		const uint64_t start = rdtsc();
+		for (uint32_t i = 0; i < batch; ++i) {
+			ata_submit(&requests[i]);
+		}
+		for (uint32_t i = 0; i < batch; ++i) {
+			ata_wait(&requests[i]);
+			errors += requests[i].status != ATA_REQUEST_DONE;
+		}
+		cycles += rdtsc() - start;
+	}
+
+	const uint64_t us = tsc_to_us(cycles) ? tsc_to_us(cycles) : 1;
+	const uint64_t bytes = (uint64_t) ops * PAGE_SIZE;
+	const uint32_t mb_s_10 = bytes * 10 * 1000000 / us / (1024 * 1024);
+
+	terminal_printf("%s  %5u x 4 KB  %5u.%u MB/s  %7u IOPS  %5u cmds  %u errors",
+		name, ops, mb_s_10 / 10, mb_s_10 % 10, (uint32_t) ((uint64_t) ops * 1000000 / us),
+		stats.commands - commands, errors);
+}
+
+void ata_bench(void) {
+	void* pages[ATA_BENCH_DEPTH];
+	uint8_t drive = 0;
+
+	while (drive < ATA_DRIVES && !drives[drive].present) {
+		++drive;
+	}
+	if (drive == ATA_DRIVES) {
+		terminal_printf("disk: no ATA drive found");
+		return;
+	}
+
+	size_t allocated = 0;
+	for (; allocated < ATA_BENCH_DEPTH; ++allocated) {
+		if (!(pages[allocated] = page_alloc())) {
+			break;
+		}
+	}
+
+	const uint64_t disk_pages = drives[drive].sectors / (PAGE_SIZE / ATA_SECTOR_SIZE);
+	const uint32_t span = disk_pages < ATA_BENCH_SEQ_PAGES ? disk_pages : ATA_BENCH_SEQ_PAGES;
+
+	if (allocated < ATA_BENCH_DEPTH || !span) {
+		terminal_printf("disk bench: not enough memory or disk space");
+	} else {
+		terminal_printf("hd%c, %u requests in flight, merged %u so far", 'a' + drive, ATA_BENCH_DEPTH, stats.merged);
+		bench_pattern("seq read  ", drive, pages, span, span, false, false);
+		bench_pattern("seq write ", drive, pages, span, span, false, true);
+		bench_pattern("rand read ", drive, pages, ATA_BENCH_RANDOM_OPS, span, true, false);
+		bench_pattern("rand write", drive, pages, ATA_BENCH_RANDOM_OPS, span, true, true);
+	}
+
+	while (allocated) {
+		page_free(pages[--allocated]);
+	}
+}
@@ -0,0 +1,387 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "bcache.hpp"
+#include "memory.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+
+static buffer_t			buffers[BCACHE_BUFFERS];
+static size_t			buffers_count = 0;
+/* Open addressing index by (device, block), with linear probing. Slots hold
+   a buffer index plus one, 0 marks an empty slot. */
+static uint16_t			hash_table[BCACHE_HASH_SIZE];
+static size_t			clock_hand = 0;
+/* Dirty buffers, oldest first */
+static buffer_t*		dirty_head = NULL;
+static buffer_t*		dirty_tail = NULL;
+static size_t			dirty_count = 0;
+/* Sequential access detection: block expected next and end of the last
+   read-ahead window, per device */
+static uint64_t			next_block[BLOCK_DEVICES];
+static uint64_t			readahead_end[BLOCK_DEVICES];
+static bcache_stats_t	stats;
+
+static_assert(BCACHE_HASH_SIZE >= 2 * BCACHE_BUFFERS, "hash table too small");
+
+
+__init void bcache_init(void) {
+	for (; buffers_count < BCACHE_BUFFERS; ++buffers_count) {
+		buffers[buffers_count].data = reinterpret_cast<uint8_t *>(page_alloc());
+		if (!buffers[buffers_count].data) {
+			break;
+		}
+	}
+}
+
+static inline size_t hash_slot(const block_device_t* dev, const uint64_t block) {
+	const uint64_t key = block * BLOCK_DEVICES + dev->id;
+
+	// Fibonacci hashing: the top bits of the product are the best mixed
+	return ((uint32_t) (key ^ (key >> 32)) * 0x9E3779B1u) >> (32 - BCACHE_HASH_BITS);
+}
+
+static buffer_t* hash_lookup(const block_device_t* dev, const uint64_t block) {
+	for (size_t slot = hash_slot(dev, block); hash_table[slot]; slot = (slot + 1) & (BCACHE_HASH_SIZE - 1)) {
+		buffer_t* b = &buffers[hash_table[slot] - 1];
+
+		if (b->block == block && b->dev == dev) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static void hash_insert(buffer_t* b) {
+	size_t slot = hash_slot(b->dev, b->block);
+
+	while (hash_table[slot]) {
+		slot = (slot + 1) & (BCACHE_HASH_SIZE - 1);
+	}
+	hash_table[slot] = b - buffers + 1;
+}
+
+/* Removes b and shifts back the entries of its probe sequence, so that
+   lookups never need tombstones */
+static void hash_remove(const buffer_t* b) {
+	const uint16_t entry = b - buffers + 1;
+	size_t hole = hash_slot(b->dev, b->block);
+
+	while (hash_table[hole] != entry) {
+		hole = (hole + 1) & (BCACHE_HASH_SIZE - 1);
+	}
+
+	for (size_t slot = (hole + 1) & (BCACHE_HASH_SIZE - 1); hash_table[slot]; slot = (slot + 1) & (BCACHE_HASH_SIZE - 1)) {
+		const buffer_t* moved = &buffers[hash_table[slot] - 1];
+		const size_t home = hash_slot(moved->dev, moved->block);
+
+		// Move the entry into the hole unless its home lies cyclically in ]hole, slot]
+		if (((slot - home) & (BCACHE_HASH_SIZE - 1)) >= ((slot - hole) & (BCACHE_HASH_SIZE - 1))) {
+			hash_table[hole] = hash_table[slot];
+			hole = slot;
+		}
+	}
+	hash_table[hole] = 0;
+}
+
+/* Writes up to max of the oldest dirty buffers, one transfer per device */
+static void bcache_flush(const size_t max) {
+	buffer_t* batch[BCACHE_FLUSH_BATCH];
+	buffer_t* group[BCACHE_FLUSH_BATCH];
+	block_io_t ios[BCACHE_FLUSH_BATCH];
+	bool done[BCACHE_FLUSH_BATCH];
+	size_t n = 0;
+
+	while (dirty_head && n < max && n < BCACHE_FLUSH_BATCH) {
+		done[n] = false;
+		batch[n++] = dirty_head;
+		dirty_head = dirty_head->dirty_next;
+		--dirty_count;
+	}
+	if (!dirty_head) {
+		dirty_tail = NULL;
+	}
+	if (!n) {
+		return;
+	}
+
+	for (size_t first = 0; first < n; ++first) {
+		if (done[first]) {
+			continue;
+		}
+
+		block_device_t* dev = batch[first]->dev;
+		size_t count = 0;
+
+		for (size_t i = first; i < n; ++i) {
+			if (!done[i] && batch[i]->dev == dev) {
+				done[i] = true;
+				group[count] = batch[i];
+				ios[count].block = batch[i]->block;
+				ios[count].buffer = batch[i]->data;
+				ios[count].write = true;
+				++count;
+			}
+		}
+
+		dev->transfer(dev, ios, count);
+
+		for (size_t i = 0; i < count; ++i) {
+			buffer_t* b = group[i];
+
+			if (!ios[i].error) {
+				b->flags &= ~BUFFER_DIRTY;
+				++stats.writebacks;
+				continue;
+			}
+
+			// Keep it dirty, at the end of the list
+			++stats.errors;
+			b->dirty_next = NULL;
+			if (dirty_tail) {
+				dirty_tail->dirty_next = b;
+			} else {
+				dirty_head = b;
+			}
+			dirty_tail = b;
+			++dirty_count;
+		}
+	}
+	++stats.flushes;
+}
+
+/* Picks a buffer to reuse with the clock algorithm: referenced buffers get a
+   second chance, dirty ones are written back in a batch first. Returns NULL
+   if every buffer is in use. */
+static buffer_t* bcache_evict(void) {
+	for (size_t scanned = 0; scanned < 3 * buffers_count; ++scanned) {
+		buffer_t* b = &buffers[clock_hand];
+
+		clock_hand = (clock_hand + 1) % buffers_count;
+		if (b->refcount) {
+			continue;
+		} else if (b->flags & BUFFER_REFERENCED) {
+			b->flags &= ~BUFFER_REFERENCED;
+			continue;
+		} else if (b->flags & BUFFER_DIRTY) {
+			bcache_flush(BCACHE_FLUSH_BATCH);
+			if (b->flags & BUFFER_DIRTY) {
+				continue;
+			}
+		}
+
+		if (b->flags & BUFFER_VALID) {
+			hash_remove(b);
+			++stats.evictions;
+		}
+		b->flags = 0;
+		b->dev = NULL;
+		return b;
+	}
+	return NULL;
+}
+
+/* Fetches block and, for a sequential reader, up to readahead blocks after
+   it that are not cached yet, all in a single transfer. The first buffer is
+   returned referenced, the read-ahead ones are only cached. */
+static buffer_t* bcache_fill(block_device_t* dev, const uint64_t block, const bool fetch_first, const size_t readahead) {
+	buffer_t* fetched[1 + BCACHE_READAHEAD];
+	block_io_t ios[1 + BCACHE_READAHEAD];
+	size_t n = 0;
+
+	for (uint64_t b = block; b < dev->blocks && b <= block + readahead; ++b) {
+		if ((b == block && !fetch_first) || (b != block && hash_lookup(dev, b))) {
+			continue;
+		}
+
+		buffer_t* buffer = bcache_evict();
+
+		if (!buffer) {
+			break;
+		}
+		// Pinned until the transfer is over so that evict doesn't hand it out twice
+		buffer->refcount = 1;
+		buffer->dev = dev;
+		buffer->block = b;
+		fetched[n] = buffer;
+		ios[n].block = b;
+		ios[n].buffer = buffer->data;
+		ios[n].write = false;
+		++n;
+	}
+
+	if (n) {
+		dev->transfer(dev, ios, n);
+	}
+
+	buffer_t* first = NULL;
+
+	for (size_t i = 0; i < n; ++i) {
+		buffer_t* buffer = fetched[i];
+
+		if (ios[i].error) {
+			++stats.errors;
+			buffer->refcount = 0;
+			buffer->dev = NULL;
+			continue;
+		}
+
+		hash_insert(buffer);
+		if (fetch_first && buffer->block == block) {
+			buffer->flags = BUFFER_VALID | BUFFER_REFERENCED;
+			first = buffer;
+		} else {
+			buffer->flags = BUFFER_VALID | BUFFER_READAHEAD;
+			buffer->refcount = 0;
+			++stats.readahead;
+		}
+	}
+
+	if (readahead) {
+		readahead_end[dev->id] = block + readahead + 1;
+	}
+	return first;
+}
+
+/* Returns the buffer of block with valid data, referenced until
+   bcache_release(), or NULL on I/O error */
+buffer_t* bcache_read(block_device_t* dev, const uint64_t block) {
+	if (!dev || block >= dev->blocks || !buffers_count) {
+		return NULL;
+	}
+
+	const bool sequential = block == next_block[dev->id];
+	buffer_t* b = hash_lookup(dev, block);
+
+	next_block[dev->id] = block + 1;
+
+	if (!b) {
+		++stats.misses;
+		return bcache_fill(dev, block, true, sequential ? BCACHE_READAHEAD : 0);
+	}
+
+	++stats.hits;
+	if (b->flags & BUFFER_READAHEAD) {
+		++stats.readahead_hits;
+		b->flags &= ~BUFFER_READAHEAD;
+	}
+	b->flags |= BUFFER_REFERENCED;
+	++b->refcount;
+
+	// Keep the window ahead of the reader: refill once it is half consumed
+	if (sequential && block + BCACHE_READAHEAD / 2 >= readahead_end[dev->id]) {
+		bcache_fill(dev, readahead_end[dev->id] - 1, false, BCACHE_READAHEAD);
+	}
+	return b;
+}
+
+void bcache_mark_dirty(buffer_t* buffer) {
+	if ((buffer->flags & BUFFER_DIRTY) || buffer->dev->read_only) {
+		return;
+	}
+
+	buffer->flags |= BUFFER_DIRTY;
+	buffer->dirty_tick = timer_ticks;
+	buffer->dirty_next = NULL;
+	if (dirty_tail) {
+		dirty_tail->dirty_next = buffer;
+	} else {
+		dirty_head = buffer;
+	}
+	dirty_tail = buffer;
+	++dirty_count;
+}
+
+void bcache_release(buffer_t* buffer) {
+	if (buffer && buffer->refcount) {
+		--buffer->refcount;
+	}
+}
+
+void bcache_sync(void) {
+	size_t remaining = dirty_count;
+
+	// Failed writes are requeued, so don't loop more than once over the list
+	while (dirty_head && remaining) {
+		const size_t batch = remaining < BCACHE_FLUSH_BATCH ? remaining : BCACHE_FLUSH_BATCH;
+
+		bcache_flush(batch);
+		remaining -= batch;
+	}
+}
+
+/* Called from the idle loop: writes a batch once the oldest dirty buffer is
+   old enough or too many buffers are dirty */
+void bcache_flush_background(void) {
+	if (dirty_head && (dirty_count >= BCACHE_FLUSH_THRESHOLD
+			|| timer_ticks - dirty_head->dirty_tick >= BCACHE_FLUSH_AGE)) {
+		bcache_flush(BCACHE_FLUSH_BATCH);
+	}
+}
+
+void bcache_print_stats(void) {
+	size_t cached = 0;
+	size_t referenced = 0;
+
+	for (size_t i = 0; i < buffers_count; ++i) {
+		cached += (buffers[i].flags & BUFFER_VALID) != 0;
+		referenced += buffers[i].refcount != 0;
+	}
+
+	const uint32_t lookups = stats.hits + stats.misses;
+
+	terminal_printf("buffers %u  cached %u  dirty %u  in use %u",
+		(uint32_t) buffers_count, (uint32_t) cached, (uint32_t) dirty_count, (uint32_t) referenced);
+	terminal_printf("hits %u  misses %u  hit rate %u%%  read-ahead %u (%u used)",
+		stats.hits, stats.misses, lookups ? stats.hits * 100 / lookups : 0, stats.readahead, stats.readahead_hits);
+	terminal_printf("evictions %u  writebacks %u in %u flushes  errors %u",
+		stats.evictions, stats.writebacks, stats.flushes, stats.errors);
+}
+
+/* Reads the start of a device sequentially through the cache */
+void bcache_scan(block_device_t* dev) {
+	const uint64_t blocks = dev->blocks < BCACHE_SCAN_BLOCKS ? dev->blocks : BCACHE_SCAN_BLOCKS;
+	const bcache_stats_t before = stats;
+	const uint64_t start = rdtsc();
+	uint32_t errors = 0;
+
+	for (uint64_t block = 0; block < blocks; ++block) {
+		buffer_t* b = bcache_read(dev, block);
+
+		errors += !b;
+		bcache_release(b);
+	}
+
+	uint64_t us = tsc_to_us(rdtsc() - start);
+
+	if (!us) {
+		us = 1;
+	}
+
+	terminal_printf("%s: %u blocks in %u us, %u MB/s, %u errors", dev->name, (uint32_t) blocks, (uint32_t) us,
+		(uint32_t) (blocks * BLOCK_SIZE / us * 1000000 / (1024 * 1024)), errors);
+	terminal_printf("hits %u  misses %u  read-ahead %u (%u used)", stats.hits - before.hits,
+		stats.misses - before.misses, stats.readahead - before.readahead,
+		stats.readahead_hits - before.readahead_hits);
+}
+
+/* Dirties the first blocks of a device without changing their content, for
+   the background flush to write them back */
+void bcache_rewrite(block_device_t* dev) {
+	const uint64_t blocks = dev->blocks < BCACHE_REWRITE_BLOCKS ? dev->blocks : BCACHE_REWRITE_BLOCKS;
+
+	if (dev->read_only) {
+		terminal_printf("%s: read-only device", dev->name);
+		return;
+	}
+
+	for (uint64_t block = 0; block < blocks; ++block) {
+		buffer_t* b = bcache_read(dev, block);
+
+		if (b) {
+			bcache_mark_dirty(b);
+			bcache_release(b);
+		}
+	}
+	terminal_printf("%s: %u blocks dirty, %u in total", dev->name, (uint32_t) blocks, (uint32_t) dirty_count);
+}
@@ -0,0 +1,69 @@
+#include "kernel.hpp"
+#include "block.hpp"
+#include "utils.hpp"
+
+
+static block_device_t	devices[BLOCK_DEVICES];
+static size_t			devices_count = 0;
+
+
+block_device_t* block_register(const char* name, const uint64_t blocks, const bool read_only, void* data,
+		size_t (*transfer)(block_device_t* dev, block_io_t* ios, const size_t count)) {
+	if (devices_count == BLOCK_DEVICES) {
+		return NULL;
+	}
+
+	block_device_t* dev = &devices[devices_count];
+	size_t len = 0;
+
+	for (; name[len] && len < BLOCK_NAME_LEN - 1; ++len) {
+		dev->name[len] = name[len];
+	}
+	dev->name[len] = '\0';
+	dev->id = devices_count++;
+	dev->read_only = read_only;
+	dev->blocks = blocks;
+	dev->data = data;
+	dev->transfer = transfer;
+	return dev;
+}
+
+block_device_t* block_find(const char* name) {
+	const size_t len = kstrlen(name);
+
+	for (size_t i = 0; i < devices_count; ++i) {
+		if (kstrlen(devices[i].name) == len && memcmp(devices[i].name, name, len) == 0) {
+			return &devices[i];
+		}
+	}
+	return NULL;
+}
+
+block_device_t* block_device(const size_t index) {
+	return index < devices_count ? &devices[index] : NULL;
+}
+
+/* RAM disk backend: the device data points at the first byte of the disk */
+static size_t ramdisk_transfer(block_device_t* dev, block_io_t* ios, const size_t count) {
+	uint8_t* const base = reinterpret_cast<uint8_t *>(dev->data);
+	size_t errors = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		uint8_t* block = base + ios[i].block * BLOCK_SIZE;
+
+		ios[i].error = ios[i].block >= dev->blocks || (ios[i].write && dev->read_only);
+		if (ios[i].error) {
+			++errors;
+		} else if (ios[i].write) {
+			memcpy(block, ios[i].buffer, BLOCK_SIZE);
+		} else {
+			memcpy(ios[i].buffer, block, BLOCK_SIZE);
+		}
+	}
+	return errors;
+}
+
+/* Exposes [start, end[ as a block device. A trailing partial block is left out. */
+block_device_t* ramdisk_create(const char* name, const uintptr_t start, const uintptr_t end, const bool read_only) {
+	return block_register(name, (end - start) / BLOCK_SIZE, read_only, reinterpret_cast<void *>(start), ramdisk_transfer);
+}
@@ -1,6 +1,11 @@
 %define ALIGN     (1<<0)
 %define MEMINFO   (1<<1)
+%define VIDEO     (1<<2)
+%ifdef CONSOLE_FB
+%define FLAGS     (ALIGN | MEMINFO | VIDEO)
+%else
 %define FLAGS     (ALIGN | MEMINFO)
+%endif
 %define MAGIC     0x1BADB002
 %define CHECKSUM  -(MAGIC + FLAGS)
 
@@ -9,6 +14,15 @@ align 4
 dd MAGIC
 dd FLAGS
 dd CHECKSUM
+%ifdef CONSOLE_FB
+; Address fields, only used by a.out kernels
+dd 0, 0, 0, 0, 0
+; Linear framebuffer of CONSOLE_WIDTH x CONSOLE_HEIGHT cells (console.hpp)
+dd 0 ; mode type: linear graphics
+dd 1280 ; width
+dd 1024 ; height
+dd 32 ; depth
+%endif
 
 section .text
 bits 32
@@ -27,6 +41,8 @@ isr_wrapper:
 
 _start:
     mov esp, stack_top
+    push ebx ; Multiboot information structure
+    push eax ; Multiboot magic value
     call kmain
     hlt
 
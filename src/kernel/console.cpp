@@ -0,0 +1,281 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "console.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memtype.hpp"
+#include "multiboot.hpp"
+#include "paging.hpp"
+#include "utils.hpp"
+
+
+#define GLYPH_SLOT_FREE	0x100
+/* Set in shown[] for the cell the cursor is drawn on */
+#define CELL_CURSOR		0x10000
+#define CELL_UNKNOWN		0xFFFFFFFF
+/* The text mode fallback shows the bottom left corner of the grid */
+#define TEXT_TOP			(tty_t::height - CONSOLE_TEXT_HEIGHT)
+#define DIRTY_WORDS		((tty_t::height + 31) / 32)
+
+/* Every printable glyph already expanded to pixels for one color pair, so
+   that drawing a cell is a plain copy of its rows */
+typedef struct GlyphSlot {
+	uint32_t	pixels[FONT_GLYPHS][FONT_HEIGHT][FONT_WIDTH];
+	uint16_t	attribute;
+	bool		referenced;
+} glyph_slot_t;
+
+typedef struct ConsoleStats {
+	uint32_t	frames;
+	uint32_t	rows;
+	uint32_t	cells_drawn;
+	uint32_t	cells_unchanged;
+	uint32_t	slot_misses;
+} console_stats_t;
+
+static const uint32_t	vga_rgb[16] = {
+	0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+	0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+/* What the terminal writes, and what the screen currently shows */
+static uint16_t			cells[tty_t::cells];
+static uint32_t			shown[tty_t::cells];
+static glyph_slot_t		slots[CONSOLE_GLYPH_SLOTS];
+static uint8_t			slot_of[256];		// slot index + 1 of each color attribute, 0 if not expanded
+static size_t			slot_hand = 0;
+static uint32_t			palette[16];
+/* One bit per row written since it was last drawn */
+static uint32_t			dirty_rows[DIRTY_WORDS];
+/* Cell index of the cursor, one word so that it changes in one store */
+static uint32_t			cursor_cell = 0;
+static bool				flushing = false;
+static volatile bool	flush_due = false;
+static bool				ready = false;
+static uint8_t*			fb = NULL;			// NULL when falling back to VGA text mode
+static uint32_t			fb_pitch = 0;
+static uint16_t* const	text = (uint16_t*) CONSOLE_TEXT_BUFFER;
+static console_stats_t	stats;
+
+
+static uint32_t pixel_color(const uint32_t rgb, const boot_framebuffer_t* info) {
+	return ((rgb >> 16) & 0xFF) << info->red_position | ((rgb >> 8) & 0xFF) << info->green_position
+		| (rgb & 0xFF) << info->blue_position;
+}
+
+/* Color pairs are replaced with the clock algorithm: a pair used since the
+   hand last passed gets a second chance */
+static glyph_slot_t* glyph_slot(const uint8_t attribute) {
+	if (slot_of[attribute]) {
+		glyph_slot_t* const slot = &slots[slot_of[attribute] - 1];
+
+		slot->referenced = true;
+		return slot;
+	}
+
+	while (slots[slot_hand].referenced) {
+		slots[slot_hand].referenced = false;
+		slot_hand = (slot_hand + 1) % CONSOLE_GLYPH_SLOTS;
+	}
+
+	glyph_slot_t* const slot = &slots[slot_hand];
+	const uint32_t fg = palette[attribute & 0x0F];
+	const uint32_t bg = palette[attribute >> 4];
+
+	if (slot->attribute != GLYPH_SLOT_FREE) {
+		slot_of[slot->attribute] = 0;
+	}
+	for (size_t glyph = 0; glyph < FONT_GLYPHS; ++glyph) {
+		for (size_t row = 0; row < FONT_HEIGHT; ++row) {
+			const uint8_t bits = font_8x8[glyph][row];
+
+			for (size_t x = 0; x < FONT_WIDTH; ++x) {
+				slot->pixels[glyph][row][x] = (bits >> x) & 1 ? fg : bg;
+			}
+		}
+	}
+	slot->attribute = attribute;
+	slot->referenced = true;
+	slot_of[attribute] = slot_hand + 1;
+	slot_hand = (slot_hand + 1) % CONSOLE_GLYPH_SLOTS;
+	++stats.slot_misses;
+	return slot;
+}
+
+static void draw_cell(const size_t x, const size_t y, const uint16_t cell, const bool cursor) {
+	const uint8_t c = cell & 0xFF;
+	const uint32_t (*glyph)[FONT_WIDTH] = glyph_slot(cell >> 8)->pixels[c >= FONT_FIRST && c <= FONT_LAST ? c - FONT_FIRST : 0];
+	uint8_t* line = fb + y * CONSOLE_CELL_HEIGHT * fb_pitch + x * CONSOLE_CELL_WIDTH * sizeof(uint32_t);
+
+	for (size_t row = 0; row < CONSOLE_CELL_HEIGHT; ++row, line += fb_pitch) {
+		const uint32_t* const src = glyph[row / FONT_SCALE];
+		uint32_t* const dest = (uint32_t*) line;
+
+		if (cursor && row >= CONSOLE_CELL_HEIGHT - CONSOLE_CURSOR_ROWS) {
+			for (size_t i = 0; i < CONSOLE_CELL_WIDTH; ++i) {
+				dest[i] = palette[(cell >> 8) & 0x0F];
+			}
+		} else {
+			for (size_t i = 0; i < CONSOLE_CELL_WIDTH; ++i) {
+				dest[i] = src[i];
+			}
+		}
+	}
+}
+
+/* Maps the framebuffer GRUB set up, if it has the mode boot.asm asked for */
+static bool framebuffer_init(void) {
+	const boot_framebuffer_t* info = boot_framebuffer();
+
+	if (!info || info->bpp != CONSOLE_DEPTH || info->width < tty_t::width * CONSOLE_CELL_WIDTH
+			|| info->height < tty_t::height * CONSOLE_CELL_HEIGHT) {
+		return false;
+	}
+
+	const uintptr_t start = info->addr & PAGE_LARGE_FRAME;
+	const uintptr_t end = ((info->addr + (uintptr_t) info->pitch * info->height - 1) | (LARGE_PAGE_SIZE - 1)) + 1;
+
+	if (!paging_map_device(start, end)) {
+		return false;
+	}
+	// Without PAT, an MTRR only takes a power of two range: the frame buffer is usually one
+	memtype_set(start, end, MEMTYPE_WC);
+
+	for (size_t i = 0; i < 16; ++i) {
+		palette[i] = pixel_color(vga_rgb[i], info);
+	}
+	fb = (uint8_t*) info->addr;
+	fb_pitch = info->pitch;
+	memset(fb, 0, (size_t) fb_pitch * info->height);
+	return true;
+}
+
+/* Returns the cells the terminal writes in, rendered by console_flush() */
+__init uint16_t* console_init(void) {
+	if (framebuffer_init()) {
+		klog(KLOG_INFO, "console: %ux%u cells on a %ux%u framebuffer", tty_t::width, tty_t::height,
+			boot_framebuffer()->width, boot_framebuffer()->height);
+	} else {
+		klog(KLOG_WARN, "console: no usable framebuffer, VGA text fallback");
+	}
+
+	for (size_t i = 0; i < CONSOLE_GLYPH_SLOTS; ++i) {
+		slots[i].attribute = GLYPH_SLOT_FREE;
+	}
+	memset(shown, CELL_UNKNOWN & 0xFF, sizeof(shown));
+	ready = true;
+	return cells;
+}
+
+/* Cheap enough for every cell write: one or per row, without masking
+   interrupts. On the one CPU, an interrupt can't split an instruction, and
+   the flush takes the bits with an exchange. Rows rather than rectangles:
+   a row is drawn whole, its unchanged cells skipped. */
+void console_dirty(const size_t y, const size_t height) {
+	const size_t end = y + height < tty_t::height ? y + height : tty_t::height;
+
+	for (size_t row = y; row < end; ++row) {
+		__asm__ volatile ("orl %1, %0" : "+m"(dirty_rows[row / 32]) : "ri"(1u << (row % 32)));
+	}
+}
+
+void console_cursor(const size_t x, const size_t y) {
+	const uint32_t old = __atomic_exchange_n(&cursor_cell, tty_t::index(x, y), __ATOMIC_RELAXED);
+
+	console_dirty(old / tty_t::width, 1);
+	console_dirty(y, 1);
+}
+
+/* Draws the cells of the dirty rows that changed since they were last
+   shown, with interrupts on: a cell written meanwhile marks its row dirty
+   again. Only the check for a flush already running masks them. */
+void console_flush(void) {
+	uint32_t rows[DIRTY_WORDS];
+	const uint32_t flags = irq_save();
+
+	flush_due = false;
+	if (!ready || flushing) {
+		irq_restore(flags);
+		return;
+	}
+	flushing = true;
+	irq_restore(flags);
+
+	const size_t cursor = __atomic_load_n(&cursor_cell, __ATOMIC_RELAXED);
+	const size_t cx = cursor % tty_t::width;
+	const size_t cy = cursor / tty_t::width;
+	uint32_t count = 0;
+
+	for (size_t word = 0; word < DIRTY_WORDS; ++word) {
+		rows[word] = __atomic_exchange_n(&dirty_rows[word], 0, __ATOMIC_ACQUIRE);
+	}
+
+	for (size_t word = 0; word < DIRTY_WORDS; ++word) {
+		for (uint32_t bits = rows[word]; bits; bits &= bits - 1, ++count) {
+			const size_t y = word * 32 + __builtin_ctz(bits);
+
+			for (size_t x = 0; x < tty_t::width; ++x) {
+				const size_t index = tty_t::index(x, y);
+				const uint16_t cell = cells[index];
+				const bool is_cursor = index == cursor;
+				const uint32_t value = cell | (is_cursor ? CELL_CURSOR : 0);
+
+				if (shown[index] == value) {
+					++stats.cells_unchanged;
+					continue;
+				}
+				shown[index] = value;
+				++stats.cells_drawn;
+				if (fb) {
+					draw_cell(x, y, cell, is_cursor);
+				} else if (x < CONSOLE_TEXT_WIDTH && y >= TEXT_TOP) {
+					text[(y - TEXT_TOP) * CONSOLE_TEXT_WIDTH + x] = cell;
+				}
+			}
+		}
+	}
+
+	if (count) {
+		// The screen is write-combining: flush it before the cursor moves
+		wc_barrier();
+		if (!fb && cx < CONSOLE_TEXT_WIDTH && cy >= TEXT_TOP) {
+			crtc_cursor((cy - TEXT_TOP) * CONSOLE_TEXT_WIDTH + cx);
+		}
+		++stats.frames;
+		stats.rows += count;
+	}
+	flushing = false;
+}
+
+/* From the timer interrupt, which doesn't draw anything itself: a long
+   command's output shows up at its next line, in console_poll() */
+void console_tick(const uint32_t ticks) {
+	if (ticks % CONSOLE_FLUSH_TICKS == 0) {
+		flush_due = true;
+	}
+}
+
+void console_poll(void) {
+	if (flush_due) {
+		console_flush();
+	}
+}
+
+void console_print(void) {
+	size_t used = 0;
+
+	for (size_t i = 0; i < CONSOLE_GLYPH_SLOTS; ++i) {
+		used += slots[i].attribute != GLYPH_SLOT_FREE;
+	}
+
+	if (fb) {
+		terminal_printf("framebuffer 0x%p, pitch %u, %ux%u cells of %ux%u pixels", fb, fb_pitch,
+			(uint32_t) tty_t::width, (uint32_t) tty_t::height, CONSOLE_CELL_WIDTH, CONSOLE_CELL_HEIGHT);
+	} else {
+		terminal_printf("no framebuffer, VGA text mode shows %ux%u of %ux%u cells", CONSOLE_TEXT_WIDTH,
+			CONSOLE_TEXT_HEIGHT, (uint32_t) tty_t::width, (uint32_t) tty_t::height);
+	}
+	terminal_printf("%u frames, %u rows, %u cells drawn, %u unchanged", stats.frames, stats.rows,
+		stats.cells_drawn, stats.cells_unchanged);
+	terminal_printf("glyph cache: %u/%u color pairs, %u expanded", (uint32_t) used, CONSOLE_GLYPH_SLOTS, stats.slot_misses);
+}
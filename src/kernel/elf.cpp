@@ -0,0 +1,54 @@
+#include "kernel.hpp"
+#include "elf.hpp"
+#include "utils.hpp"
+
+
+static bool inside(const uint32_t addr, const uint32_t size, const uintptr_t start, const uintptr_t end) {
+	return addr >= start && addr <= end && size <= end - addr;
+}
+
+/* Copies the PT_LOAD segments of the executable in image to their address,
+   which must be inside [start, end[, and zeroes their .bss part.
+   Returns NULL on success, or why the image was rejected. */
+const char* elf_load(const uint8_t* image, const size_t size, const uintptr_t start, const uintptr_t end, uint32_t* entry) {
+	const elf32_header_t* header = (const elf32_header_t *) image;
+
+	if (size < sizeof(elf32_header_t) || header->magic != ELF_MAGIC) {
+		return "not an ELF file";
+	} else if (header->elf_class != ELF_CLASS_32 || header->data != ELF_DATA_LSB
+			|| header->type != ELF_TYPE_EXEC || header->machine != ELF_MACHINE_386) {
+		return "not an i386 executable";
+	} else if (header->phentsize != sizeof(elf32_program_header_t)
+			|| !inside(header->phoff, header->phnum * sizeof(elf32_program_header_t), 0, size)) {
+		return "bad program headers";
+	} else if (!inside(header->entry, 1, start, end)) {
+		return "entry point outside of user memory";
+	} else if ((uintptr_t) image < end && (uintptr_t) image + size > start) {
+		return "image overlaps user memory";
+	}
+
+	const elf32_program_header_t* segments = (const elf32_program_header_t *) (image + header->phoff);
+
+	// Check everything first so that a bad file doesn't leave a half loaded program
+	for (size_t i = 0; i < header->phnum; ++i) {
+		if (segments[i].type != ELF_PT_LOAD) {
+			continue;
+		} else if (segments[i].filesz > segments[i].memsz
+				|| !inside(segments[i].offset, segments[i].filesz, 0, size)
+				|| !inside(segments[i].vaddr, segments[i].memsz, start, end)) {
+			return "segment outside of user memory";
+		}
+	}
+
+	for (size_t i = 0; i < header->phnum; ++i) {
+		const elf32_program_header_t* segment = &segments[i];
+
+		if (segment->type == ELF_PT_LOAD) {
+			memcpy((void *) segment->vaddr, image + segment->offset, segment->filesz);
+			memset((void *) (segment->vaddr + segment->filesz), 0, segment->memsz - segment->filesz);
+		}
+	}
+
+	*entry = header->entry;
+	return NULL;
+}
@@ -0,0 +1,139 @@
+#include "kernel.hpp"
+#include "fpu.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "utils.hpp"
+
+
+static bool				fpu = false;
+static bool				fxsr = false;
+static bool				sse = false;
+static bool				sse2 = false;
+/* Context whose state is in the registers, and context running now. NULL
+   is the kernel, which never keeps FPU state between two calls. */
+static fpu_context_t*	owner = NULL;
+static fpu_context_t*	current = NULL;
+
+
+static inline void clts(void) {
+	__asm__ volatile ("clts" : : : "memory");
+}
+
+static inline void stts(void) {
+	write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_save(fpu_context_t* context) {
+	if (fxsr) {
+		__asm__ volatile ("fxsave %0" : "=m"(context->state));
+	} else {
+		__asm__ volatile ("fnsave %0" : "=m"(context->state));
+	}
+}
+
+static void fpu_restore(fpu_context_t* context) {
+	if (!context->initialized) {
+		const uint32_t mxcsr = MXCSR_DEFAULT;
+
+		__asm__ volatile ("fninit");
+		if (sse) {
+			__asm__ volatile ("ldmxcsr %0" : : "m"(mxcsr));
+		}
+		context->initialized = true;
+	} else if (fxsr) {
+		__asm__ volatile ("fxrstor %0" : : "m"(context->state));
+	} else {
+		__asm__ volatile ("frstor %0" : : "m"(context->state));
+	}
+}
+
+/* #NM: the running context touched the FPU while another one owns it */
+static bool fpu_trap(exception_frame_t*) {
+	clts();
+	if (owner != current) {
+		if (owner) {
+			fpu_save(owner);
+		}
+		if (current) {
+			fpu_restore(current);
+		}
+		owner = current;
+	}
+	return true;
+}
+
+__init void fpu_init(void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	fpu = edx & CPUID_FPU;
+	fxsr = edx & CPUID_FXSR;
+	sse = fxsr && (edx & CPUID_SSE);
+	sse2 = sse && (edx & CPUID_SSE2);
+
+	if (!fpu) {
+		return;
+	}
+
+	// MP: wait/fwait honours TS too, NE: native x87 error reporting
+	write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+	if (fxsr) {
+		write_cr4(read_cr4() | CR4_OSFXSR | (sse ? CR4_OSXMMEXCPT : 0));
+	}
+	__asm__ volatile ("fninit");
+
+	exception_register(EXCEPTION_NM, fpu_trap);
+	klog(KLOG_INFO, "fpu: x87%s%s%s, lazy switching", fxsr ? ", fxsave" : "", sse ? ", SSE" : "", sse2 ? ", SSE2" : "");
+}
+
+bool fpu_has_sse2(void) {
+	return sse2;
+}
+
+void fpu_context_init(fpu_context_t* context) {
+	context->initialized = false;
+}
+
+/* Makes context (NULL for the kernel) the running one. Its registers are
+   only loaded on its first FPU instruction. */
+void fpu_switch(fpu_context_t* context) {
+	if (!fpu) {
+		return;
+	}
+
+	current = context;
+	if (owner == context) {
+		clts();
+	} else {
+		stts();
+	}
+}
+
+/* The context is gone: its registers don't need to be saved any more */
+void fpu_release(fpu_context_t* context) {
+	if (owner == context) {
+		owner = NULL;
+	}
+}
+
+/* Lets the kernel use SSE until fpu_kernel_end(), from any context. The
+   state of the owner is saved first, so a program interrupted by a system
+   call or an IRQ gets its registers back through #NM. Interrupts stay
+   disabled in between: the registers are not saved for nested users. */
+uint32_t fpu_kernel_begin(void) {
+	const uint32_t flags = irq_save();
+
+	clts();
+	if (owner) {
+		fpu_save(owner);
+		owner = NULL;
+	}
+	return flags;
+}
+
+void fpu_kernel_end(const uint32_t flags) {
+	if (current) {
+		stts();
+	}
+	irq_restore(flags);
+}
@@ -0,0 +1,192 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "hexdump.hpp"
+#include "paging.hpp"
+#include "serial.hpp"
+#include "utils.hpp"
+
+
+/* Both hex digits of every byte, so that a byte is formatted with a single
+   two character copy */
+typedef struct HexTable {
+	char	pairs[256][2];
+} hex_table_t;
+
+static constexpr hex_table_t hex_build(void) {
+	constexpr char digits[] = "0123456789abcdef";
+	hex_table_t table = {};
+
+	for (size_t i = 0; i < 256; ++i) {
+		table.pairs[i][0] = digits[i >> 4];
+		table.pairs[i][1] = digits[i & 0xF];
+	}
+	return table;
+}
+
+static constexpr hex_table_t	hex = hex_build();
+
+static_assert(hex.pairs[0xA7][0] == 'a' && hex.pairs[0xA7][1] == '7', "hex table");
+
+/* Where a plain "x" goes on, once a dump was longer than a screen */
+static uintptr_t	next_addr = 0;
+static size_t		next_len = 0;
+static size_t		next_unit = 1;
+
+
+static inline char* put_byte(char* out, const uint8_t byte) {
+	out[0] = hex.pairs[byte][0];
+	out[1] = hex.pairs[byte][1];
+	return out + 2;
+}
+
+/* Formats one row of up to HEXDUMP_ROW_BYTES bytes. Units of more than a
+   byte are shown as little endian values, like the CPU reads them. */
+static size_t format_row(char* line, const uintptr_t addr, const uint8_t* data, const size_t len, const size_t unit) {
+	char* out = line;
+
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out = put_byte(out, addr >> shift);
+	}
+	*out++ = ' ';
+
+	for (size_t offset = 0; offset < HEXDUMP_ROW_BYTES; offset += unit) {
+		*out++ = ' ';
+		if (unit == 1 && offset == HEXDUMP_ROW_BYTES / 2) {
+			*out++ = ' ';
+		}
+		for (size_t byte = unit; byte--;) {
+			if (offset + unit <= len) {
+				out = put_byte(out, data[offset + byte]);
+			} else {
+				*out++ = ' ';
+				*out++ = ' ';
+			}
+		}
+	}
+
+	*out++ = ' ';
+	*out++ = ' ';
+	*out++ = '|';
+	for (size_t i = 0; i < len; ++i) {
+		*out++ = data[i] >= 0x20 && data[i] < 0x7F ? data[i] : '.';
+	}
+	*out++ = '|';
+	*out = '\0';
+	return out - line;
+}
+
+/* A fault in the kernel stops it: every page is checked before it's read */
+static bool readable(const uintptr_t start, const size_t len) {
+	return paging_mapped(current_space(), start) && paging_mapped(current_space(), start + len - 1);
+}
+
+/* Dumps len bytes at addr, a screenful at most: a plain "x" shows the rest.
+   Over the serial port, everything goes out at once. */
+void hexdump(const uintptr_t addr, const size_t len, const size_t unit, const bool serial) {
+	const size_t rows_max = serial ? (size_t) -1 : tty_t::height - 2;
+	char line[HEXDUMP_LINE];
+	size_t done = 0;
+
+	for (size_t rows = 0; done < len && rows < rows_max; ++rows) {
+		const size_t row_len = len - done < HEXDUMP_ROW_BYTES ? len - done : HEXDUMP_ROW_BYTES;
+
+		if (!readable(addr + done, row_len)) {
+			terminal_printf("hexdump: 0x%p is not mapped", addr + done);
+			next_len = 0;
+			return;
+		}
+
+		const size_t line_len = format_row(line, addr + done, (const uint8_t*) (addr + done), row_len, unit);
+
+		if (serial) {
+			line[line_len] = '\r';
+			line[line_len + 1] = '\n';
+			serial_write(line, line_len + 2);
+		} else {
+			terminal_print_line(line);
+		}
+		done += row_len;
+	}
+
+	next_addr = addr + done;
+	next_len = len - done;
+	next_unit = unit;
+	if (serial) {
+		terminal_printf("hexdump: %u bytes sent to the serial port", len);
+	} else if (next_len) {
+		terminal_printf("-- %u bytes left, x to go on --", next_len);
+	}
+}
+
+/* Decimal, or hexadecimal after 0x. False when it's neither. */
+static bool parse_number(const char* str, uint32_t* value) {
+	const bool hexadecimal = str[0] == '0' && (str[1] == 'x' || str[1] == 'X');
+	uint32_t result = 0;
+
+	str += hexadecimal ? 2 : 0;
+	if (!*str) {
+		return false;
+	}
+	for (; *str; ++str) {
+		const char c = *str | 0x20;
+
+		if (c >= '0' && c <= '9') {
+			result = result * (hexadecimal ? 16 : 10) + (c - '0');
+		} else if (hexadecimal && c >= 'a' && c <= 'f') {
+			result = result * 16 + (c - 'a' + 10);
+		} else {
+			return false;
+		}
+	}
+	*value = result;
+	return true;
+}
+
+/* hexdump <addr> <len> [serial] */
+void hexdump_command(const char* addr, const char* len, const char* target) {
+	uint32_t start, size;
+
+	if (!parse_number(addr, &start) || !parse_number(len, &size) || !size
+			|| (*target && (kstrlen(target) != 6 || memcmp(target, "serial", 6) != 0))) {
+		terminal_printf("usage: hexdump <addr> <len> [serial]");
+		return;
+	}
+	hexdump(start, size, 1, *target);
+}
+
+/* x/<count><unit> <addr>, with units b, h, w and g of 1, 2, 4 and 8 bytes as
+   in gdb. A plain x goes on with the previous dump. */
+void examine_command(const char* format, const char* addr) {
+	uint32_t start, count = 1;
+	size_t unit = 1;
+
+	if (!*format && !*addr) {
+		if (!next_len) {
+			terminal_printf("x: nothing to go on with");
+		} else {
+			hexdump(next_addr, next_len, next_unit, false);
+		}
+		return;
+	}
+
+	char digits[12];
+	size_t len = 0;
+
+	while (*format >= '0' && *format <= '9' && len < sizeof(digits) - 1) {
+		digits[len++] = *format++;
+	}
+	digits[len] = '\0';
+	switch (*format) {
+		case 'b': unit = 1; ++format; break;
+		case 'h': unit = 2; ++format; break;
+		case 'w': unit = 4; ++format; break;
+		case 'g': unit = 8; ++format; break;
+		default: break;
+	}
+
+	if ((len && !parse_number(digits, &count)) || *format || !count || !parse_number(addr, &start)) {
+		terminal_printf("usage: x/<count><b|h|w|g> <addr>, or x to go on");
+		return;
+	}
+	hexdump(start, count * unit, unit, false);
+}
@@ -0,0 +1,264 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "initrd.hpp"
+#include "simd.hpp"
+#include "utils.hpp"
+
+
+static initrd_file_t	files[INITRD_MAX_FILES];
+static size_t			files_count = 0;
+/* Open addressing index over files, by path hash. Slots hold a file index
+   plus one, 0 marks an empty slot. */
+static uint8_t			path_index[INITRD_HASH_SIZE];
+
+static_assert(INITRD_MAX_FILES < 256, "path_index slots are 8 bits wide");
+static_assert((INITRD_HASH_SIZE & (INITRD_HASH_SIZE - 1)) == 0, "INITRD_HASH_SIZE must be a power of two");
+
+
+/* FNV-1a, fed one path segment at a time */
+# define FNV_OFFSET	2166136261u
+# define FNV_PRIME	16777619u
+
+static inline uint32_t hash_update(uint32_t hash, const char* str, const size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ (uint8_t) str[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint32_t hash_path(const char* prefix, const size_t prefix_len, const char* name, const size_t name_len) {
+	uint32_t hash = FNV_OFFSET;
+
+	if (prefix_len) {
+		hash = hash_update(hash, prefix, prefix_len);
+		hash = hash_update(hash, "/", 1);
+	}
+	return hash_update(hash, name, name_len);
+}
+
+static size_t parse_octal(const char* str, const size_t len) {
+	size_t value = 0;
+
+	for (size_t i = 0; i < len && str[i] >= '0' && str[i] <= '7'; ++i) {
+		value = value * 8 + (str[i] - '0');
+	}
+	return value;
+}
+
+/* Drops any leading "./" or "/" and trailing "/" from a path */
+static const char* normalize_path(const char* path, size_t* len) {
+	while (*len && (path[0] == '/' || (path[0] == '.' && (*len == 1 || path[1] == '/')))) {
+		++path;
+		--*len;
+	}
+	while (*len && path[*len - 1] == '/') {
+		--*len;
+	}
+	return path;
+}
+
+static size_t field_len(const char* field, const size_t max) {
+	const char* end = (const char *) memchr(field, '\0', max);
+
+	return end ? end - field : max;
+}
+
+static bool path_equals(const initrd_file_t* file, const char* path, const size_t len) {
+	if (file->prefix_len) {
+		return len == (size_t) file->prefix_len + 1 + file->name_len
+			&& memcmp(path, file->prefix, file->prefix_len) == 0
+			&& path[file->prefix_len] == '/'
+			&& memcmp(path + file->prefix_len + 1, file->name, file->name_len) == 0;
+	}
+	return len == file->name_len && memcmp(path, file->name, len) == 0;
+}
+
+static void index_file(const size_t file_index) {
+	size_t slot = files[file_index].hash & (INITRD_HASH_SIZE - 1);
+
+	while (path_index[slot]) {
+		slot = (slot + 1) & (INITRD_HASH_SIZE - 1);
+	}
+	path_index[slot] = file_index + 1;
+}
+
+/* Walks the ustar archive in [start, end[ once and builds the path index */
+__init bool initrd_init(const uintptr_t start, const uintptr_t end) {
+	uintptr_t offset = start;
+
+	while (offset + TAR_BLOCK_SIZE <= end && files_count < INITRD_MAX_FILES) {
+		const tar_header_t* header = (const tar_header_t *) offset;
+
+		if (!header->name[0] || memcmp(header->magic, "ustar", 5) != 0) {
+			break;
+		}
+
+		const size_t size = parse_octal(header->size, sizeof(header->size));
+		size_t prefix_len = field_len(header->prefix, sizeof(header->prefix));
+		size_t name_len = field_len(header->name, sizeof(header->name));
+		const char* prefix = normalize_path(header->prefix, &prefix_len);
+		const char* name = prefix_len ? header->name : normalize_path(header->name, &name_len);
+
+		while (name_len && name[name_len - 1] == '/') {
+			--name_len;
+		}
+
+		offset += TAR_BLOCK_SIZE;
+		if (offset + size > end) {
+			break;
+		}
+
+		if (name_len && (header->typeflag == TAR_TYPE_FILE || header->typeflag == TAR_TYPE_OLD_FILE
+				|| header->typeflag == TAR_TYPE_DIRECTORY)) {
+			initrd_file_t* file = &files[files_count];
+
+			file->prefix = prefix;
+			file->prefix_len = prefix_len;
+			file->name = name;
+			file->name_len = name_len;
+			file->data = (const uint8_t *) offset;
+			file->size = size;
+			file->directory = header->typeflag == TAR_TYPE_DIRECTORY;
+			file->hash = hash_path(prefix, prefix_len, name, name_len);
+			index_file(files_count++);
+		}
+
+		offset += (size + TAR_BLOCK_SIZE - 1) & ~(TAR_BLOCK_SIZE - 1);
+	}
+
+	return files_count != 0;
+}
+
+const initrd_file_t* initrd_lookup(const char* path) {
+	size_t len = kstrlen(path);
+
+	path = normalize_path(path, &len);
+
+	const uint32_t hash = hash_path(NULL, 0, path, len);
+	size_t slot = hash & (INITRD_HASH_SIZE - 1);
+
+	for (; path_index[slot]; slot = (slot + 1) & (INITRD_HASH_SIZE - 1)) {
+		const initrd_file_t* file = &files[path_index[slot] - 1];
+
+		if (file->hash == hash && path_equals(file, path, len)) {
+			return file;
+		}
+	}
+	return NULL;
+}
+
+/* Returns how many bytes can be read from offset, with *data pointing at
+   them inside the module memory */
+size_t initrd_read(const initrd_file_t* file, const size_t offset, const uint8_t** data) {
+	if (!file || file->directory || offset >= file->size) {
+		*data = NULL;
+		return 0;
+	}
+
+	*data = file->data + offset;
+	return file->size - offset;
+}
+
+size_t initrd_file_count(void) {
+	return files_count;
+}
+
+const initrd_file_t* initrd_file(const size_t index) {
+	return index < files_count ? &files[index] : NULL;
+}
+
+size_t initrd_path(const initrd_file_t* file, char* buf, const size_t size) {
+	size_t len = 0;
+
+	for (size_t i = 0; i < file->prefix_len && len < size - 1; ++i) {
+		buf[len++] = file->prefix[i];
+	}
+	if (file->prefix_len && len < size - 1) {
+		buf[len++] = '/';
+	}
+	for (size_t i = 0; i < file->name_len && len < size - 1; ++i) {
+		buf[len++] = file->name[i];
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+void initrd_ls(const char* dir) {
+	size_t dir_len = kstrlen(dir);
+	char path[INITRD_PATH_MAX];
+
+	dir = normalize_path(dir, &dir_len);
+
+	if (dir_len) {
+		const initrd_file_t* file = initrd_lookup(dir);
+
+		if (!file) {
+			terminal_printf("ls: %s: No such file or directory", dir);
+			return;
+		} else if (!file->directory) {
+			terminal_printf("%8u  %s", (uint32_t) file->size, dir);
+			return;
+		}
+	}
+
+	for (size_t i = 0; i < files_count; ++i) {
+		const size_t len = initrd_path(&files[i], path, sizeof(path));
+		const char* entry = path;
+
+		if (dir_len) {
+			if (len <= dir_len || memcmp(path, dir, dir_len) != 0 || path[dir_len] != '/') {
+				continue;
+			}
+			entry = path + dir_len + 1;
+		}
+
+		bool nested = false;
+
+		for (const char* c = entry; *c; ++c) {
+			nested |= *c == '/';
+		}
+		if (nested) {
+			continue;
+		}
+
+		if (files[i].directory) {
+			terminal_printf("       -  %s/", entry);
+		} else {
+			terminal_printf("%8u  %s", (uint32_t) files[i].size, entry);
+		}
+	}
+}
+
+void initrd_cat(const char* path) {
+	const initrd_file_t* file = initrd_lookup(path);
+	const uint8_t* data;
+	char line[VGA_WIDTH + 1];
+	size_t line_len = 0;
+
+	if (!file) {
+		terminal_printf("cat: %s: No such file or directory", path);
+		return;
+	} else if (file->directory) {
+		terminal_printf("cat: %s: Is a directory", path);
+		return;
+	}
+
+	const size_t size = initrd_read(file, 0, &data);
+
+	for (size_t i = 0; i < size; ++i) {
+		if (data[i] == '\n' || line_len == VGA_WIDTH) {
+			line[line_len] = '\0';
+			terminal_print_line(line);
+			line_len = 0;
+			if (data[i] == '\n') {
+				continue;
+			}
+		}
+		line[line_len++] = (data[i] >= ' ' && data[i] < 0x7F) ? data[i] : '.';
+	}
+
+	if (line_len) {
+		line[line_len] = '\0';
+		terminal_print_line(line);
+	}
+}
@@ -0,0 +1,154 @@
+section .text
+bits 32
+
+extern irq_dispatch
+extern msi_dispatch
+extern exception_dispatch
+
+; Saves the registers and calls irq_dispatch(irq) for a legacy PIC line
+%macro IRQ_STUB 1
+irq_stub_%1:
+    pushad
+    cld
+    push dword %1
+    call irq_dispatch
+    add esp, 4
+    popad
+    iretd
+%endmacro
+
+IRQ_STUB 0
+IRQ_STUB 1
+IRQ_STUB 2
+IRQ_STUB 3
+IRQ_STUB 4
+IRQ_STUB 5
+IRQ_STUB 6
+IRQ_STUB 7
+IRQ_STUB 8
+IRQ_STUB 9
+IRQ_STUB 10
+IRQ_STUB 11
+IRQ_STUB 12
+IRQ_STUB 13
+IRQ_STUB 14
+IRQ_STUB 15
+
+; Same for a vector handed out to a PCI device's MSI, from MSI_VECTOR_START
+%macro MSI_STUB 1
+msi_stub_%1:
+    pushad
+    cld
+    push dword %1
+    call msi_dispatch
+    add esp, 4
+    popad
+    iretd
+%endmacro
+
+MSI_STUB 0
+MSI_STUB 1
+MSI_STUB 2
+MSI_STUB 3
+MSI_STUB 4
+MSI_STUB 5
+MSI_STUB 6
+MSI_STUB 7
+MSI_STUB 8
+MSI_STUB 9
+MSI_STUB 10
+MSI_STUB 11
+MSI_STUB 12
+MSI_STUB 13
+MSI_STUB 14
+MSI_STUB 15
+
+; The local APIC's spurious vector must not be acknowledged
+global lapic_spurious_stub
+lapic_spurious_stub:
+    iretd
+
+; CPU exceptions: the ones without an error code push a 0 so that
+; exception_dispatch() always gets the same frame
+%macro EXCEPTION_STUB 1
+exception_stub_%1:
+    push dword 0
+    push dword %1
+    jmp exception_common
+%endmacro
+
+%macro EXCEPTION_STUB_ERROR 1
+exception_stub_%1:
+    push dword %1
+    jmp exception_common
+%endmacro
+
+exception_common:
+    pushad
+    cld
+    push esp                    ; exception_frame_t*
+    call exception_dispatch
+    add esp, 4
+    popad
+    add esp, 8                  ; vector and error code
+    iretd
+
+EXCEPTION_STUB 0
+EXCEPTION_STUB 1
+EXCEPTION_STUB 2
+EXCEPTION_STUB 3
+EXCEPTION_STUB 4
+EXCEPTION_STUB 5
+EXCEPTION_STUB 6
+EXCEPTION_STUB 7
+EXCEPTION_STUB_ERROR 8
+EXCEPTION_STUB 9
+EXCEPTION_STUB_ERROR 10
+EXCEPTION_STUB_ERROR 11
+EXCEPTION_STUB_ERROR 12
+EXCEPTION_STUB_ERROR 13
+EXCEPTION_STUB_ERROR 14
+EXCEPTION_STUB 15
+EXCEPTION_STUB 16
+EXCEPTION_STUB_ERROR 17
+EXCEPTION_STUB 18
+EXCEPTION_STUB 19
+EXCEPTION_STUB 20
+EXCEPTION_STUB_ERROR 21
+EXCEPTION_STUB 22
+EXCEPTION_STUB 23
+EXCEPTION_STUB 24
+EXCEPTION_STUB 25
+EXCEPTION_STUB 26
+EXCEPTION_STUB 27
+EXCEPTION_STUB 28
+EXCEPTION_STUB_ERROR 29
+EXCEPTION_STUB_ERROR 30
+EXCEPTION_STUB 31
+
+section .rodata
+global irq_stubs
+global msi_stubs
+global exception_stubs
+
+exception_stubs:
+    dd exception_stub_0, exception_stub_1, exception_stub_2, exception_stub_3
+    dd exception_stub_4, exception_stub_5, exception_stub_6, exception_stub_7
+    dd exception_stub_8, exception_stub_9, exception_stub_10, exception_stub_11
+    dd exception_stub_12, exception_stub_13, exception_stub_14, exception_stub_15
+    dd exception_stub_16, exception_stub_17, exception_stub_18, exception_stub_19
+    dd exception_stub_20, exception_stub_21, exception_stub_22, exception_stub_23
+    dd exception_stub_24, exception_stub_25, exception_stub_26, exception_stub_27
+    dd exception_stub_28, exception_stub_29, exception_stub_30, exception_stub_31
+
+irq_stubs:
+    dd irq_stub_0, irq_stub_1, irq_stub_2, irq_stub_3
+    dd irq_stub_4, irq_stub_5, irq_stub_6, irq_stub_7
+    dd irq_stub_8, irq_stub_9, irq_stub_10, irq_stub_11
+    dd irq_stub_12, irq_stub_13, irq_stub_14, irq_stub_15
+
+msi_stubs:
+    dd msi_stub_0, msi_stub_1, msi_stub_2, msi_stub_3
+    dd msi_stub_4, msi_stub_5, msi_stub_6, msi_stub_7
+    dd msi_stub_8, msi_stub_9, msi_stub_10, msi_stub_11
+    dd msi_stub_12, msi_stub_13, msi_stub_14, msi_stub_15
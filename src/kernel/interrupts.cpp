@@ -0,0 +1,202 @@
+#include "kernel.hpp"
+#include "interrupts.hpp"
+#include "keyboard.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "memtype.hpp"
+#include "paging.hpp"
+#include "serial.hpp"
+#include "syscall.hpp"
+#include "utils.hpp"
+
+
+static irq_handler_t		irq_handlers[IRQ_COUNT][IRQ_HANDLERS];
+static exception_handler_t	exception_handlers[EXCEPTION_COUNT];
+static irq_handler_t		msi_handlers[MSI_COUNT];
+static uint8_t				msi_count = 0;
+static volatile uint32_t*	lapic = NULL;
+
+static const char* const	exception_names[EXCEPTION_COUNT] = {
+	"divide error", "debug", "NMI", "breakpoint", "overflow", "bound range exceeded",
+	"invalid opcode", "device not available", "double fault", "coprocessor segment overrun",
+	"invalid TSS", "segment not present", "stack fault", "general protection fault",
+	"page fault", "reserved", "x87 error", "alignment check", "machine check", "SIMD error",
+	"virtualization exception", "control protection", "reserved", "reserved", "reserved",
+	"reserved", "reserved", "reserved", "hypervisor injection", "VMM communication",
+	"security exception", "reserved",
+};
+
+
+/* PCI devices of different drivers may share a line: each handler on it is
+   called in turn, checking its own devices. Registering the same handler
+   twice is a no-op. Returns false if there is no room left on the line. */
+bool irq_register(const uint8_t irq, const irq_handler_t handler) {
+	if (irq >= IRQ_COUNT) {
+		return false;
+	}
+
+	const uint32_t flags = irq_save();
+	size_t i = 0;
+
+	while (i < IRQ_HANDLERS && irq_handlers[irq][i] && irq_handlers[irq][i] != handler) {
+		++i;
+	}
+	if (i < IRQ_HANDLERS) {
+		irq_handlers[irq][i] = handler;
+	}
+	irq_restore(flags);
+
+	if (i == IRQ_HANDLERS) {
+		klog(KLOG_WARN, "irq: no room for another handler on line %u", irq);
+		return false;
+	}
+	return true;
+}
+
+void irq_unmask(const uint8_t irq) {
+	const uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+
+	outb(port, inb(port) & ~(1 << (irq & 7)));
+	if (irq >= 8) {
+		outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << IRQ_CASCADE));
+	}
+}
+
+void irq_mask(const uint8_t irq) {
+	const uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+
+	outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+/* IRQ7 and IRQ15 may be raised spuriously, in which case the PIC has no
+   interrupt in service and must not receive an EOI */
+static bool irq_spurious(const uint8_t irq) {
+	const uint16_t command = irq < 8 ? PIC1_COMMAND : PIC2_COMMAND;
+
+	outb(command, PIC_READ_ISR);
+	return !(inb(command) & (1 << (irq & 7)));
+}
+
+/* Called by the irq_stub_* entry points in interrupts.asm */
+extern "C" void irq_dispatch(const uint32_t irq) {
+	++cpu_stats.interrupts;
+	if ((irq == 7 || irq == 15) && irq_spurious(irq)) {
+		if (irq == 15) {
+			outb(PIC1_COMMAND, PIC_EOI);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < IRQ_HANDLERS && irq_handlers[irq][i]; ++i) {
+		irq_handlers[irq][i](irq);
+	}
+
+	if (irq >= 8) {
+		outb(PIC2_COMMAND, PIC_EOI);
+	}
+	outb(PIC1_COMMAND, PIC_EOI);
+}
+
+static inline uint32_t lapic_read(const uint32_t reg) {
+	return lapic[reg / 4];
+}
+
+static inline void lapic_write(const uint32_t reg, const uint32_t value) {
+	lapic[reg / 4] = value;
+}
+
+/* Enables the local APIC for the MSI vectors, leaving the PIC lines as they
+   were: LINT0 passes them through as external interrupts. Must run after
+   paging_init(). */
+__init void msi_init(void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_APIC)) {
+		klog(KLOG_WARN, "msi: no local APIC, devices stay on PIC lines");
+		return;
+	}
+
+	const uint64_t base = rdmsr(MSR_APIC_BASE);
+	const uintptr_t start = base & APIC_BASE_FRAME;
+
+	if (!paging_map_device(start, start + PAGE_SIZE)) {
+		return;
+	}
+	paging_set_cache(start, start + PAGE_SIZE, PAGE_CACHE_UC);
+	wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+	lapic = (volatile uint32_t*) start;
+
+	set_idt_entry(LAPIC_SPURIOUS_VECTOR, lapic_spurious_stub, DEFAULT_FLAG);
+	for (uint8_t i = 0; i < MSI_COUNT; ++i) {
+		set_idt_entry(MSI_VECTOR_START + i, msi_stubs[i], DEFAULT_FLAG);
+	}
+
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+	lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_EXTINT);
+	lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+	lapic_write(LAPIC_TPR, 0);
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+	klog(KLOG_INFO, "msi: local APIC %u at 0x%p, %u vectors from 0x%x", lapic_read(LAPIC_ID) >> 24, start,
+		MSI_COUNT, MSI_VECTOR_START);
+}
+
+/* Gives handler a vector of its own, 0 when there's no local APIC or no
+   vector left. The handler gets the vector as its argument. */
+uint8_t msi_register(const irq_handler_t handler) {
+	if (!lapic || msi_count == MSI_COUNT) {
+		return 0;
+	}
+
+	const uint32_t flags = irq_save();
+
+	msi_handlers[msi_count] = handler;
+	irq_restore(flags);
+	return MSI_VECTOR_START + msi_count++;
+}
+
+/* Message address targeting this processor's local APIC */
+uint32_t msi_address(void) {
+	return MSI_ADDRESS | (lapic_read(LAPIC_ID) >> 24) << 12;
+}
+
+/* Called by the msi_stub_* entry points in interrupts.asm. Nothing is
+   shared: no need to ask the device whether it raised the interrupt. */
+extern "C" void msi_dispatch(const uint32_t index) {
+	++cpu_stats.interrupts;
+	if (msi_handlers[index]) {
+		msi_handlers[index](MSI_VECTOR_START + index);
+	}
+	lapic_write(LAPIC_EOI, 0);
+}
+
+void exception_register(const uint8_t vector, const exception_handler_t handler) {
+	exception_handlers[vector] = handler;
+}
+
+/* Called by the exception_stub_* entry points in interrupts.asm. A fault
+   nobody handles kills the user program that caused it, or stops the
+   kernel if it happened in ring 0. */
+extern "C" void exception_dispatch(exception_frame_t* frame) {
+	const uint32_t vector = frame->vector;
+
+	if (exception_handlers[vector] && exception_handlers[vector](frame)) {
+		return;
+	}
+
+	if ((frame->cs & 3) && user_running()) {
+		klog(KLOG_WARN, "user: %s at 0x%p (error 0x%x), killed", exception_names[vector], frame->eip, frame->error);
+		terminal_printf("user: %s at 0x%p (error 0x%x), killed", exception_names[vector], frame->eip, frame->error);
+		user_kill(-(int) vector - 1);
+	}
+
+	klog(KLOG_ERR, "kernel panic: %s at 0x%p (error 0x%x)", exception_names[vector], frame->eip, frame->error);
+	serial_flush();
+	terminal_printf("kernel panic: %s at 0x%p (error 0x%x)", exception_names[vector], frame->eip, frame->error);
+	terminal_printf("eax %p  ebx %p  ecx %p  edx %p", frame->eax, frame->ebx, frame->ecx, frame->edx);
+	terminal_printf("esi %p  edi %p  ebp %p  eflags %p", frame->esi, frame->edi, frame->ebp, frame->eflags);
+	for (;;) {
+		__asm__ volatile ("cli\n\thlt");
+	}
+}
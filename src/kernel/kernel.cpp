@@ -2,25 +2,31 @@
 
 #include "kernel.hpp"
 #include "keyboard.hpp"
+#include "fpu.hpp"
+#include "ata.hpp"
+#include "bcache.hpp"
+#include "block.hpp"
+#include "console.hpp"
+#include "initrd.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "memtype.hpp"
+#include "multiboot.hpp"
+#include "paging.hpp"
+#include "pci.hpp"
+#include "serial.hpp"
+#include "simd.hpp"
+#include "syscall.hpp"
+#include "timer.hpp"
 #include "utils.hpp"
+#include "virtio.hpp"
 
 
-size_t		terminal_row[MAX_TTY];
-size_t		terminal_column[MAX_TTY];
-size_t		terminal_written_column[MAX_TTY];
-uint8_t		terminal_color[MAX_TTY];
+cpu_stats_t	cpu_stats;
 uint16_t*	terminal_buffer;
-uint16_t	tty[MAX_TTY][VGA_WIDTH * VGA_HEIGHT];
-uint8_t		curr_tty;
-
-
-inline uint8_t vga_entry_color(const enum vga_color fg, const enum vga_color bg) {
-	return fg | bg << 4;
-}
-
-inline uint16_t vga_entry(const unsigned char uc, const uint8_t color) {
-	return (uint16_t) uc | (uint16_t) color << 8;
-}
+tty_t		ttys[MAX_TTY];
+tty_t*		curr_tty;
 
 size_t kstrlen(const char* str) {
 	size_t len = 0;
@@ -39,27 +45,21 @@ void display_42(void) {
 	terminal_putentryat(EMPTY, DEFAULT_COLOR, VGA_WIDTH - 1, 1);
 }
 
-void terminal_initialize(void) {
+__init void terminal_initialize(void) {
+	curr_tty = &ttys[0];
+	terminal_buffer = console_init();
+
 	for (int i = 0; i < MAX_TTY; ++i) {
-		terminal_row[i] = 0;
-		terminal_column[i] = 0;
-		terminal_written_column[i] = 0;
-		terminal_color[i] = DEFAULT_COLOR;
+		ttys[i].row = 0;
+		ttys[i].column = 0;
+		ttys[i].written_column = 0;
+		ttys[i].color = DEFAULT_COLOR;
 	}
 
-	curr_tty = 0;
-	terminal_buffer = (uint16_t*) 0xB8000; // Reserved address of VGA to store text to display
-
-	for (size_t y = 0; y < VGA_HEIGHT; y++) {
-		for (size_t x = 0; x < VGA_WIDTH; x++) {
-			const size_t index = y * VGA_WIDTH + x;
-
-			terminal_buffer[index] = vga_entry(EMPTY, terminal_color[curr_tty]);
-
-			for (int i = 0; i < MAX_TTY; ++i) {
-				tty[i][index] = vga_entry(EMPTY, terminal_color[curr_tty]);
-			}
-		}
+	fill16(terminal_buffer, vga_entry(EMPTY, curr_tty->color), tty_t::cells);
+	console_dirty(0, tty_t::height);
+	for (int i = 0; i < MAX_TTY; ++i) {
+		fill16(ttys[i].screen, vga_entry(EMPTY, curr_tty->color), tty_t::cells);
 	}
 
 	init_history();
@@ -70,33 +70,25 @@ void terminal_initialize(void) {
 	}
 }
 
-static inline void terminal_setcolor(const uint8_t color) {
-	terminal_color[curr_tty] = color;
-}
-
-void terminal_putentryat(const char c, const uint8_t color, const size_t x, const size_t y) {
-	const size_t index = y * VGA_WIDTH + x;
-
-	terminal_buffer[index] = vga_entry(c, color);
-}
-
-void terminal_putchar(const char c) {
-	terminal_putentryat(c, terminal_color[curr_tty], terminal_column[curr_tty], terminal_row[curr_tty]);
+__hot void terminal_putchar(const char c) {
+	terminal_putentryat(c, curr_tty->color, curr_tty->column, curr_tty->row);
 	move_cursor_right();
 }
 
-void terminal_insert_char(const char c) {
-	if (terminal_written_column[curr_tty] < VGA_WIDTH - 1) {
-		if (terminal_column[curr_tty] < terminal_written_column[curr_tty]) {
-			size_t written_index = terminal_row[curr_tty] * VGA_WIDTH + terminal_written_column[curr_tty];
-			size_t x = terminal_written_column[curr_tty];
+__hot void terminal_insert_char(const char c) {
+	tty_t * const	t = curr_tty;
+
+	if (t->written_column < tty_t::width - 1) {
+		if (t->column < t->written_column) {
+			size_t written_index = t->index(t->written_column, t->row);
+			size_t x = t->written_column;
 
-			for (; x > terminal_column[curr_tty]; --x, --written_index) {
-				terminal_putentryat(terminal_buffer[written_index - 1], terminal_color[curr_tty], x, terminal_row[curr_tty]);
+			for (; x > t->column; --x, --written_index) {
+				terminal_putentryat(terminal_buffer[written_index - 1], t->color, x, t->row);
 			}
 		}
-		terminal_putentryat(c, terminal_color[curr_tty], terminal_column[curr_tty], terminal_row[curr_tty]);
-		++terminal_written_column[curr_tty];
+		terminal_putentryat(c, t->color, t->column, t->row);
+		++t->written_column;
 		move_cursor_right();
 	}
 }
@@ -111,22 +103,95 @@ void terminal_writestring(const char* data) {
 	terminal_write(data, kstrlen(data));
 }
 
-extern "C" int kmain(void) {
+/* Moves the screen up by lines, the bottom ones staying in place. In text
+   mode the screen is a window the CRTC start address moves down the 32 KB
+   aperture: only the bottom lines are written, and the screen goes back to
+   the start of the aperture once it reaches the end. */
+void terminal_scroll(const size_t lines) {
+	const size_t kept = (tty_t::height - lines) * tty_t::width;
+
+#ifdef CONSOLE_FB
+	memmove(terminal_buffer, terminal_buffer + lines * tty_t::width, kept * sizeof(uint16_t));
+	cpu_stats.cells += kept;
+	console_dirty(0, tty_t::height - lines);
+#else
+	uint16_t* const aperture = (uint16_t*) CONSOLE_TEXT_BUFFER;
+	uint16_t* const old = terminal_buffer;
+	const uint32_t flags = irq_save();
+	size_t top = old - aperture + lines * tty_t::width;
+
+	if (top + tty_t::cells > CONSOLE_TEXT_APERTURE / sizeof(uint16_t)) {
+		memmove(aperture, old + lines * tty_t::width, kept * sizeof(uint16_t));
+		cpu_stats.cells += kept;
+		top = 0;
+	}
+	terminal_buffer = aperture + top;
+	memcpy(terminal_buffer + kept, old + kept, lines * tty_t::width * sizeof(uint16_t));
+	cpu_stats.cells += lines * tty_t::width;
+
+	// The cells must be in memory before the CRTC shows them
+	wc_barrier();
+	crtc_start(top);
+	update_cursor(curr_tty->column, curr_tty->row);
+	irq_restore(flags);
+#endif
+}
+
+#ifndef KFS_HOST
+extern "C" int kmain(const uint32_t multiboot_magic, const multiboot_info_t* multiboot_info) {
 	// Deactivate interruptions while kernel starts
 	__asm__ volatile ("cli");
 
+	// Boot modules and memory map must be copied before memory is handed to the page allocator
+	if (multiboot_init(multiboot_magic, multiboot_info)) {
+		const boot_module_t* initrd = boot_module_find(INITRD_MODULE);
+
+		if (initrd) {
+			initrd_init(initrd->start, initrd->end);
+			ramdisk_create("ram0", initrd->start, initrd->end, true);
+		}
+	}
+	init_memory();
+	bcache_init();
+
 	// https://wiki.osdev.org/Global_Descriptor_Table
 	// https://wiki.osdev.org/GDT_Tutorial
 	init_gdt();
 
 	initialize_idt();
 	load_idt();
+	syscall_init();
+	paging_init();
+	memtype_init();
+	msi_init();
+	fpu_init();
+	simd_init();
 	PIC_remap();
+	tsc_calibrate();
+	timer_init();
+	serial_init();
 
+	pci_init();
+	ata_init();
+	virtio_init();
 	terminal_initialize();
+	free_init_memory();
 
 	// Restore interruptions
 	__asm__ volatile ("sti");
 
-	for (;;);
-}
\ No newline at end of file
+	// Commands entered at the prompt run here rather than in the keyboard interrupt
+	for (;;) {
+		console_flush();
+		__asm__ volatile ("cli");
+		if (!has_pending_command()) {
+			irq_wait();
+		}
+		__asm__ volatile ("sti");
+		run_pending_command();
+		bcache_flush_background();
+		serial_poll();
+		virtio_console_poll();
+	}
+}
+#endif
@@ -2,70 +2,99 @@
 
 #include "kernel.hpp"
 #include "keyboard.hpp"
+#include "ata.hpp"
+#include "bcache.hpp"
+#include "console.hpp"
+#include "hexdump.hpp"
+#include "initrd.hpp"
+#include "interrupts.hpp"
+#include "keymap.hpp"
+#include "keyrec.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "memtype.hpp"
+#include "paging.hpp"
+#include "pci.hpp"
+#include "simd.hpp"
+#include "syscall.hpp"
+#include "timer.hpp"
 #include "utils.hpp"
+#include "virtio.hpp"
 
 
-static const enum vga_color default_colors[MAX_TTY][2] = TERMINAL_PROMPT_COLORS;
-static uint8_t	prompts_colors[MAX_TTY];
-static char		qwerty_keyboard_table[128][2] = QWERTY_KEYBOARD_TABLE;
-static size_t	history_total_index[MAX_TTY];
-static int		history_current_index[MAX_TTY];
-static uint16_t	history[MAX_TTY][MAX_HISTORY][VGA_WIDTH];
+static const enum vga_color default_colors[MAX_TTY][2] __initdata = TERMINAL_PROMPT_COLORS;
 static bool		lshift = false;
 static bool		rshift = false;
-static bool		shift = false;
+static bool		altgr = false;
 static bool		maj = false;
 static bool		rdy_to_disable_maj = false;
-
-
-void init_colors(void) {
+/* Modifier state indexing the keymap, KEYMAP_SHIFT | KEYMAP_CAPS | KEYMAP_ALTGR */
+static uint8_t	modifiers = 0;
+/* KEYMAP_EXTENDED after the 0xE0 prefix, until the next byte */
+static uint16_t	extended = 0;
+/* Set by Enter until the command has run in run_pending_command(). Scan
+   codes received meanwhile are queued and replayed afterwards. */
+static volatile bool	pending_command = false;
+static uint8_t	scancode_queue[KEYBOARD_QUEUE_SIZE];
+static uint8_t	scancode_queue_head = 0;
+static uint8_t	scancode_queue_tail = 0;
+
+
+__init void init_colors(void) {
 	for (int i = 0; i < MAX_TTY; ++i) {
-		prompts_colors[i] = vga_entry_color(default_colors[i][0], default_colors[i][1]);
+		ttys[i].prompt_color = vga_entry_color(default_colors[i][0], default_colors[i][1]);
 	}
 }
 
-void init_history(void) {
-	kmemset(history_current_index, 0, sizeof(uint8_t) * MAX_TTY);
-	kmemset(history_total_index, 0, sizeof(uint8_t) * MAX_TTY);
-	kmemset(history, 0, sizeof(uint16_t) * (MAX_TTY * MAX_HISTORY * VGA_WIDTH));
+__init void init_history(void) {
+	for (int i = 0; i < MAX_TTY; ++i) {
+		ttys[i].history_current_index = -1;
+		ttys[i].history_total_index = 0;
+		kmemset(ttys[i].history, 0, sizeof(ttys[i].history));
+	}
 }
 
 static inline void delete_last_char(void) {
-	if (terminal_column[curr_tty] == TERMINAL_PROMPT_LEN) {
+	tty_t * const	t = curr_tty;
+
+	if (t->column == TERMINAL_PROMPT_LEN) {
 		return;
 	}
 
-	size_t index = terminal_row[curr_tty] * VGA_WIDTH + terminal_column[curr_tty];
-	size_t x = terminal_column[curr_tty];
+	size_t index = t->cursor_index();
+	size_t x = t->column;
 
-	for (; x < VGA_WIDTH; ++x, ++index) {
-		terminal_putentryat(terminal_buffer[index], terminal_color[curr_tty], x - 1, terminal_row[curr_tty]);
+	for (; x < tty_t::width; ++x, ++index) {
+		terminal_putentryat(terminal_buffer[index], t->color, x - 1, t->row);
 	}
-	terminal_putentryat(EMPTY, terminal_color[curr_tty], x - 1, terminal_row[curr_tty]);
-	--terminal_written_column[curr_tty];
+	terminal_putentryat(EMPTY, t->color, x - 1, t->row);
+	--t->written_column;
 	move_cursor_left();
 }
 
 static inline void delete_next_char(void) {
-	if (terminal_column[curr_tty] >= terminal_written_column[curr_tty]) {
+	tty_t * const	t = curr_tty;
+
+	if (t->column >= t->written_column) {
 		return;
 	}
 
-	size_t index = terminal_row[curr_tty] * VGA_WIDTH + terminal_column[curr_tty];
-	size_t x = terminal_column[curr_tty];
+	size_t index = t->cursor_index();
+	size_t x = t->column;
 
-	for (; x < VGA_WIDTH - 1; ++x, ++index) {
-		terminal_putentryat(terminal_buffer[index + 1], terminal_color[curr_tty], x, terminal_row[curr_tty]);
+	for (; x < tty_t::width - 1; ++x, ++index) {
+		terminal_putentryat(terminal_buffer[index + 1], t->color, x, t->row);
 	}
-	terminal_putentryat(EMPTY, terminal_color[curr_tty], x, terminal_row[curr_tty]);
-	--terminal_written_column[curr_tty];
+	terminal_putentryat(EMPTY, t->color, x, t->row);
+	--t->written_column;
 }
 
 void save_to_history(void) {
-	long input_end = terminal_written_column[curr_tty];
+	tty_t * const	t = curr_tty;
+	long			input_end = t->written_column;
 
 	for (; input_end >= TERMINAL_PROMPT_LEN; --input_end) {
-		if ((terminal_buffer[VGA_WIDTH * (VGA_HEIGHT - 1) + input_end] & 0x00FF) != EMPTY) {
+		if ((terminal_buffer[tty_t::prompt_index(input_end)] & 0x00FF) != EMPTY) {
 			break ;
 		}
 	}
@@ -74,130 +103,150 @@ void save_to_history(void) {
 		return ;
 	}
 
-	if (input_end < VGA_WIDTH - 1) {
-		history[curr_tty][history_total_index[curr_tty] % MAX_HISTORY][input_end + 1] = 0;
+	if (input_end < tty_t::width - 1) {
+		t->history[t->history_total_index % MAX_HISTORY][input_end + 1] = 0;
 	}
 
 	for (; input_end >= 0; --input_end) {
-		history[curr_tty][history_total_index[curr_tty] % MAX_HISTORY][input_end] =
-			terminal_buffer[VGA_WIDTH * (VGA_HEIGHT - 1) + input_end];
+		t->history[t->history_total_index % MAX_HISTORY][input_end] =
+			terminal_buffer[tty_t::prompt_index(input_end)];
 	}
 
-	++history_total_index[curr_tty];
+	++t->history_total_index;
 }
 
 void terminal_prompt(void) {
-	const uint16_t og_color = terminal_color[curr_tty];
+	tty_t * const	t = curr_tty;
+	const uint8_t	og_color = t->color;
 
-	terminal_color[curr_tty] = prompts_colors[curr_tty];
-	terminal_column[curr_tty] = 0;
-	terminal_row[curr_tty] = VGA_HEIGHT - 1;
+	t->color = t->prompt_color;
+	t->column = 0;
+	t->row = tty_t::prompt_row;
 
 	terminal_writestring(TERMINAL_PROMPT);
-	terminal_written_column[curr_tty] = terminal_column[curr_tty];
-	terminal_color[curr_tty] = og_color;
+	t->written_column = t->column;
+	t->color = og_color;
 
-	for (int i = 0; i < VGA_WIDTH - TERMINAL_PROMPT_LEN; ++i) {
-		terminal_putentryat(EMPTY, terminal_color[curr_tty], terminal_column[curr_tty] + i, terminal_row[curr_tty]);
+	for (int i = 0; i < tty_t::width - TERMINAL_PROMPT_LEN; ++i) {
+		terminal_putentryat(EMPTY, t->color, t->column + i, t->row);
 	}
 
 	display_42();
 }
 
 static inline void handle_down_press(void) {
-	if (!history_total_index[curr_tty] || history_current_index[curr_tty] == -1) {
+	tty_t * const	t = curr_tty;
+
+	if (!t->history_total_index || t->history_current_index == -1) {
 		return;
-	} else if (history_current_index[curr_tty] == (history_total_index[curr_tty] - 1) % MAX_HISTORY) {
-		history_current_index[curr_tty] = -1;
+	} else if (t->history_current_index == (t->history_total_index - 1) % MAX_HISTORY) {
+		t->history_current_index = -1;
 		terminal_prompt();
 		return;
 	}
 
-	if (history_total_index[curr_tty] <= MAX_HISTORY && history_current_index[curr_tty] < history_total_index[curr_tty]) {
-		++history_current_index[curr_tty];
-	} else if (history_total_index[curr_tty] > MAX_HISTORY) {
-		if (history_current_index[curr_tty] == MAX_HISTORY - 1) {
-			history_current_index[curr_tty] = 0;
+	if (t->history_total_index <= MAX_HISTORY && t->history_current_index < t->history_total_index) {
+		++t->history_current_index;
+	} else if (t->history_total_index > MAX_HISTORY) {
+		if (t->history_current_index == MAX_HISTORY - 1) {
+			t->history_current_index = 0;
 		} else {
-			++history_current_index[curr_tty];
+			++t->history_current_index;
 		}
 	}
 
-	uint16_t c = history[curr_tty][history_current_index[curr_tty]][TERMINAL_PROMPT_LEN];
-	terminal_column[curr_tty] = TERMINAL_PROMPT_LEN;
-	while ((terminal_column[curr_tty] < VGA_WIDTH) && (c & 0x00FF)) {
-		terminal_buffer[VGA_WIDTH * (VGA_HEIGHT - 1) + terminal_column[curr_tty]] = c;
+	uint16_t c = t->history[t->history_current_index][TERMINAL_PROMPT_LEN];
+	t->column = TERMINAL_PROMPT_LEN;
+	while ((t->column < tty_t::width) && (c & 0x00FF)) {
+		terminal_buffer[tty_t::prompt_index(t->column)] = c;
 
-		++terminal_column[curr_tty];
-		c = history[curr_tty][history_current_index[curr_tty]][terminal_column[curr_tty]];
+		++t->column;
+		c = t->history[t->history_current_index][t->column];
 	}
 
-	for (int i = terminal_column[curr_tty]; i < VGA_WIDTH; ++i) {
-		terminal_buffer[VGA_WIDTH * (VGA_HEIGHT - 1) + i] = vga_entry(EMPTY, DEFAULT_COLOR);
-	}
+	fill16(&terminal_buffer[tty_t::prompt_index(t->column)], vga_entry(EMPTY, DEFAULT_COLOR), tty_t::width - t->column);
+	cpu_stats.cells += tty_t::width - TERMINAL_PROMPT_LEN;
+	console_dirty(tty_t::prompt_row, 1);
 
-	terminal_written_column[curr_tty] = terminal_column[curr_tty];
-	update_cursor(terminal_column[curr_tty], terminal_row[curr_tty]);
+	t->written_column = t->column;
+	update_cursor(t->column, t->row);
 }
 
 static inline void handle_up_press(void) {
-	if (!history_total_index[curr_tty]) {
+	tty_t * const	t = curr_tty;
+
+	if (!t->history_total_index) {
 		return;
 	}
 
-	if (history_current_index[curr_tty] == -1) {
-		history_current_index[curr_tty] = (history_total_index[curr_tty] - 1) % MAX_HISTORY;
+	if (t->history_current_index == -1) {
+		t->history_current_index = (t->history_total_index - 1) % MAX_HISTORY;
 	} else {
-		if (history_total_index[curr_tty] <= MAX_HISTORY && history_current_index[curr_tty]) {
-			--history_current_index[curr_tty];
-		} else if (history_total_index[curr_tty] > MAX_HISTORY
-				&& (history_total_index[curr_tty] % MAX_HISTORY) != history_current_index[curr_tty]) {
-			if (!history_current_index[curr_tty]) {
-				history_current_index[curr_tty] = MAX_HISTORY - 1;
+		if (t->history_total_index <= MAX_HISTORY && t->history_current_index) {
+			--t->history_current_index;
+		} else if (t->history_total_index > MAX_HISTORY
+				&& (t->history_total_index % MAX_HISTORY) != t->history_current_index) {
+			if (!t->history_current_index) {
+				t->history_current_index = MAX_HISTORY - 1;
 			} else {
-				--history_current_index[curr_tty];
+				--t->history_current_index;
 			}
 		}
 	}
 
-	uint16_t c = history[curr_tty][history_current_index[curr_tty]][TERMINAL_PROMPT_LEN];
+	uint16_t c = t->history[t->history_current_index][TERMINAL_PROMPT_LEN];
 
-	terminal_column[curr_tty] = TERMINAL_PROMPT_LEN;
-	while ((terminal_column[curr_tty] < VGA_WIDTH) && (c & 0x00FF)) {
-		terminal_buffer[VGA_WIDTH * (VGA_HEIGHT - 1) + terminal_column[curr_tty]] = c;
+	t->column = TERMINAL_PROMPT_LEN;
+	while ((t->column < tty_t::width) && (c & 0x00FF)) {
+		terminal_buffer[tty_t::prompt_index(t->column)] = c;
 
-		++terminal_column[curr_tty];
-		c = history[curr_tty][history_current_index[curr_tty]][terminal_column[curr_tty]];
+		++t->column;
+		c = t->history[t->history_current_index][t->column];
 	}
 
-	for (int i = terminal_column[curr_tty]; i < VGA_WIDTH; ++i) {
-		terminal_buffer[VGA_WIDTH * (VGA_HEIGHT - 1) + i] = vga_entry(' ', DEFAULT_COLOR);
-	}
+	fill16(&terminal_buffer[tty_t::prompt_index(t->column)], vga_entry(' ', DEFAULT_COLOR), tty_t::width - t->column);
+	cpu_stats.cells += tty_t::width - TERMINAL_PROMPT_LEN;
+	console_dirty(tty_t::prompt_row, 1);
 
-	terminal_written_column[curr_tty] = terminal_column[curr_tty];
-	update_cursor(terminal_column[curr_tty], terminal_row[curr_tty]);
+	t->written_column = t->column;
+	update_cursor(t->column, t->row);
 }
 
-inline void swap_tty(const uint8_t new_tty) {
-	for (size_t y = 0; y < VGA_HEIGHT; y++) {
-		for (size_t x = 0; x < VGA_WIDTH; x++) {
-			const size_t index = y * VGA_WIDTH + x;
+void swap_tty(const uint8_t new_tty) {
+	kmemcpy(curr_tty->screen, terminal_buffer, sizeof(curr_tty->screen));
+	curr_tty = &ttys[new_tty];
+	kmemcpy(terminal_buffer, curr_tty->screen, sizeof(curr_tty->screen));
+	cpu_stats.cells += tty_t::cells;
+	console_dirty(0, tty_t::height);
 
-			tty[curr_tty][index] = terminal_buffer[index];
-			terminal_buffer[index] = tty[new_tty][index];
-		}
-	}
-
-	curr_tty = new_tty;
-	update_cursor(terminal_column[curr_tty], terminal_row[curr_tty]);
+	update_cursor(curr_tty->column, curr_tty->row);
 }
 
 static inline void display_full_history(const int gap) {
-	for (int i = 0; i < VGA_HEIGHT - gap; ++i) {
-		for (int j = 0; j < VGA_WIDTH; ++j) {
-			terminal_buffer[i * VGA_WIDTH + j] = terminal_buffer[(i + gap) * VGA_WIDTH + j];
-		}
+	terminal_scroll(gap);
+}
+
+/* Writes one line of command output right above the prompt line, scrolling
+   the rest of the screen up by one line. */
+void terminal_print_line(const char* str) {
+	display_full_history(1);
+
+	for (size_t x = 0; x < tty_t::width; ++x) {
+		terminal_putentryat(*str ? *str++ : EMPTY, DEFAULT_COLOR, x, tty_t::prompt_row - 1);
 	}
+	// A command busy for several ticks gets its output drawn as it goes
+	console_poll();
+}
+
+void terminal_printf(const char* format, ...) {
+	va_list	va_params;
+	char	line[tty_t::width + 1];
+
+	va_start(va_params, format);
+	kvsnprintf(line, sizeof(line), format, va_params);
+	va_end(va_params);
+
+	terminal_print_line(line);
 }
 
 #define COLOR_COMMAND		"color "
@@ -208,33 +257,78 @@ static inline void display_full_history(const int gap) {
 #define GDT_COMMAND_LEN		4
 #define GDTR_COMMAND		"gdtr "
 #define GDTR_COMMAND_LEN	5
+#define SECTIONS_COMMAND		"sections "
+#define SECTIONS_COMMAND_LEN	9
+#define LS_COMMAND			"ls "
+#define LS_COMMAND_LEN		3
+#define CAT_COMMAND			"cat "
+#define CAT_COMMAND_LEN		4
+#define DISK_COMMAND		"disk "
+#define DISK_COMMAND_LEN	5
+#define BCACHE_COMMAND		"bcache "
+#define BCACHE_COMMAND_LEN	7
+#define EXEC_COMMAND		"exec "
+#define EXEC_COMMAND_LEN	5
+#define SYSCALLBENCH_COMMAND		"syscallbench "
+#define SYSCALLBENCH_COMMAND_LEN	13
+#define PAGING_COMMAND		"paging "
+#define PAGING_COMMAND_LEN	7
+#define WCBENCH_COMMAND		"wcbench "
+#define WCBENCH_COMMAND_LEN	8
+#define SIMDBENCH_COMMAND		"simdbench "
+#define SIMDBENCH_COMMAND_LEN	10
+#define LAYOUT_COMMAND		"layout "
+#define LAYOUT_COMMAND_LEN	7
+#define DMESG_COMMAND		"dmesg "
+#define DMESG_COMMAND_LEN	6
+#define KLOGBENCH_COMMAND	"klogbench "
+#define KLOGBENCH_COMMAND_LEN	10
+#define LSPCI_COMMAND		"lspci "
+#define LSPCI_COMMAND_LEN	6
+#define VIRTIO_COMMAND		"virtio "
+#define VIRTIO_COMMAND_LEN	7
+#define HEXDUMP_COMMAND		"hexdump "
+#define HEXDUMP_COMMAND_LEN	8
+#define EXAMINE_COMMAND		"x/"
+#define EXAMINE_COMMAND_LEN	2
+#define CONTINUE_COMMAND	"x "
+#define CONTINUE_COMMAND_LEN	2
+#define TIME_COMMAND		"time "
+#define TIME_COMMAND_LEN	5
+#define KEYREC_COMMAND		"keyrec "
+#define KEYREC_COMMAND_LEN	7
+#define REPLAY_COMMAND		"replay "
+#define REPLAY_COMMAND_LEN	7
+#define CONSOLE_COMMAND		"console "
+#define CONSOLE_COMMAND_LEN	8
 
 static void write_color_msg(const char * color_str, const uint16_t color) {
-	terminal_column[curr_tty] = 0;
-	terminal_row[curr_tty] = VGA_HEIGHT - 2;
+	curr_tty->column = 0;
+	curr_tty->row = VGA_HEIGHT - 2;
 
 	terminal_writestring(COLOR_MSG);
-	terminal_color[curr_tty] = color;
+	curr_tty->color = color;
 	terminal_writestring(color_str);
 
-	while (terminal_column[curr_tty] < VGA_WIDTH - 1) {
+	while (curr_tty->column < VGA_WIDTH - 1) {
 		terminal_putchar(' ');
 	}
 }
 
 static void change_color(uint16_t* arg_ptr) {
-	const char color_palet[16][14] = COLOR_PALET;
+	static constexpr char color_palet[16][14] = COLOR_PALET;
+	const uint16_t* const line_end = &terminal_buffer[tty_t::cells];
 
-	while (((*arg_ptr) & 0x00FF) == EMPTY && (uint32_t) arg_ptr < TERMINAL_LIMIT) {
+	while (((*arg_ptr) & 0x00FF) == EMPTY && arg_ptr < line_end) {
 		++arg_ptr;
 	}
 
-	if ((uint32_t) arg_ptr < TERMINAL_LIMIT) {
+	if (arg_ptr < line_end) {
 		for (int color_index = 0; color_index < 16; ++color_index) {
 			const char *	color_str = color_palet[color_index];
 			const size_t	color_len = kstrlen(color_str);
 
-			if (((uint32_t) (arg_ptr + color_len) <= TERMINAL_LIMIT) && (kstrncmp(arg_ptr, color_str, color_len) == 0)
+			if ((arg_ptr + color_len <= line_end) && (kstrncmp(arg_ptr, color_str, color_len) == 0)
 					&& (*(arg_ptr + color_len) & 0x00FF) == EMPTY) {
 				const uint16_t color = vga_entry_color(static_cast<vga_color>(color_index), VGA_COLOR_BLACK);
 
@@ -246,129 +340,275 @@ static void change_color(uint16_t* arg_ptr) {
 	}
 
 	display_full_history(2);
-	terminal_column[curr_tty] = 0;
-	terminal_row[curr_tty] = VGA_HEIGHT - 2;
+	curr_tty->column = 0;
+	curr_tty->row = VGA_HEIGHT - 2;
 	terminal_writestring("Invalid color");
-	while (terminal_column[curr_tty] < VGA_WIDTH - 1) {
+	while (curr_tty->column < VGA_WIDTH - 1) {
 		terminal_putchar(' ');
 	}
 }
 
-static void print_gdt(void) {
-	uint8_t * gdt_ptr = (uint8_t *) &gdt;
-	const char hexa_base[] = "0123456789abcdef";
-	const uint8_t prev_color = terminal_color[curr_tty];
-
-	terminal_color[curr_tty] = DEFAULT_COLOR;
-	display_full_history(1 + (sizeof(GDT_t) * GDT_ENTRIES / 16) + 1);
-	terminal_column[curr_tty] = 12;
-	terminal_row[curr_tty] = VGA_HEIGHT - 1 - (sizeof(GDT_t) * GDT_ENTRIES / 16) - 1;
-
-	for (int i = 0; i < (sizeof(GDT_t) * GDT_ENTRIES / 16) + 1; ++i) {
-		terminal_column[curr_tty] = 0;
+/* Copies the next space separated word of the prompt line into buf */
+static const uint16_t* command_argument(const uint16_t* arg_ptr, char* buf, const size_t size) {
+	const uint16_t* const line_end = &terminal_buffer[tty_t::cells];
+	size_t len = 0;
 
-		terminal_writestring("0x00");
-		terminal_putnbr_base(
-			((uint32_t) gdt) + (i * 16), hexa_base, 16,
-			((VGA_HEIGHT - 1 - (sizeof(GDT_t) * GDT_ENTRIES / 16) - 1) + i) * VGA_WIDTH + 4);
-
-		terminal_column[curr_tty] += 6;
-		terminal_writestring("  ");
-		++terminal_row[curr_tty];
+	while (arg_ptr < line_end && (*arg_ptr & 0x00FF) == EMPTY) {
+		++arg_ptr;
 	}
+	while (arg_ptr < line_end && (*arg_ptr & 0x00FF) != EMPTY && len < size - 1) {
+		buf[len++] = *arg_ptr++ & 0x00FF;
+	}
+	buf[len] = '\0';
+	return arg_ptr;
+}
 
-	terminal_column[curr_tty] = 12;
-	terminal_row[curr_tty] = VGA_HEIGHT - 1 - (sizeof(GDT_t) * GDT_ENTRIES / 16) - 1;
-
-	for (int i = 0; i < sizeof(GDT_t) * (GDT_ENTRIES + 1); ++i) {
-		if ((*(gdt_ptr + i)) < 10) {
-			terminal_putchar('0');
-		}
-		terminal_column[curr_tty] = terminal_putnbr_base(
-			(*(gdt_ptr + i)), hexa_base, 16, terminal_row[curr_tty] * VGA_WIDTH + terminal_column[curr_tty]) % VGA_WIDTH;
+/* bcache [stats|sync|scan <dev>|rewrite <dev>] */
+static void bcache_command(const char* action, const char* name) {
+	const size_t len = kstrlen(action);
 
-		if ((*(gdt_ptr + i)) % 16 == 1) {
-			terminal_putchar('0');
-		}
-		if (i && (i + 1) % 8 == 0) {
-			terminal_putchar(' ');
-		}
-		terminal_putchar(' ');
+	if (len == 4 && memcmp(action, "sync", 4) == 0) {
+		bcache_sync();
+		bcache_print_stats();
+		return;
+	} else if ((len == 4 && memcmp(action, "scan", 4) == 0) || (len == 7 && memcmp(action, "rewrite", 7) == 0)) {
+		block_device_t* dev = block_find(name);
 
-		if ((i + 1) % 16 == 0) {
-			++terminal_row[curr_tty];
-			terminal_column[curr_tty] = 12;
+		if (!dev) {
+			terminal_printf("bcache: %s: no such device", name);
+		} else if (len == 4) {
+			bcache_scan(dev);
+		} else {
+			bcache_rewrite(dev);
 		}
+		return;
 	}
-
-	terminal_color[curr_tty] = prev_color;
+	bcache_print_stats();
 }
 
-static void print_gdtr(void) {
-	uint8_t * gdtr_ptr = (uint8_t *) 0x00000800;
-	const char hexa_base[] = "0123456789abcdef";
-	const uint8_t prev_color = terminal_color[curr_tty];
+static int run_command_at(size_t index);
 
-	terminal_color[curr_tty] = DEFAULT_COLOR;
-	display_full_history(2);
-	terminal_column[curr_tty] = 0;
-	terminal_row[curr_tty] = VGA_HEIGHT - 2;
-	terminal_writestring("0x00000800  ");
-
-	for (int i = 0; i < 16; ++i) {
-		terminal_column[curr_tty] = terminal_putnbr_base(
-			(*(gdtr_ptr + i)), hexa_base, 16, terminal_row[curr_tty] * VGA_WIDTH + terminal_column[curr_tty]) % VGA_WIDTH;
-		if ((*(gdtr_ptr + i)) % 16 == 1 || (*(gdtr_ptr + i)) == 0) {
-			terminal_putchar('0');
-		}
-		if (i && (i + 1) % 8 == 0) {
-			terminal_putchar(' ');
-		}
-		terminal_putchar(' ');
+/* First non blank column of the prompt line from index, VGA_WIDTH if none */
+static size_t skip_blanks(size_t index) {
+	while (index < VGA_WIDTH && (terminal_buffer[tty_t::prompt_index(index)] & 0x00FF) == EMPTY) {
+		++index;
 	}
-
-	terminal_color[curr_tty] = prev_color;
+	return index;
 }
 
-static int check_command(void) {
-	size_t index = TERMINAL_PROMPT_LEN;
+/* time <command>: what the command cost, its output not included */
+static int time_command(const size_t index) {
+	if (index == VGA_WIDTH) {
+		display_full_history(1);
+		terminal_printf("usage: time <command>");
+		return 1;
+	}
 
-	while ((terminal_buffer[VGA_WIDTH * (VGA_HEIGHT - 1) + index] & 0x00FF) == EMPTY && index < VGA_WIDTH) {
-		++index;
+	const cpu_stats_t before = cpu_stats;
+	const uint64_t start = rdtsc();
+	const int found = run_command_at(index);
+	const uint64_t cycles = rdtsc() - start;
+	const cpu_stats_t after = cpu_stats;
+
+	if (!found) {
+		display_full_history(1);
+		terminal_printf("time: no such command");
+		return 1;
 	}
+	if (cycles >> 32) {
+		terminal_printf("time: %u us, %u Mcycles", (uint32_t) tsc_to_us(cycles), (uint32_t) (cycles / 1000000));
+	} else {
+		terminal_printf("time: %u us, %u cycles", (uint32_t) tsc_to_us(cycles), (uint32_t) cycles);
+	}
+	terminal_printf("%u cells written, %u port I/O (%u cursor updates), %u interrupts", after.cells - before.cells,
+		after.port_io - before.port_io, after.cursor_updates - before.cursor_updates,
+		after.interrupts - before.interrupts);
+	return 1;
+}
+
+static int check_command(void) {
+	const size_t index = skip_blanks(TERMINAL_PROMPT_LEN);
 
 	if (index == VGA_WIDTH) {
 		return 0;
 	}
+	return run_command_at(index);
+}
 
-	uint16_t * curr_buff = &terminal_buffer[VGA_WIDTH * (VGA_HEIGHT - 1) + index];
+/* Runs the command starting at column index of the prompt line, 0 if there's none */
+static int run_command_at(size_t index) {
+	char arg[VGA_WIDTH];
+	uint16_t * curr_buff = &terminal_buffer[tty_t::prompt_index(index)];
 
-	if (index + COLOR_COMMAND_LEN < VGA_WIDTH + 1 && kstrncmp(curr_buff, COLOR_COMMAND, COLOR_COMMAND_LEN) == 0) {
+	if (index + TIME_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, TIME_COMMAND, TIME_COMMAND_LEN) == 0) {
+		return time_command(skip_blanks(index + TIME_COMMAND_LEN));
+	} else if (index + COLOR_COMMAND_LEN < VGA_WIDTH + 1 && kstrncmp(curr_buff, COLOR_COMMAND, COLOR_COMMAND_LEN) == 0) {
 		change_color(curr_buff + COLOR_COMMAND_LEN);
 		return 1;
 	} else if (index + GDT_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, GDT_COMMAND, GDT_COMMAND_LEN) == 0) {
-		print_gdt();
+		display_full_history(1);
+		hexdump((uintptr_t) gdt, sizeof(gdt), 1, false);
 		return 1;
 	} else if (index + GDTR_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, GDTR_COMMAND, GDTR_COMMAND_LEN) == 0) {
-		print_gdtr();
+		display_full_history(1);
+		hexdump((uintptr_t) gdt_register, sizeof(GDTR_t), 1, false);
+		return 1;
+	} else if (index + SECTIONS_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, SECTIONS_COMMAND, SECTIONS_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		print_sections();
+		return 1;
+	} else if (index + LS_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, LS_COMMAND, LS_COMMAND_LEN) == 0) {
+		command_argument(curr_buff + LS_COMMAND_LEN, arg, sizeof(arg));
+		display_full_history(1);
+		initrd_ls(arg);
+		return 1;
+	} else if (index + CAT_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, CAT_COMMAND, CAT_COMMAND_LEN) == 0) {
+		command_argument(curr_buff + CAT_COMMAND_LEN, arg, sizeof(arg));
+		display_full_history(1);
+		initrd_cat(arg);
+		return 1;
+	} else if (index + DISK_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, DISK_COMMAND, DISK_COMMAND_LEN) == 0) {
+		command_argument(curr_buff + DISK_COMMAND_LEN, arg, sizeof(arg));
+		display_full_history(1);
+		if (kstrlen(arg) == 5 && memcmp(arg, "bench", 5) == 0) {
+			ata_bench();
+		} else {
+			ata_list();
+		}
+		return 1;
+	} else if (index + BCACHE_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, BCACHE_COMMAND, BCACHE_COMMAND_LEN) == 0) {
+		char				name[BLOCK_NAME_LEN];
+		const uint16_t*		next = command_argument(curr_buff + BCACHE_COMMAND_LEN, arg, sizeof(arg));
+
+		command_argument(next, name, sizeof(name));
+		display_full_history(1);
+		bcache_command(arg, name);
+		return 1;
+	} else if (index + EXEC_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, EXEC_COMMAND, EXEC_COMMAND_LEN) == 0) {
+		command_argument(curr_buff + EXEC_COMMAND_LEN, arg, sizeof(arg));
+		display_full_history(1);
+		user_exec(arg);
+		return 1;
+	} else if (index + SYSCALLBENCH_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, SYSCALLBENCH_COMMAND, SYSCALLBENCH_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		syscall_bench();
+		return 1;
+	} else if (index + PAGING_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, PAGING_COMMAND, PAGING_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		paging_print();
+		return 1;
+	} else if (index + WCBENCH_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, WCBENCH_COMMAND, WCBENCH_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		memtype_bench();
+		return 1;
+	} else if (index + SIMDBENCH_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, SIMDBENCH_COMMAND, SIMDBENCH_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		simd_bench();
+		return 1;
+	} else if (index + LAYOUT_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, LAYOUT_COMMAND, LAYOUT_COMMAND_LEN) == 0) {
+		command_argument(curr_buff + LAYOUT_COMMAND_LEN, arg, sizeof(arg));
+		display_full_history(1);
+		if (arg[0] && !keymap_select(arg)) {
+			terminal_printf("layout: %s: unknown layout", arg);
+		} else {
+			keymap_print();
+		}
+		return 1;
+	} else if (index + DMESG_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, DMESG_COMMAND, DMESG_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		klog_dmesg();
+		return 1;
+	} else if (index + KLOGBENCH_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, KLOGBENCH_COMMAND, KLOGBENCH_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		klog_bench();
+		return 1;
+	} else if (index + LSPCI_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, LSPCI_COMMAND, LSPCI_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		pci_print();
+		return 1;
+	} else if (index + HEXDUMP_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, HEXDUMP_COMMAND, HEXDUMP_COMMAND_LEN) == 0) {
+		char			len[VGA_WIDTH];
+		char			target[VGA_WIDTH];
+		const uint16_t*	next = command_argument(curr_buff + HEXDUMP_COMMAND_LEN, arg, sizeof(arg));
+
+		next = command_argument(next, len, sizeof(len));
+		command_argument(next, target, sizeof(target));
+		display_full_history(1);
+		hexdump_command(arg, len, target);
 		return 1;
+	} else if (index + EXAMINE_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, EXAMINE_COMMAND, EXAMINE_COMMAND_LEN) == 0) {
+		char			addr[VGA_WIDTH];
+		const uint16_t*	next = command_argument(curr_buff + EXAMINE_COMMAND_LEN, arg, sizeof(arg));
+
+		command_argument(next, addr, sizeof(addr));
+		display_full_history(1);
+		examine_command(arg, addr);
+		return 1;
+	} else if (index + CONTINUE_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, CONTINUE_COMMAND, CONTINUE_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		examine_command("", "");
+		return 1;
+	} else if (index + VIRTIO_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, VIRTIO_COMMAND, VIRTIO_COMMAND_LEN) == 0) {
+		command_argument(curr_buff + VIRTIO_COMMAND_LEN, arg, sizeof(arg));
+		display_full_history(1);
+		if (kstrlen(arg) == 5 && memcmp(arg, "bench", 5) == 0) {
+			virtio_bench();
+		} else {
+			virtio_list();
+		}
+		return 1;
+	} else if (index + KEYREC_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, KEYREC_COMMAND, KEYREC_COMMAND_LEN) == 0) {
+		command_argument(curr_buff + KEYREC_COMMAND_LEN, arg, sizeof(arg));
+		display_full_history(1);
+		keyrec_command(arg);
+		return 1;
+	} else if (index + REPLAY_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, REPLAY_COMMAND, REPLAY_COMMAND_LEN) == 0) {
+		char			speed[VGA_WIDTH];
+		const uint16_t*	next = command_argument(curr_buff + REPLAY_COMMAND_LEN, arg, sizeof(arg));
+
+		command_argument(next, speed, sizeof(speed));
+		display_full_history(1);
+		replay_command(arg, speed);
+		return 1;
+#ifdef CONSOLE_FB
+	} else if (index + CONSOLE_COMMAND_LEN < VGA_WIDTH && kstrncmp(curr_buff, CONSOLE_COMMAND, CONSOLE_COMMAND_LEN) == 0) {
+		display_full_history(1);
+		console_print();
+		return 1;
+#endif
 	}
 
 	return 0;
 }
 
+static inline void update_modifiers(void) {
+	modifiers = ((lshift || rshift) ? KEYMAP_SHIFT : 0) | (maj ? KEYMAP_CAPS : 0) | (altgr ? KEYMAP_ALTGR : 0);
+}
+
 static inline void handle_extended_byte(const uint8_t scan_code) {
 	switch (scan_code) {
+		case RALT_PRESS:
+			altgr = true;
+			update_modifiers();
+			break;
+		case RALT_RELEASE:
+			altgr = false;
+			update_modifiers();
+			break;
+		case EXTENDED_ENTER_PRESS:
+			save_to_history();
+			pending_command = true;
+			break;
 		case DELETE_PRESS:
 			delete_next_char();
 			break;
 		case CURSOR_RIGHT_PRESS:
-			if (terminal_written_column[curr_tty] > terminal_column[curr_tty]) {
+			if (curr_tty->written_column > curr_tty->column) {
 				move_cursor_right();
 			}
 			break;
 		case CURSOR_LEFT_PRESS:
-			if (terminal_column[curr_tty] > TERMINAL_PROMPT_LEN) {
+			if (curr_tty->column > TERMINAL_PROMPT_LEN) {
 				move_cursor_left();
 			}
 			break;
@@ -383,59 +623,56 @@ static inline void handle_extended_byte(const uint8_t scan_code) {
 	}
 }
 
-extern "C" void isr_keyboard(void) {
-    uint8_t scan_code = inb(0x60);
-	uint8_t c = qwerty_keyboard_table[scan_code][shift];
+static __hot void handle_scan_code(const uint8_t scan_code) {
+	const uint16_t key = extended | scan_code;
+	const uint8_t c = keymap->keys[modifiers][key];
 	uint8_t new_tty;
 
+	// The byte following 0xE0 comes with its own interrupt
+	extended = 0;
+
 	#ifdef DEBUG 
-		kprintf("scan_code: 0x%x/%d\nchar: %c", scan_code, scan_code, c);
+		kprintf("scan_code: 0x%x/%d, char: %c", scan_code, scan_code, c);
 	#endif
 
 	if (c) {
-		if (maj && ((c >= 'a' && c <= 'z') || c >= 'A' && c <= 'Z')) {
-			c = qwerty_keyboard_table[scan_code][!shift];
-		}
-
 		terminal_insert_char(c);
+	} else if (key & KEYMAP_EXTENDED) {
+		handle_extended_byte(scan_code);
 	} else {
 		switch (scan_code) {
 			case ENTER_PRESS:
 				save_to_history();
-				if (!check_command()) {
-					display_full_history(1);
-				}
-				terminal_prompt();
-				history_current_index[curr_tty] = -1;
+				pending_command = true;
 				break;
 			case EXTENDED_BYTE:
-				scan_code = inb(0x60);
-				handle_extended_byte(scan_code);
+				extended = KEYMAP_EXTENDED;
 				break;
 			case BACKSPACE_PRESS:
 				delete_last_char();
 				break;
 			case LSHIFT_PRESS:
 				lshift = true;
-				shift = lshift | rshift;
+				update_modifiers();
 				break;
 			case RSHIFT_PRESS:
 				rshift = true;
-				shift = lshift | rshift;
+				update_modifiers();
 				break;
 			case LSHIFT_RELEASE:
 				lshift = false;
-				shift = lshift | rshift;
+				update_modifiers();
 				break;
 			case RSHIFT_RELEASE:
 				rshift = false;
-				shift = lshift | rshift;
+				update_modifiers();
 				break;
 			case CAPSLOCK_PRESS:
 				if (rdy_to_disable_maj == false) {
 					maj = true;
 					rdy_to_disable_maj = false;
 				}
+				update_modifiers();
 				break;
 			case CAPSLOCK_RELEASE:
 				if (rdy_to_disable_maj == false) {
@@ -444,6 +681,7 @@ extern "C" void isr_keyboard(void) {
 					maj = false;
 					rdy_to_disable_maj = false;
 				}
+				update_modifiers();
 				break;
 			case F1_PRESSED:
 			case F2_PRESSED:
@@ -456,7 +694,7 @@ extern "C" void isr_keyboard(void) {
 			case F9_PRESSED:
 			case F10_PRESSED:
 				new_tty = scan_code - F1_PRESSED;
-				if (curr_tty != new_tty) {
+				if (curr_tty != &ttys[new_tty]) {
 					swap_tty(new_tty);
 				}
 				break;
@@ -464,6 +702,76 @@ extern "C" void isr_keyboard(void) {
 				break;
 		}
 	}
+}
+
+extern "C" __hot void isr_keyboard(void) {
+	const uint8_t scan_code = inb(0x60);
+
+	++cpu_stats.interrupts;
+	keyrec_capture(scan_code);
+	if (!pending_command) {
+		handle_scan_code(scan_code);
+	} else if ((uint8_t) (scancode_queue_head - scancode_queue_tail) < KEYBOARD_QUEUE_SIZE) {
+		scancode_queue[scancode_queue_head++ % KEYBOARD_QUEUE_SIZE] = scan_code;
+	}
 
     outb(PIC1_COMMAND, 0x20);
-}
\ No newline at end of file
+}
+
+/* Forgets the modifiers held and the scan codes queued, as at boot */
+void keyboard_reset(void) {
+	lshift = rshift = altgr = maj = rdy_to_disable_maj = false;
+	modifiers = 0;
+	extended = 0;
+	pending_command = false;
+	scancode_queue_head = scancode_queue_tail = 0;
+}
+
+bool has_pending_command(void) {
+	return pending_command;
+}
+
+static void run_command(void) {
+	if (!check_command()) {
+		display_full_history(1);
+	}
+	terminal_prompt();
+	curr_tty->history_current_index = -1;
+}
+
+/* Runs the command entered at the prompt, outside of the keyboard interrupt
+   so that it can itself wait for interrupts, then replays the keys typed in
+   the meantime */
+void run_pending_command(void) {
+	if (!pending_command) {
+		return;
+	}
+
+	run_command();
+
+	const uint32_t flags = irq_save();
+
+	pending_command = false;
+	while (!pending_command && scancode_queue_tail != scancode_queue_head) {
+		handle_scan_code(scancode_queue[scancode_queue_tail++ % KEYBOARD_QUEUE_SIZE]);
+	}
+	irq_restore(flags);
+}
+
+/* Decodes scan_code as if it came from the keyboard, running the command it
+   completes at once. Only called from a command, replay, so real scan codes
+   keep being queued meanwhile. */
+void keyboard_inject(const uint8_t scan_code) {
+	const uint32_t flags = irq_save();
+
+	pending_command = false;
+	handle_scan_code(scan_code);
+
+	const bool entered = pending_command;
+
+	pending_command = true;
+	irq_restore(flags);
+	if (entered) {
+		run_command();
+	}
+}
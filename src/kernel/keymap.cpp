@@ -0,0 +1,136 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "keymap.hpp"
+#include "utils.hpp"
+
+
+/* A layout as written by hand: what each key gives alone and with shift,
+   from scan code 0x00 to 0x39, and the few keys AltGr changes. Characters
+   outside ASCII are code page 437, what the VGA text mode displays. */
+typedef struct KeymapSource {
+	const char*	name;
+	char		normal[KEYMAP_SOURCE_KEYS + 1];
+	char		shifted[KEYMAP_SOURCE_KEYS + 1];
+	char		iso[2];
+	uint8_t		altgr[KEYMAP_ALTGR_KEYS][2];	// scan code, character
+} keymap_source_t;
+
+static constexpr keymap_source_t	qwerty_source = {
+	"qwerty",
+	"\0\0" "1234567890-=" "\0\0"
+	"qwertyuiop[]" "\0\0" "as"
+	"dfghjkl;'`" "\0" "\\zxcv"
+	"bnm,./" "\0" "*" "\0" " ",
+	"\0\0" "!@#$%^&*()_+" "\0\0"
+	"QWERTYUIOP{}" "\0\0" "AS"
+	"DFGHJKL:\"~" "\0" "|ZXCV"
+	"BNM<>?" "\0" "*" "\0" " ",
+	{ '\\', '|' },
+	{},
+};
+
+static constexpr keymap_source_t	azerty_source = {
+	"azerty",
+	"\0\0" "&\x82\"'(-\x8A_\x87\x85)=" "\0\0"
+	"azertyuiop^$" "\0\0" "qs"
+	"dfghjklm\x97\xFD" "\0" "*wxcv"
+	"bn,;:!" "\0" "*" "\0" " ",
+	"\0\0" "1234567890\xF8+" "\0\0"
+	"AZERTYUIOP" "\0" "\x9C" "\0\0" "QS"
+	"DFGHJKLM%" "\0\0" "\xE6" "WXCV"
+	"BN?./\x15" "\0" "*" "\0" " ",
+	{ '<', '>' },
+	{
+		{ 0x03, '~' }, { 0x04, '#' }, { 0x05, '{' }, { 0x06, '[' }, { 0x07, '|' }, { 0x08, '`' },
+		{ 0x09, '\\' }, { 0x0A, '^' }, { 0x0B, '@' }, { 0x0C, ']' }, { 0x0D, '}' },
+	},
+};
+
+static constexpr keymap_source_t	dvorak_source = {
+	"dvorak",
+	"\0\0" "1234567890[]" "\0\0"
+	"',.pyfgcrl/=" "\0\0" "ao"
+	"euidhtns-`" "\0" "\\;qjk"
+	"xbmwvz" "\0" "*" "\0" " ",
+	"\0\0" "!@#$%^&*(){}" "\0\0"
+	"\"<>PYFGCRL?+" "\0\0" "AO"
+	"EUIDHTNS_~" "\0" "|:QJK"
+	"XBMWVZ" "\0" "*" "\0" " ",
+	{ '\\', '|' },
+	{},
+};
+
+// A literal too short for the scan codes it should cover would be padded with 0
+static_assert(qwerty_source.normal[0x39] == ' ' && qwerty_source.shifted[0x39] == ' ', "qwerty: wrong key count");
+static_assert(azerty_source.normal[0x39] == ' ' && azerty_source.shifted[0x39] == ' ', "azerty: wrong key count");
+static_assert(dvorak_source.normal[0x39] == ' ' && dvorak_source.shifted[0x39] == ' ', "dvorak: wrong key count");
+
+/* Caps lock only inverts shift on letters. AltGr gives its own characters
+   and nothing on the other keys. Space and the keypad are the same in
+   every state. */
+static constexpr keymap_t keymap_build(const keymap_source_t& source) {
+	keymap_t map = {};
+
+	map.name = source.name;
+	for (size_t state = 0; state < KEYMAP_STATES; ++state) {
+		map.keys[state][0x37] = '*';
+		map.keys[state][0x39] = ' ';
+		map.keys[state][0x4A] = '-';
+		map.keys[state][0x4E] = '+';
+		map.keys[state][KEYMAP_EXTENDED | 0x35] = '/';
+
+		if (state & KEYMAP_ALTGR) {
+			for (size_t i = 0; i < KEYMAP_ALTGR_KEYS; ++i) {
+				if (source.altgr[i][0]) {
+					map.keys[state][source.altgr[i][0]] = source.altgr[i][1];
+				}
+			}
+			continue;
+		}
+
+		for (size_t code = 0; code < KEYMAP_SOURCE_KEYS; ++code) {
+			const uint8_t normal = source.normal[code];
+			const uint8_t shifted = source.shifted[code];
+			const bool letter = normal >= 'a' && normal <= 'z' && shifted == normal - 'a' + 'A';
+			const bool upper = ((state & KEYMAP_SHIFT) != 0) != (letter && (state & KEYMAP_CAPS));
+
+			map.keys[state][code] = upper ? shifted : normal;
+		}
+		map.keys[state][KEYMAP_ISO_KEY] = source.iso[(state & KEYMAP_SHIFT) != 0];
+	}
+	return map;
+}
+
+static constexpr keymap_t	keymaps[KEYMAP_COUNT] = {
+	keymap_build(qwerty_source),
+	keymap_build(azerty_source),
+	keymap_build(dvorak_source),
+};
+
+static_assert(keymaps[0].keys[KEYMAP_SHIFT | KEYMAP_CAPS][0x10] == 'q', "caps lock must invert shift on letters");
+static_assert(keymaps[1].keys[KEYMAP_CAPS][0x02] == '&', "caps lock must leave the other keys alone");
+
+const keymap_t*	keymap = &keymaps[0];
+
+
+bool keymap_select(const char* name) {
+	const size_t len = kstrlen(name);
+
+	for (size_t i = 0; i < KEYMAP_COUNT; ++i) {
+		if (kstrlen(keymaps[i].name) == len && memcmp(keymaps[i].name, name, len) == 0) {
+			keymap = &keymaps[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+void keymap_print(void) {
+	char line[VGA_WIDTH + 1];
+	size_t len = ksnprintf(line, sizeof(line), "layout %s, available:", keymap->name);
+
+	for (size_t i = 0; i < KEYMAP_COUNT && len < sizeof(line) - 1; ++i) {
+		len += ksnprintf(line + len, sizeof(line) - len, " %s", keymaps[i].name);
+	}
+	terminal_print_line(line);
+}
@@ -0,0 +1,325 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "initrd.hpp"
+#include "keymap.hpp"
+#include "keyrec.hpp"
+#include "serial.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+
+#define KEY_RELEASE		0x80
+
+/* A stream built from lines typed at the prompt, each round the same */
+typedef struct KeyrecCorpus {
+	const char*	name;
+	const char*	lines[6];
+	bool		enter;			// run each line, or erase it
+	uint8_t		history;		// up then down presses after each round
+	uint8_t		rounds;
+} keyrec_corpus_t;
+
+static const keyrec_corpus_t	corpora[] = {
+	{ "typing", { "the quick brown fox jumps over the lazy dog" }, false, 0, 16 },
+	{ "commands", { "layout", "gdtr", "lspci", "keyrec", "hello" }, true, 0, 24 },
+	{ "history", { "layout", "keyrec", "hello" }, true, 16, 12 },
+};
+
+bool					keyrec_recording = false;
+static keyrec_event_t	recorded[KEYREC_EVENTS];
+static size_t			recorded_count = 0;
+static uint32_t			recorded_dropped = 0;
+/* The stream replayed when it isn't the recording: from the initrd or built in */
+static keyrec_event_t	loaded[KEYREC_EVENTS];
+static size_t			loaded_count = 0;
+static uint32_t			latencies[KEYREC_EVENTS];
+static bool				replaying = false;
+
+
+__hot void keyrec_store(const uint8_t code) {
+	if (recorded_count == KEYREC_EVENTS) {
+		++recorded_dropped;
+		return;
+	}
+	recorded[recorded_count].tsc = rdtsc();
+	recorded[recorded_count++].code = code;
+}
+
+static inline bool is_enter(const keyrec_event_t* event) {
+	return event->code == ENTER_PRESS;
+}
+
+/* Cuts the line that typed keyrec stop off the end, keeping the release of
+   the Enter before it */
+static void trim_stop_line(void) {
+	size_t end = recorded_count;
+
+	while (end && !is_enter(&recorded[end - 1])) {
+		--end;
+	}
+	if (end) {
+		--end;
+	}
+	while (end && !is_enter(&recorded[end - 1])) {
+		--end;
+	}
+	if (end < recorded_count && recorded[end].code == (ENTER_PRESS | KEY_RELEASE)) {
+		++end;
+	} else if (end + 1 < recorded_count && recorded[end].code == EXTENDED_BYTE
+			&& recorded[end + 1].code == (ENTER_PRESS | KEY_RELEASE)) {
+		end += 2;
+	}
+	recorded_count = end;
+}
+
+/* "<microseconds from the first> <scan code>" lines, what the replay reads back */
+static void keyrec_dump(void) {
+	char line[KEYREC_LINE];
+
+	serial_write("# keyrec\r\n", 10);
+	for (size_t i = 0; i < recorded_count; ++i) {
+		const size_t len = ksnprintf(line, sizeof(line), "%u %02x\r\n",
+			(uint32_t) tsc_to_us(recorded[i].tsc - recorded[0].tsc), recorded[i].code);
+
+		serial_write(line, len);
+	}
+	terminal_printf("keyrec: %u scancodes sent to the serial port", recorded_count);
+}
+
+/* keyrec [start|stop|dump] */
+void keyrec_command(const char* action) {
+	const size_t len = kstrlen(action);
+
+	if (len == 5 && memcmp(action, "start", 5) == 0) {
+		recorded_count = 0;
+		recorded_dropped = 0;
+		keyrec_recording = true;
+		terminal_printf("keyrec: recording up to %u scancodes", KEYREC_EVENTS);
+	} else if (len == 4 && memcmp(action, "stop", 4) == 0) {
+		if (keyrec_recording) {
+			keyrec_recording = false;
+			trim_stop_line();
+		}
+		terminal_printf("keyrec: %u scancodes over %u ms, %u dropped", recorded_count,
+			recorded_count ? (uint32_t) tsc_to_us(recorded[recorded_count - 1].tsc - recorded[0].tsc) / 1000 : 0,
+			recorded_dropped);
+	} else if (len == 4 && memcmp(action, "dump", 4) == 0) {
+		keyrec_dump();
+	} else {
+		terminal_printf("keyrec: %s, %u scancodes recorded", keyrec_recording ? "recording" : "stopped", recorded_count);
+		terminal_printf("usage: keyrec [start|stop|dump], replay <rec|typing|commands|history|file> [fast]");
+	}
+}
+
+static void load_event(const uint64_t us, const uint8_t code) {
+	if (loaded_count < KEYREC_EVENTS) {
+		loaded[loaded_count].tsc = us * tsc_khz / 1000;
+		loaded[loaded_count++].code = code;
+	}
+}
+
+/* The scan code giving c in the current layout, 0 if there's none */
+static uint8_t key_for(const char c, bool* shift) {
+	for (size_t state = 0; state <= KEYMAP_SHIFT; state += KEYMAP_SHIFT) {
+		for (size_t code = 1; code < KEY_RELEASE; ++code) {
+			if (keymap->keys[state][code] == (uint8_t) c) {
+				*shift = state;
+				return code;
+			}
+		}
+	}
+	return 0;
+}
+
+static void generate_key(const uint8_t code, const bool extended, uint64_t* us) {
+	if (extended) {
+		load_event(*us, EXTENDED_BYTE);
+	}
+	load_event(*us, code);
+	*us += KEYREC_KEY_US;
+	if (extended) {
+		load_event(*us, EXTENDED_BYTE);
+	}
+	load_event(*us, code | KEY_RELEASE);
+	*us += KEYREC_GAP_US;
+}
+
+static void generate(const keyrec_corpus_t* corpus) {
+	uint64_t us = 0;
+
+	loaded_count = 0;
+	for (size_t round = 0; round < corpus->rounds; ++round) {
+		for (size_t i = 0; i < 6 && corpus->lines[i]; ++i) {
+			const char* const text = corpus->lines[i];
+
+			for (size_t j = 0; text[j]; ++j) {
+				bool shift = false;
+				const uint8_t code = key_for(text[j], &shift);
+
+				if (shift) {
+					load_event(us, LSHIFT_PRESS);
+				}
+				if (code) {
+					generate_key(code, false, &us);
+				}
+				if (shift) {
+					load_event(us, LSHIFT_RELEASE);
+				}
+			}
+			if (corpus->enter) {
+				generate_key(ENTER_PRESS, false, &us);
+			} else {
+				for (size_t j = 0; text[j]; ++j) {
+					generate_key(BACKSPACE_PRESS, false, &us);
+				}
+			}
+		}
+		for (size_t i = 0; i < corpus->history; ++i) {
+			generate_key(CURSOR_UP_PRESS, true, &us);
+		}
+		for (size_t i = 0; i < corpus->history; ++i) {
+			generate_key(CURSOR_DOWN_PRESS, true, &us);
+		}
+	}
+}
+
+/* Lines of the dump format. The rest, comments included, is skipped. */
+static bool load_file(const initrd_file_t* file) {
+	const uint8_t* data;
+	const size_t size = initrd_read(file, 0, &data);
+	size_t i = 0;
+
+	loaded_count = 0;
+	while (i < size) {
+		uint64_t us = 0;
+		uint32_t code = 0;
+		size_t digits = 0;
+		size_t hex_digits = 0;
+
+		for (; i < size && data[i] >= '0' && data[i] <= '9'; ++i, ++digits) {
+			us = us * 10 + data[i] - '0';
+		}
+		for (; i < size && (data[i] == ' ' || data[i] == '\t'); ++i) {
+		}
+		for (; i < size; ++i, ++hex_digits) {
+			const char c = data[i] | 0x20;
+
+			if (c >= '0' && c <= '9') {
+				code = code * 16 + c - '0';
+			} else if (c >= 'a' && c <= 'f') {
+				code = code * 16 + c - 'a' + 10;
+			} else {
+				break;
+			}
+		}
+		if (digits && hex_digits && code <= 0xFF) {
+			load_event(us, code);
+		}
+		for (; i < size && data[i] != '\n'; ++i) {
+		}
+		++i;
+	}
+	return loaded_count;
+}
+
+static void sort(uint32_t* values, const size_t count) {
+	for (size_t gap = count / 2; gap; gap /= 2) {
+		for (size_t i = gap; i < count; ++i) {
+			const uint32_t value = values[i];
+			size_t j = i;
+
+			for (; j >= gap && values[j - gap] > value; j -= gap) {
+				values[j] = values[j - gap];
+			}
+			values[j] = value;
+		}
+	}
+}
+
+/* Feeds the stream to the keyboard decoding, either as fast as it goes or
+   waiting until each scan code is due, then reports how long each one took
+   to handle, the command it ends included */
+static void replay(const keyrec_event_t* events, const size_t count, const bool fast) {
+	uint32_t presses = 0;
+
+	// Typed on an empty prompt, not after the replay command itself
+	replaying = true;
+	terminal_prompt();
+	curr_tty->history_current_index = -1;
+
+	const uint64_t start = rdtsc();
+
+	for (size_t i = 0; i < count; ++i) {
+		if (!fast) {
+			while (rdtsc() - start < events[i].tsc - events[0].tsc) {
+				__asm__ volatile ("pause");
+			}
+		}
+
+		const uint64_t before = rdtsc();
+
+		keyboard_inject(events[i].code);
+
+		const uint64_t cycles = rdtsc() - before;
+
+		latencies[i] = cycles > UINT32_MAX ? UINT32_MAX : cycles;
+		presses += !(events[i].code & KEY_RELEASE);
+	}
+
+	const uint64_t us = tsc_to_us(rdtsc() - start);
+
+	replaying = false;
+	sort(latencies, count);
+	terminal_printf("replay: %u scancodes, %u keys in %u ms: %u keys/s", count, presses, (uint32_t) (us / 1000),
+		us ? (uint32_t) (presses * 1000000ULL / us) : 0);
+	terminal_printf("latency: p50 %u ns, p90 %u ns, p99 %u ns, max %u ns",
+		(uint32_t) tsc_to_ns(latencies[count / 2]), (uint32_t) tsc_to_ns(latencies[count * 9 / 10]),
+		(uint32_t) tsc_to_ns(latencies[count * 99 / 100]), (uint32_t) tsc_to_ns(latencies[count - 1]));
+}
+
+/* replay <rec|corpus|file> [fast] */
+void replay_command(const char* source, const char* speed) {
+	const size_t speed_len = kstrlen(speed);
+	const bool fast = speed_len == 4 && memcmp(speed, "fast", 4) == 0;
+
+	if (!*source || (speed_len && !fast)) {
+		terminal_printf("usage: replay <rec|typing|commands|history|file> [fast]");
+		return;
+	}
+	// The replayed keys may well type replay again
+	if (replaying) {
+		terminal_printf("replay: already replaying");
+		return;
+	}
+
+	const size_t len = kstrlen(source);
+
+	if (len == 3 && memcmp(source, "rec", 3) == 0) {
+		if (keyrec_recording) {
+			terminal_printf("replay: keyrec stop first");
+		} else if (!recorded_count) {
+			terminal_printf("replay: nothing recorded");
+		} else {
+			replay(recorded, recorded_count, fast);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); ++i) {
+		if (kstrlen(corpora[i].name) == len && memcmp(corpora[i].name, source, len) == 0) {
+			generate(&corpora[i]);
+			replay(loaded, loaded_count, fast);
+			return;
+		}
+	}
+
+	const initrd_file_t* const file = initrd_lookup(source);
+
+	if (!file || file->directory) {
+		terminal_printf("replay: %s: no such stream", source);
+	} else if (!load_file(file)) {
+		terminal_printf("replay: %s: no scancode in it", source);
+	} else {
+		replay(loaded, loaded_count, fast);
+	}
+}
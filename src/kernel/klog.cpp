@@ -0,0 +1,129 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "klog.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+
+static_assert(sizeof(klog_record_t) == KLOG_RECORD_SIZE, "klog records must have a fixed size");
+
+static klog_record_t	records[KLOG_RECORDS] __attribute__((aligned(CACHE_LINE_SIZE)));
+/* Sequence number of the next record to be reserved */
+static uint32_t			head = 0;
+
+static const char* const	level_names[8] = {
+	"emerg", "alert", "crit", "err", "warn", "notice", "info", "debug",
+};
+
+
+/* A writer reserves its record with one atomic increment, so that an
+   interrupt handler logging meanwhile simply takes the next one. Nothing
+   ever waits: a reader finds a record still being written and stops there. */
+void vklog(const uint8_t level, const char* format, va_list va_params) {
+	const uint32_t seq = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+	klog_record_t* const record = &records[seq % KLOG_RECORDS];
+
+	record->commit = 0;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	record->tsc = rdtsc();
+	record->level = level;
+	record->len = kvsnprintf(record->text, sizeof(record->text), format, va_params);
+	__atomic_store_n(&record->commit, seq + 1, __ATOMIC_RELEASE);
+}
+
+void klog(const uint8_t level, const char* format, ...) {
+	va_list va_params;
+
+	va_start(va_params, format);
+	vklog(level, format, va_params);
+	va_end(va_params);
+}
+
+/* From the oldest record still in the ring, or from the next one written */
+void klog_reader_init(klog_reader_t* reader, const bool oldest) {
+	const uint32_t next = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+
+	reader->seq = oldest && next > KLOG_RECORDS ? next - KLOG_RECORDS : (oldest ? 0 : next);
+	reader->lost = 0;
+}
+
+/* Copies the reader's next record. The commit word is checked again after
+   the copy, as a writer may have gone around the ring and reused the
+   record meanwhile. */
+bool klog_read(klog_reader_t* reader, klog_record_t* record) {
+	for (;;) {
+		const uint32_t next = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+
+		if (next - reader->seq > KLOG_RECORDS) {
+			reader->lost += next - KLOG_RECORDS - reader->seq;
+			reader->seq = next - KLOG_RECORDS;
+		}
+		if (reader->seq == next) {
+			return false;
+		}
+
+		const klog_record_t* const slot = &records[reader->seq % KLOG_RECORDS];
+
+		// Still being written: it comes out on the next call
+		if (__atomic_load_n(&slot->commit, __ATOMIC_ACQUIRE) != reader->seq + 1) {
+			return false;
+		}
+
+		memcpy(record, (const void*) slot, sizeof(*record));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (slot->commit != reader->seq + 1) {
+			++reader->lost;
+			++reader->seq;
+			continue;
+		}
+		++reader->seq;
+		return true;
+	}
+}
+
+/* "[seconds.microseconds] level text", like dmesg */
+size_t klog_format(const klog_record_t* record, char* buf, const size_t size) {
+	const uint64_t us = tsc_to_us(record->tsc);
+
+	return ksnprintf(buf, size, "[%5u.%06u] %5s %s", (uint32_t) (us / 1000000), (uint32_t) (us % 1000000),
+		level_names[record->level & 7], record->text);
+}
+
+void klog_dmesg(void) {
+	klog_reader_t	reader;
+	klog_record_t	record;
+	char			line[VGA_WIDTH + 1];
+
+	klog_reader_init(&reader, true);
+	while (klog_read(&reader, &record)) {
+		klog_format(&record, line, sizeof(line));
+		terminal_print_line(line);
+	}
+	if (reader.lost) {
+		terminal_printf("dmesg: %u records overwritten while reading", reader.lost);
+	}
+}
+
+/* Cost of a record, and what a reader that doesn't keep up gets back */
+void klog_bench(void) {
+	klog_reader_t	reader;
+	klog_record_t	record;
+	uint32_t		read = 0;
+
+	klog_reader_init(&reader, false);
+
+	const uint64_t start = rdtsc();
+
+	for (uint32_t i = 0; i < KLOG_BENCH_RECORDS; ++i) {
+		klog(KLOG_DEBUG, "klogbench record %u", i);
+	}
+
+	const uint64_t cycles = rdtsc() - start;
+
+	while (klog_read(&reader, &record)) {
+		++read;
+	}
+	terminal_printf("%u records, %u cycles (%u ns) each", KLOG_BENCH_RECORDS,
+		(uint32_t) (cycles / KLOG_BENCH_RECORDS), (uint32_t) (tsc_to_ns(cycles) / KLOG_BENCH_RECORDS));
+	terminal_printf("late reader: %u read, %u lost to overruns", read, reader.lost);
+}
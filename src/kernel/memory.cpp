@@ -0,0 +1,123 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "memory.hpp"
+#include "multiboot.hpp"
+#include "syscall.hpp"
+#include "utils.hpp"
+
+
+/* Free physical pages are chained through their first word: the kernel runs
+   with a flat address space so a free page can hold its own link. */
+struct FreePage {
+	FreePage*	next;
+};
+
+static FreePage*	free_list = NULL;
+static size_t		free_count = 0;
+static bool			init_freed = false;
+
+
+void page_free(void* page) {
+	FreePage* p = reinterpret_cast<FreePage *>(page);
+
+	p->next = free_list;
+	free_list = p;
+	++free_count;
+}
+
+void* page_alloc(void) {
+	FreePage* p = free_list;
+
+	if (p) {
+		free_list = p->next;
+		--free_count;
+	}
+	return p;
+}
+
+/* Hands every whole page of [start, end[ to the allocator */
+void free_pages(uintptr_t start, uintptr_t end) {
+	start = PAGE_ALIGN_UP(start);
+	end = PAGE_ALIGN_DOWN(end);
+
+	for (; start < end; start += PAGE_SIZE) {
+		page_free(reinterpret_cast<void *>(start));
+	}
+}
+
+static bool page_in_module(const uintptr_t page) {
+	for (size_t i = 0; i < boot_module_count(); ++i) {
+		const boot_module_t* module = boot_module(i);
+
+		if (page + PAGE_SIZE > module->start && page < module->end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Hands the available memory reported by the bootloader to the allocator,
+   except the kernel image, the low megabyte, the boot modules and the
+   memory reserved for user programs */
+__init void init_memory(void) {
+	for (size_t i = 0; i < boot_memory_region_count(); ++i) {
+		const boot_memory_region_t* region = boot_memory_region(i);
+		uint64_t start = region->start;
+		uint64_t end = region->end;
+
+		if (start < (uintptr_t) __kernel_end) {
+			start = (uintptr_t) __kernel_end;
+		}
+		if (end > 0x100000000ULL) {
+			end = 0x100000000ULL;
+		}
+		if (start >= end) {
+			continue;
+		}
+
+		for (uint64_t page = PAGE_ALIGN_UP(start); page + PAGE_SIZE <= end; page += PAGE_SIZE) {
+			if (!page_in_module((uintptr_t) page) && (page < USER_BASE || page >= USER_END)) {
+				page_free(reinterpret_cast<void *>((uintptr_t) page));
+			}
+		}
+	}
+}
+
+size_t pages_free_count(void) {
+	return free_count;
+}
+
+/* Releases the .init.text and .init.data pages once booting is over.
+   The area is filled with int3 first so that a stale call into boot code
+   traps instead of running whatever reuses the page. */
+void free_init_memory(void) {
+	const uintptr_t start = (uintptr_t) __init_start;
+	const uintptr_t end = (uintptr_t) __init_end;
+
+	kmemset(__init_start, (int8_t) 0xCC, end - start);
+	free_pages(start, end);
+	init_freed = true;
+}
+
+bool init_memory_freed(void) {
+	return init_freed;
+}
+
+static void print_section(const char* name, const uint8_t* start, const uint8_t* end) {
+	terminal_printf("%s  0x%p  0x%p  %8u", name, start, end, (uint32_t) (end - start));
+}
+
+void print_sections(void) {
+	terminal_printf("section     start       end             size");
+	print_section(".text     ", __text_start, __text_end);
+	print_section(".rodata   ", __rodata_start, __rodata_end);
+	print_section(".data     ", __data_start, __data_end);
+	print_section(".user     ", __user_start, __user_end);
+	print_section(".bss      ", __bss_start, __bss_end);
+	print_section(".init.text", __init_text_start, __init_text_end);
+	print_section(".init.data", __init_data_start, __init_data_end);
+	print_section("kernel    ", __kernel_start, __kernel_end);
+	terminal_printf("resident: %u bytes, init: %u bytes %s, free pages: %u",
+		(uint32_t) (__init_start - __kernel_start), (uint32_t) (__init_end - __init_start),
+		init_freed ? "(freed)" : "(in use)", (uint32_t) free_count);
+}
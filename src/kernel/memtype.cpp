@@ -0,0 +1,239 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "memtype.hpp"
+#include "paging.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+
+typedef struct CacheChange {
+	uint32_t	irq_flags;
+	uint32_t	cr0;
+	uint64_t	mtrr_def_type;
+} cache_change_t;
+
+static bool		pat = false;
+static bool		mtrr = false;
+static bool		mtrr_wc = false;
+static bool		mtrr_fixed = false;
+static size_t	mtrr_count = 0;
+static uint64_t	phys_mask = 0;
+
+static uint16_t	bench_frame[CONSOLE_TEXT_WIDTH * CONSOLE_TEXT_HEIGHT];
+static uint16_t	bench_saved[CONSOLE_TEXT_WIDTH * CONSOLE_TEXT_HEIGHT];
+
+
+static inline void wbinvd(void) {
+	__asm__ volatile ("wbinvd" : : : "memory");
+}
+
+/* PAT and MTRRs may only change with caching disabled and the caches and
+   TLBs flushed, MTRRs turned off meanwhile (SDM 11.11.8) */
+static void cache_change_begin(cache_change_t* change) {
+	change->irq_flags = irq_save();
+	change->cr0 = read_cr0();
+	write_cr0((change->cr0 | CR0_CD) & ~CR0_NW);
+	wbinvd();
+	tlb_flush_global();
+	if (mtrr) {
+		change->mtrr_def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+		wrmsr(MSR_MTRR_DEF_TYPE, change->mtrr_def_type & ~(uint64_t) MTRR_ENABLE);
+	}
+}
+
+static void cache_change_end(const cache_change_t* change) {
+	wbinvd();
+	tlb_flush_global();
+	if (mtrr) {
+		wrmsr(MSR_MTRR_DEF_TYPE, change->mtrr_def_type);
+	}
+	write_cr0(change->cr0);
+	irq_restore(change->irq_flags);
+}
+
+/* One byte per 16 KB from 0xA0000 to 0xBFFFF */
+static bool mtrr_set_fixed(const uintptr_t start, const uintptr_t end, const uint8_t type) {
+	cache_change_t change;
+
+	if (!mtrr_fixed || start < VGA_APERTURE_START || end > VGA_APERTURE_END || (start | end) & 0x3FFF) {
+		return false;
+	}
+
+	cache_change_begin(&change);
+
+	uint64_t value = rdmsr(MSR_MTRR_FIX16K_A0000);
+
+	for (uintptr_t addr = start; addr < end; addr += 0x4000) {
+		const size_t shift = (addr - VGA_APERTURE_START) / 0x4000 * 8;
+
+		value = (value & ~((uint64_t) 0xFF << shift)) | (uint64_t) type << shift;
+	}
+	wrmsr(MSR_MTRR_FIX16K_A0000, value);
+	cache_change_end(&change);
+	return true;
+}
+
+/* A variable range must be a power of two, aligned on its size. Setting a
+   range back to UC releases the MTRR that made it WC. */
+static bool mtrr_set_variable(const uintptr_t start, const uintptr_t end, const uint8_t type) {
+	const uint64_t size = end - start;
+	cache_change_t change;
+
+	if (size < PAGE_SIZE || (size & (size - 1)) || (start & (size - 1))) {
+		return false;
+	}
+
+	for (size_t i = 0; i < mtrr_count; ++i) {
+		const uint64_t base = rdmsr(MSR_MTRR_PHYSBASE0 + 2 * i);
+		const uint64_t mask = rdmsr(MSR_MTRR_PHYSMASK0 + 2 * i);
+		const bool same = (mask & MTRR_MASK_VALID) && (base & PAGE_FRAME) == start;
+
+		if ((type == MEMTYPE_WC && (mask & MTRR_MASK_VALID)) || (type != MEMTYPE_WC && !same)) {
+			continue;
+		}
+
+		cache_change_begin(&change);
+		if (type == MEMTYPE_WC) {
+			wrmsr(MSR_MTRR_PHYSBASE0 + 2 * i, start | MEMTYPE_WC);
+			wrmsr(MSR_MTRR_PHYSMASK0 + 2 * i, (~(size - 1) & phys_mask) | MTRR_MASK_VALID);
+		} else {
+			wrmsr(MSR_MTRR_PHYSMASK0 + 2 * i, 0);
+		}
+		cache_change_end(&change);
+		return true;
+	}
+	return false;
+}
+
+/* Makes the kernel mapping of [start, end[ write-combining or uncached:
+   through the page tables when the CPU has PAT, MTRRs otherwise. Only
+   meant for memory that is never cached, like frame buffers. */
+bool memtype_set(const uintptr_t start, const uintptr_t end, const uint8_t type) {
+	if (pat) {
+		paging_set_cache(start, end, type == MEMTYPE_WC ? PAGE_CACHE_WC : PAGE_CACHE_UC);
+		return true;
+	} else if (!mtrr || (type == MEMTYPE_WC && !mtrr_wc)) {
+		return false;
+	} else if (end <= VGA_APERTURE_END) {
+		return mtrr_set_fixed(start, end, type);
+	}
+	return mtrr_set_variable(start, end, type);
+}
+
+const char* memtype_method(void) {
+	if (pat) {
+		return "PAT";
+	}
+	return mtrr && mtrr_wc ? "MTRR" : "none";
+}
+
+/* Must run after paging_init() */
+__init void memtype_init(void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	pat = edx & CPUID_PAT;
+	mtrr = edx & CPUID_MTRR;
+
+	if (mtrr) {
+		const uint64_t cap = rdmsr(MSR_MTRRCAP);
+		uint32_t phys_bits = 36;
+
+		mtrr_wc = cap & MTRRCAP_WC;
+		mtrr_count = cap & MTRRCAP_VCNT;
+		mtrr_fixed = (cap & MTRRCAP_FIX) && (rdmsr(MSR_MTRR_DEF_TYPE) & MTRR_FIXED_ENABLE);
+
+		cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+		if (eax >= 0x80000008) {
+			cpuid(0x80000008, &eax, &ebx, &ecx, &edx);
+			phys_bits = eax & 0xFF;
+		}
+		phys_mask = ((1ULL << phys_bits) - 1) & ~(uint64_t) (PAGE_SIZE - 1);
+	}
+
+	if (pat) {
+		cache_change_t change;
+
+		cache_change_begin(&change);
+		wrmsr(MSR_PAT, PAT_LAYOUT);
+		cache_change_end(&change);
+	}
+
+	memtype_set(VGA_TEXT_START, VGA_TEXT_END, MEMTYPE_WC);
+	klog(KLOG_INFO, "memtype: write-combining through %s", memtype_method());
+}
+
+/* The text cells the CRTC shows, wherever scrolling has panned them to.
+   Behind the framebuffer console, the unseen start of the text buffer. */
+static uint16_t* bench_screen(void) {
+#ifdef CONSOLE_FB
+	return (uint16_t*) CONSOLE_TEXT_BUFFER;
+#else
+	return terminal_buffer;
+#endif
+}
+
+/* Redraws the whole text screen the two ways the terminal does: one 16-bit
+   store per cell like terminal_putentryat(), and one bulk copy like swap_tty() */
+static void bench_pass(uint64_t* cells_cycles, uint64_t* copy_cycles) {
+	volatile uint16_t* const screen = bench_screen();
+	uint64_t start = rdtsc();
+
+	for (size_t frame = 0; frame < WC_BENCH_FRAMES; ++frame) {
+		const uint16_t entry = vga_entry('0' + frame % 10, DEFAULT_COLOR);
+
+		for (size_t i = 0; i < CONSOLE_TEXT_WIDTH * CONSOLE_TEXT_HEIGHT; ++i) {
+			screen[i] = entry;
+		}
+	}
+	wc_barrier();
+	*cells_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	for (size_t frame = 0; frame < WC_BENCH_FRAMES; ++frame) {
+		memcpy(bench_screen(), bench_frame, sizeof(bench_frame));
+	}
+	wc_barrier();
+	*copy_cycles = rdtsc() - start;
+}
+
+static void bench_print(const char* name, const uint64_t cells_cycles, const uint64_t copy_cycles) {
+	const uint64_t cells_ns = tsc_to_ns(cells_cycles) / WC_BENCH_FRAMES;
+	const uint64_t copy_ns = tsc_to_ns(copy_cycles) / WC_BENCH_FRAMES;
+
+	terminal_printf("%s  cell stores %u us/frame  bulk copy %u us/frame (%u MB/s)", name,
+		(uint32_t) (cells_ns / 1000), (uint32_t) (copy_ns / 1000),
+		(uint32_t) (copy_ns ? sizeof(bench_frame) * 1000 / copy_ns : 0));
+}
+
+void memtype_bench(void) {
+	uint64_t uc_cells, uc_copy, wc_cells, wc_copy;
+
+	if (!memtype_set(VGA_TEXT_START, VGA_TEXT_END, MEMTYPE_UC)) {
+		terminal_printf("wcbench: memory types can't be changed on this CPU");
+		return;
+	}
+
+	for (size_t i = 0; i < CONSOLE_TEXT_WIDTH * CONSOLE_TEXT_HEIGHT; ++i) {
+		bench_frame[i] = vga_entry('#', DEFAULT_COLOR);
+	}
+	memcpy(bench_saved, bench_screen(), sizeof(bench_saved));
+
+	bench_pass(&uc_cells, &uc_copy);
+	const bool wc = memtype_set(VGA_TEXT_START, VGA_TEXT_END, MEMTYPE_WC);
+	bench_pass(&wc_cells, &wc_copy);
+
+	memcpy(bench_screen(), bench_saved, sizeof(bench_saved));
+	wc_barrier();
+
+	terminal_printf("full screen redraw, %u frames, memory types through %s", WC_BENCH_FRAMES, memtype_method());
+	bench_print("UC", uc_cells, uc_copy);
+	if (wc) {
+		bench_print("WC", wc_cells, wc_copy);
+	} else {
+		terminal_printf("WC  not supported");
+	}
+}
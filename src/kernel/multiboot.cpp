@@ -0,0 +1,117 @@
+#include "kernel.hpp"
+#include "multiboot.hpp"
+#include "utils.hpp"
+
+
+static boot_module_t		modules[MAX_MODULES];
+static size_t				modules_count = 0;
+static boot_memory_region_t	memory_regions[MAX_MMAP_ENTRIES];
+static size_t				memory_regions_count = 0;
+static boot_framebuffer_t	framebuffer;
+static bool					has_framebuffer = false;
+
+
+/* Copies the module list, the available memory map and the framebuffer out
+   of the multiboot information. Returns false if we were not booted by a multiboot loader. */
+__init bool multiboot_init(const uint32_t magic, const multiboot_info_t* mbi) {
+	if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+		return false;
+	}
+
+	if (mbi->flags & MULTIBOOT_INFO_MODS) {
+		const multiboot_module_t* mod = (const multiboot_module_t *) mbi->mods_addr;
+
+		for (uint32_t i = 0; i < mbi->mods_count && modules_count < MAX_MODULES; ++i, ++mod) {
+			boot_module_t* module = &modules[modules_count++];
+			const char* cmdline = (const char *) mod->cmdline;
+			size_t len = 0;
+
+			module->start = mod->mod_start;
+			module->end = mod->mod_end;
+			for (; cmdline && cmdline[len] && len < MODULE_CMDLINE_LEN - 1; ++len) {
+				module->cmdline[len] = cmdline[len];
+			}
+			module->cmdline[len] = '\0';
+		}
+	}
+
+	if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+		uintptr_t entry_addr = mbi->mmap_addr;
+		const uintptr_t mmap_end = mbi->mmap_addr + mbi->mmap_length;
+
+		while (entry_addr < mmap_end && memory_regions_count < MAX_MMAP_ENTRIES) {
+			const multiboot_mmap_entry_t* entry = (const multiboot_mmap_entry_t *) entry_addr;
+
+			if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->len) {
+				memory_regions[memory_regions_count].start = entry->addr;
+				memory_regions[memory_regions_count].end = entry->addr + entry->len;
+				++memory_regions_count;
+			}
+			entry_addr += entry->size + sizeof(entry->size);
+		}
+	} else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+		// mem_upper is the amount of memory above 1M, in KB
+		memory_regions[0].start = 0x100000;
+		memory_regions[0].end = 0x100000 + (uint64_t) mbi->mem_upper * 1024;
+		memory_regions_count = 1;
+	}
+
+	// Only a direct color framebuffer below 4 GB is of any use
+	if ((mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER) && mbi->framebuffer_type == MULTIBOOT_FRAMEBUFFER_RGB
+			&& mbi->framebuffer_addr < 0x100000000ULL) {
+		framebuffer.addr = mbi->framebuffer_addr;
+		framebuffer.pitch = mbi->framebuffer_pitch;
+		framebuffer.width = mbi->framebuffer_width;
+		framebuffer.height = mbi->framebuffer_height;
+		framebuffer.bpp = mbi->framebuffer_bpp;
+		framebuffer.red_position = mbi->red_position;
+		framebuffer.green_position = mbi->green_position;
+		framebuffer.blue_position = mbi->blue_position;
+		has_framebuffer = true;
+	}
+
+	return true;
+}
+
+size_t boot_module_count(void) {
+	return modules_count;
+}
+
+const boot_module_t* boot_module(const size_t index) {
+	return index < modules_count ? &modules[index] : NULL;
+}
+
+/* Finds a module by the last word of its command line, e.g. "initrd" for
+   a "module /boot/initrd.tar initrd" line in grub.cfg */
+const boot_module_t* boot_module_find(const char* name) {
+	const size_t name_len = kstrlen(name);
+
+	for (size_t i = 0; i < modules_count; ++i) {
+		const char* cmdline = modules[i].cmdline;
+		const char* word = cmdline;
+
+		// GRUB passes the module path as the first word
+		for (const char* c = cmdline; *c; ++c) {
+			if (*c == ' ' && c[1]) {
+				word = c + 1;
+			}
+		}
+
+		if (kstrlen(word) == name_len && memcmp(word, name, name_len) == 0) {
+			return &modules[i];
+		}
+	}
+	return NULL;
+}
+
+size_t boot_memory_region_count(void) {
+	return memory_regions_count;
+}
+
+const boot_memory_region_t* boot_memory_region(const size_t index) {
+	return index < memory_regions_count ? &memory_regions[index] : NULL;
+}
+
+const boot_framebuffer_t* boot_framebuffer(void) {
+	return has_framebuffer ? &framebuffer : NULL;
+}
@@ -0,0 +1,333 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "multiboot.hpp"
+#include "paging.hpp"
+#include "syscall.hpp"
+#include "utils.hpp"
+
+
+static uint32_t			kernel_directory[PAGE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+/* The first 4 MB need per page protection: read-only kernel text and
+   rodata, and the .user pages reachable from ring 3. Everything else is
+   mapped with 4 MB pages. */
+static uint32_t			low_table[PAGE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static address_space_t	kernel_address_space = { kernel_directory };
+static address_space_t*	current = NULL;
+static bool				pse = false;
+static bool				pge = false;
+static uint32_t			global_flag = 0;
+
+
+static inline void write_cr3(const uintptr_t value) {
+	__asm__ volatile ("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static bool user_table(const size_t index) {
+	return index >= PAGE_DIRECTORY_INDEX(USER_BASE) && index < PAGE_DIRECTORY_INDEX(USER_END);
+}
+
+static uint32_t low_page_flags(const uintptr_t addr) {
+	if (addr >= (uintptr_t) __text_start && addr < (uintptr_t) __rodata_end) {
+		return PAGE_PRESENT | global_flag;
+	} else if (addr >= (uintptr_t) __user_start && addr < (uintptr_t) __user_end) {
+		return PAGE_PRESENT | PAGE_WRITE | PAGE_USER | global_flag;
+	}
+	return PAGE_PRESENT | PAGE_WRITE | global_flag;
+}
+
+static bool page_fault(exception_frame_t* frame) {
+	uintptr_t addr;
+
+	__asm__ volatile ("mov %%cr2, %0" : "=r"(addr));
+	terminal_printf("page fault at 0x%p: %s on %s", addr,
+		frame->error & PAGE_PRESENT ? "protection violation" : "page not present",
+		frame->error & PAGE_WRITE ? "write" : "read");
+	return false;
+}
+
+/* Identity maps the kernel image and all the memory the bootloader reported
+   (the page allocator hands out physical addresses), marked global so that
+   switching address spaces never evicts them. Must run after init_memory(),
+   the fallback without PSE takes its page tables from the allocator. */
+__init void paging_init(void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	pse = edx & CPUID_PSE;
+	pge = edx & CPUID_PGE;
+	global_flag = pge ? PAGE_GLOBAL : 0;
+
+	for (size_t i = 0; i < PAGE_ENTRIES; ++i) {
+		low_table[i] = (i * PAGE_SIZE) | low_page_flags(i * PAGE_SIZE);
+	}
+	kernel_directory[0] = (uintptr_t) low_table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+
+	uint64_t top = 0;
+
+	for (size_t i = 0; i < boot_memory_region_count(); ++i) {
+		if (boot_memory_region(i)->end > top) {
+			top = boot_memory_region(i)->end;
+		}
+	}
+	for (size_t i = 0; i < boot_module_count(); ++i) {
+		if (boot_module(i)->end > top) {
+			top = boot_module(i)->end;
+		}
+	}
+	if (top > 0x100000000ULL) {
+		top = 0x100000000ULL;
+	}
+
+	for (uint64_t addr = LARGE_PAGE_SIZE; addr < top; addr += LARGE_PAGE_SIZE) {
+		if (!user_table(PAGE_DIRECTORY_INDEX(addr))) {
+			paging_map_large(&kernel_address_space, addr, addr, PAGE_WRITE | global_flag);
+		}
+	}
+
+	exception_register(EXCEPTION_PF, page_fault);
+
+	if (pse || pge) {
+		write_cr4(read_cr4() | (pse ? CR4_PSE : 0) | (pge ? CR4_PGE : 0));
+	}
+	write_cr3((uintptr_t) kernel_directory);
+	// WP: read-only pages are read-only for the kernel too
+	write_cr0(read_cr0() | CR0_PG | CR0_WP);
+	current = &kernel_address_space;
+	klog(KLOG_INFO, "paging: %u MB identity mapped, pse %u, pge %u", (uint32_t) (top >> 20), pse, pge);
+}
+
+address_space_t* kernel_space(void) {
+	return &kernel_address_space;
+}
+
+address_space_t* current_space(void) {
+	return current;
+}
+
+/* New address space with the kernel mappings and an empty user window.
+   Kernel entries are copied, so mappings added to the kernel later only
+   show up in address spaces created after. */
+bool address_space_create(address_space_t* space) {
+	space->directory = reinterpret_cast<uint32_t *>(page_alloc());
+	if (!space->directory) {
+		return false;
+	}
+
+	memcpy(space->directory, kernel_directory, PAGE_SIZE);
+	for (size_t i = PAGE_DIRECTORY_INDEX(USER_BASE); i < PAGE_DIRECTORY_INDEX(USER_END); ++i) {
+		space->directory[i] = 0;
+	}
+	return true;
+}
+
+/* Frees the user page tables and the directory, not the pages they map */
+void address_space_destroy(address_space_t* space) {
+	if (space == current) {
+		address_space_switch(&kernel_address_space);
+	}
+
+	for (size_t i = PAGE_DIRECTORY_INDEX(USER_BASE); i < PAGE_DIRECTORY_INDEX(USER_END); ++i) {
+		const uint32_t entry = space->directory[i];
+
+		if ((entry & PAGE_PRESENT) && !(entry & PAGE_LARGE)) {
+			page_free(reinterpret_cast<void *>(entry & PAGE_FRAME));
+		}
+	}
+	page_free(space->directory);
+	space->directory = NULL;
+}
+
+/* Only the non global user entries leave the TLB */
+__hot void address_space_switch(address_space_t* space) {
+	if (space != current) {
+		current = space;
+		write_cr3((uintptr_t) space->directory);
+	}
+}
+
+bool paging_map(address_space_t* space, const uintptr_t virt, const uintptr_t phys, const uint32_t flags) {
+	uint32_t* const pde = &space->directory[PAGE_DIRECTORY_INDEX(virt)];
+
+	if (!(*pde & PAGE_PRESENT)) {
+		uint32_t* table = reinterpret_cast<uint32_t *>(page_alloc());
+
+		if (!table) {
+			return false;
+		}
+		memset(table, 0, PAGE_SIZE);
+		*pde = (uintptr_t) table | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
+	} else if (*pde & PAGE_LARGE) {
+		return false;
+	}
+
+	uint32_t* const table = reinterpret_cast<uint32_t *>(*pde & PAGE_FRAME);
+
+	table[PAGE_TABLE_INDEX(virt)] = (phys & PAGE_FRAME) | flags | PAGE_PRESENT;
+	if (space == current) {
+		tlb_invalidate_page(virt);
+	}
+	return true;
+}
+
+void paging_unmap(address_space_t* space, const uintptr_t virt) {
+	const uint32_t pde = space->directory[PAGE_DIRECTORY_INDEX(virt)];
+
+	if (!(pde & PAGE_PRESENT)) {
+		return;
+	} else if (pde & PAGE_LARGE) {
+		space->directory[PAGE_DIRECTORY_INDEX(virt)] = 0;
+	} else {
+		reinterpret_cast<uint32_t *>(pde & PAGE_FRAME)[PAGE_TABLE_INDEX(virt)] = 0;
+	}
+	if (space == current) {
+		tlb_invalidate_page(virt);
+	}
+}
+
+bool paging_mapped(const address_space_t* space, const uintptr_t virt) {
+	const uint32_t pde = space->directory[PAGE_DIRECTORY_INDEX(virt)];
+
+	if (!(pde & PAGE_PRESENT)) {
+		return false;
+	} else if (pde & PAGE_LARGE) {
+		return true;
+	}
+	return reinterpret_cast<const uint32_t *>(pde & PAGE_FRAME)[PAGE_TABLE_INDEX(virt)] & PAGE_PRESENT;
+}
+
+/* Maps the 4 MB at virt with a single PSE entry, or a full page table when
+   the CPU has no PSE */
+bool paging_map_large(address_space_t* space, const uintptr_t virt, const uintptr_t phys, const uint32_t flags) {
+	if (!pse) {
+		for (uintptr_t offset = 0; offset < LARGE_PAGE_SIZE; offset += PAGE_SIZE) {
+			if (!paging_map(space, virt + offset, phys + offset, flags)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	space->directory[PAGE_DIRECTORY_INDEX(virt)] = (phys & PAGE_LARGE_FRAME) | flags | PAGE_LARGE | PAGE_PRESENT;
+	if (space == current) {
+		tlb_invalidate_page(virt);
+	}
+	return true;
+}
+
+/* Identity maps device memory [start, end[, like a frame buffer, in the
+   kernel entries with global 4 MB pages. Must run before the address spaces
+   that need it are created. */
+bool paging_map_device(const uintptr_t start, const uintptr_t end) {
+	uintptr_t addr = start & PAGE_LARGE_FRAME;
+
+	while (addr < end) {
+		if (user_table(PAGE_DIRECTORY_INDEX(addr))
+				|| !paging_map_large(&kernel_address_space, addr, addr, PAGE_WRITE | global_flag)) {
+			return false;
+		}
+		if (addr + LARGE_PAGE_SIZE <= addr) {
+			break;
+		}
+		addr += LARGE_PAGE_SIZE;
+	}
+	return true;
+}
+
+/* Sets the memory type bits (PWT/PCD, which select a PAT entry) of the
+   kernel mappings covering [start, end[ */
+void paging_set_cache(const uintptr_t start, const uintptr_t end, const uint32_t cache) {
+	uintptr_t addr = PAGE_ALIGN_DOWN(start);
+
+	while (addr < end) {
+		uint32_t* entry = &kernel_directory[PAGE_DIRECTORY_INDEX(addr)];
+		uintptr_t next = (addr & PAGE_LARGE_FRAME) + LARGE_PAGE_SIZE;
+
+		if ((*entry & PAGE_PRESENT) && !(*entry & PAGE_LARGE)) {
+			entry = &reinterpret_cast<uint32_t *>(*entry & PAGE_FRAME)[PAGE_TABLE_INDEX(addr)];
+			next = addr + PAGE_SIZE;
+		}
+		if (*entry & PAGE_PRESENT) {
+			*entry = (*entry & ~(PAGE_PWT | PAGE_PCD)) | cache;
+			tlb_invalidate_page(addr);
+		}
+		if (next <= addr) {
+			break;
+		}
+		addr = next;
+	}
+}
+
+/* invlpg also drops global entries, a CR3 reload doesn't: large ranges
+   outside the user window need the global flush */
+void tlb_invalidate_range(const uintptr_t start, const uintptr_t end) {
+	const uintptr_t first = PAGE_ALIGN_DOWN(start);
+
+	if ((end - first) / PAGE_SIZE <= TLB_INVALIDATE_MAX) {
+		for (uintptr_t page = first; page < end; page += PAGE_SIZE) {
+			tlb_invalidate_page(page);
+		}
+	} else if (start >= USER_BASE && end <= USER_END) {
+		tlb_flush();
+	} else {
+		tlb_flush_global();
+	}
+}
+
+/* Invalidates everything one page directory entry maps, after its page
+   table was changed or replaced. There is a single CPU, so there is no
+   other TLB to shoot down: an address space that isn't current has no
+   user entries cached. */
+void tlb_invalidate_table(address_space_t* space, const size_t table) {
+	const uintptr_t start = table * LARGE_PAGE_SIZE;
+
+	if (space != current && user_table(table)) {
+		return;
+	} else if (space->directory[table] & PAGE_LARGE) {
+		tlb_invalidate_page(start);
+	} else {
+		tlb_invalidate_range(start, start + LARGE_PAGE_SIZE);
+	}
+}
+
+/* Toggling CR4.PGE is the only way to flush global entries at once */
+void tlb_flush_global(void) {
+	if (pge) {
+		const uint32_t cr4 = read_cr4();
+
+		write_cr4(cr4 & ~CR4_PGE);
+		write_cr4(cr4);
+	} else {
+		tlb_flush();
+	}
+}
+
+void paging_print(void) {
+	size_t large = 0;
+	size_t tables = 0;
+	size_t read_only = 0;
+	size_t user = 0;
+
+	for (size_t i = 0; i < PAGE_ENTRIES; ++i) {
+		const uint32_t entry = current->directory[i];
+
+		if (!(entry & PAGE_PRESENT)) {
+			continue;
+		} else if (entry & PAGE_LARGE) {
+			++large;
+		} else {
+			++tables;
+		}
+	}
+	for (size_t i = 0; i < PAGE_ENTRIES; ++i) {
+		read_only += !(low_table[i] & PAGE_WRITE);
+		user += (low_table[i] & PAGE_USER) != 0;
+	}
+
+	terminal_printf("PSE %s  PGE %s  directory 0x%p%s", pse ? "on" : "off", pge ? "on" : "off",
+		current->directory, current == &kernel_address_space ? " (kernel)" : "");
+	terminal_printf("%u large pages (%u MB), %u page tables", (uint32_t) large, (uint32_t) large * 4, (uint32_t) tables);
+	terminal_printf("first 4 MB: %u read-only pages, %u user pages", (uint32_t) read_only, (uint32_t) user);
+}
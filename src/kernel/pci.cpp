@@ -0,0 +1,251 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "klog.hpp"
+#include "pci.hpp"
+#include "utils.hpp"
+
+
+static pci_device_t	devices[PCI_MAX_DEVICES];
+static size_t		device_count = 0;
+
+static const char* const	class_names[PCI_CLASS_NAMES] = {
+	"unclassified", "storage", "network", "display", "multimedia", "memory", "bridge",
+	"communication", "system", "input", "docking", "processor", "serial bus",
+};
+
+static inline uint32_t pci_config_address(const pci_address_t address, const uint8_t offset) {
+	return 0x80000000 | ((uint32_t) address.bus << 16) | ((uint32_t) address.device << 11)
+		| ((uint32_t) address.function << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read32(const pci_address_t address, const uint8_t offset) {
+	outl(PCI_CONFIG_ADDRESS, pci_config_address(address, offset));
+	return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_config_read16(const pci_address_t address, const uint8_t offset) {
+	outl(PCI_CONFIG_ADDRESS, pci_config_address(address, offset));
+	return inw(PCI_CONFIG_DATA + (offset & 2));
+}
+
+uint8_t pci_config_read8(const pci_address_t address, const uint8_t offset) {
+	return pci_config_read32(address, offset) >> ((offset & 3) * 8);
+}
+
+void pci_config_write32(const pci_address_t address, const uint8_t offset, const uint32_t value) {
+	outl(PCI_CONFIG_ADDRESS, pci_config_address(address, offset));
+	outl(PCI_CONFIG_DATA, value);
+}
+
+/* A real 16-bit access: writing the dword back would clear the status bits
+   next to the command register, which a write of 1 acknowledges */
+void pci_config_write16(const pci_address_t address, const uint8_t offset, const uint16_t value) {
+	outl(PCI_CONFIG_ADDRESS, pci_config_address(address, offset));
+	outw(PCI_CONFIG_DATA + (offset & 2), value);
+}
+
+/* Sizes the BAR at index by writing all ones and reading back which
+   address bits are hardwired to 0. Decoding is off meanwhile. Returns the
+   number of slots it takes. */
+static size_t pci_bar_probe(const pci_address_t address, const size_t index, pci_bar_t* bar) {
+	const uint8_t offset = PCI_BAR0 + index * 4;
+	const uint32_t low = pci_config_read32(address, offset);
+
+	pci_config_write32(address, offset, 0xFFFFFFFF);
+	const uint32_t low_mask = pci_config_read32(address, offset);
+	pci_config_write32(address, offset, low);
+
+	if (low & PCI_BAR_IO) {
+		bar->flags = PCI_BAR_IO;
+		bar->base = low & PCI_BAR_IO_MASK;
+		bar->size = (uint16_t) (~(low_mask & PCI_BAR_IO_MASK) + 1);
+		return 1;
+	}
+
+	uint64_t mask = low_mask & PCI_BAR_MEMORY_MASK;
+
+	bar->flags = low & (PCI_BAR_TYPE_MASK | PCI_BAR_PREFETCH);
+	bar->base = low & PCI_BAR_MEMORY_MASK;
+	if ((low & PCI_BAR_TYPE_MASK) != PCI_BAR_TYPE_64 || index + 1 == PCI_BARS) {
+		bar->size = mask ? (uint32_t) (~(uint32_t) mask + 1) : 0;
+		return 1;
+	}
+
+	const uint32_t high = pci_config_read32(address, offset + 4);
+
+	pci_config_write32(address, offset + 4, 0xFFFFFFFF);
+	mask |= (uint64_t) pci_config_read32(address, offset + 4) << 32;
+	pci_config_write32(address, offset + 4, high);
+
+	bar->base |= (uint64_t) high << 32;
+	bar->size = mask ? ~mask + 1 : 0;
+	return 2;
+}
+
+static void pci_add(const pci_address_t address) {
+	if (device_count == PCI_MAX_DEVICES) {
+		klog(KLOG_WARN, "pci: %u:%u.%u ignored, table full", address.bus, address.device, address.function);
+		return;
+	}
+
+	pci_device_t* const device = &devices[device_count++];
+	const uint8_t header = pci_config_read8(address, PCI_HEADER_TYPE) & PCI_HEADER_MASK;
+
+	memset(device, 0, sizeof(*device));
+	device->address = address;
+	device->vendor_id = pci_config_read16(address, PCI_VENDOR_ID);
+	device->device_id = pci_config_read16(address, PCI_DEVICE_ID);
+	device->class_code = pci_config_read8(address, PCI_CLASS);
+	device->subclass = pci_config_read8(address, PCI_SUBCLASS);
+	device->prog_if = pci_config_read8(address, PCI_PROG_IF);
+	device->revision = pci_config_read8(address, PCI_REVISION);
+	device->header_type = header;
+	device->irq = pci_config_read8(address, PCI_INTERRUPT_LINE);
+
+	// Bridges have two BARs, CardBus bridges none that matter here
+	const size_t bar_count = header == 0 ? PCI_BARS : (header == PCI_HEADER_BRIDGE ? PCI_BRIDGE_BARS : 0);
+	const uint16_t command = pci_config_read16(address, PCI_COMMAND);
+
+	pci_config_write16(address, PCI_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+	for (size_t i = 0; i < bar_count;) {
+		i += pci_bar_probe(address, i, &device->bars[i]);
+	}
+	pci_config_write16(address, PCI_COMMAND, command);
+
+	if (!(pci_config_read16(address, PCI_STATUS) & PCI_STATUS_CAPABILITIES)) {
+		return;
+	}
+	// The list is bounded: a broken one could loop
+	for (uint8_t offset = pci_config_read8(address, PCI_CAPABILITIES) & 0xFC;
+			offset && device->capability_count < PCI_MAX_CAPABILITIES;
+			offset = pci_config_read8(address, offset + 1) & 0xFC) {
+		device->capabilities[device->capability_count][0] = pci_config_read8(address, offset);
+		device->capabilities[device->capability_count][1] = offset;
+		++device->capability_count;
+	}
+}
+
+/* Scans every bus once, with mechanism #1 */
+__init void pci_init(void) {
+	for (uint16_t bus = 0; bus < PCI_MAX_BUS; ++bus) {
+		for (uint8_t device = 0; device < PCI_MAX_DEVICE; ++device) {
+			for (uint8_t function = 0; function < PCI_MAX_FUNCTION; ++function) {
+				const pci_address_t address = { (uint8_t) bus, device, function };
+
+				if (pci_config_read16(address, PCI_VENDOR_ID) == 0xFFFF) {
+					if (!function) {
+						break;
+					}
+					continue;
+				}
+
+				pci_add(address);
+
+				if (!function && !(pci_config_read8(address, PCI_HEADER_TYPE) & PCI_HEADER_MULTIFUNCTION)) {
+					break;
+				}
+			}
+		}
+	}
+	klog(KLOG_INFO, "pci: %u functions", device_count);
+}
+
+/* after is the previous match, or NULL to start from the first device */
+pci_device_t* pci_find_class(const uint8_t class_code, const uint8_t subclass, const pci_device_t* after) {
+	for (size_t i = after ? after - devices + 1 : 0; i < device_count; ++i) {
+		if (devices[i].class_code == class_code && devices[i].subclass == subclass) {
+			return &devices[i];
+		}
+	}
+	return NULL;
+}
+
+pci_device_t* pci_find_device(const uint16_t vendor_id, const uint16_t device_id, const pci_device_t* after) {
+	for (size_t i = after ? after - devices + 1 : 0; i < device_count; ++i) {
+		if (devices[i].vendor_id == vendor_id && devices[i].device_id == device_id) {
+			return &devices[i];
+		}
+	}
+	return NULL;
+}
+
+/* Offset of the next capability with this id after the one at offset after
+   (0 for the first), 0 if there's none */
+uint8_t pci_find_capability(const pci_device_t* device, const uint8_t id, const uint8_t after) {
+	for (size_t i = 0; i < device->capability_count; ++i) {
+		if (device->capabilities[i][0] == id && device->capabilities[i][1] > after) {
+			return device->capabilities[i][1];
+		}
+	}
+	return 0;
+}
+
+void pci_enable(const pci_device_t* device, const uint16_t command) {
+	pci_config_write16(device->address, PCI_COMMAND, pci_config_read16(device->address, PCI_COMMAND) | command);
+}
+
+/* Gives the device a vector of its own, with a single message, and turns
+   its legacy interrupt line off. False when it has no MSI capability or no
+   vector is left, in which case it keeps using device->irq. */
+bool pci_msi_enable(pci_device_t* device, const irq_handler_t handler) {
+	const uint8_t msi = pci_find_capability(device, PCI_CAP_MSI, 0);
+
+	if (!msi || device->msi_vector) {
+		return device->msi_vector != 0;
+	}
+
+	const uint8_t vector = msi_register(handler);
+
+	if (!vector) {
+		return false;
+	}
+
+	const pci_address_t address = device->address;
+	const uint16_t control = pci_config_read16(address, msi + PCI_MSI_CONTROL);
+
+	pci_config_write32(address, msi + PCI_MSI_ADDRESS, msi_address());
+	if (control & PCI_MSI_64) {
+		pci_config_write32(address, msi + PCI_MSI_ADDRESS + 4, 0);
+		pci_config_write16(address, msi + PCI_MSI_DATA_64, vector);
+	} else {
+		pci_config_write16(address, msi + PCI_MSI_DATA_32, vector);
+	}
+	pci_config_write16(address, msi + PCI_MSI_CONTROL, (control & ~PCI_MSI_MULTIPLE_MASK) | PCI_MSI_ENABLE);
+	pci_enable(device, PCI_COMMAND_INTX_DISABLE);
+	device->msi_vector = vector;
+	return true;
+}
+
+/* One line per function, then one per BAR */
+void pci_print(void) {
+	for (size_t i = 0; i < device_count; ++i) {
+		const pci_device_t* const device = &devices[i];
+		char caps[3 * PCI_MAX_CAPABILITIES + 1];
+		size_t len = 0;
+
+		caps[0] = '\0';
+		for (size_t cap = 0; cap < device->capability_count; ++cap) {
+			len += ksnprintf(caps + len, sizeof(caps) - len, " %02x", device->capabilities[cap][0]);
+		}
+		terminal_printf("%02x:%02x.%u %04x:%04x %s %02x.%02x.%02x %s %u caps%s",
+			device->address.bus, device->address.device, device->address.function,
+			device->vendor_id, device->device_id,
+			device->class_code < PCI_CLASS_NAMES ? class_names[device->class_code] : "other",
+			device->class_code, device->subclass, device->prog_if,
+			device->msi_vector ? "msi" : "irq", device->msi_vector ? device->msi_vector : device->irq, caps);
+
+		for (size_t bar = 0; bar < PCI_BARS; ++bar) {
+			const pci_bar_t* const b = &device->bars[bar];
+
+			if (!b->size) {
+				continue;
+			} else if (b->flags & PCI_BAR_IO) {
+				terminal_printf("  bar%u io  0x%04x size 0x%x", bar, (uint32_t) b->base, (uint32_t) b->size);
+			} else {
+				terminal_printf("  bar%u mem 0x%08x%08x size 0x%x%s%s", bar, (uint32_t) (b->base >> 32),
+					(uint32_t) b->base, (uint32_t) b->size, b->flags & PCI_BAR_TYPE_64 ? " 64-bit" : "",
+					b->flags & PCI_BAR_PREFETCH ? " prefetchable" : "");
+			}
+		}
+	}
+}
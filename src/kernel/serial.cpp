@@ -0,0 +1,91 @@
+#include "kernel.hpp"
+#include "klog.hpp"
+#include "serial.hpp"
+#include "utils.hpp"
+
+
+static bool				serial_present = false;
+static klog_reader_t	serial_reader;
+/* The record being sent, and how much of it already went out */
+static char				serial_line[KLOG_TEXT_SIZE + 32];
+static size_t			serial_len = 0;
+static size_t			serial_sent = 0;
+
+
+/* 115200 8N1 on COM1, if a UART echoes a byte back in loopback mode */
+__init void serial_init(void) {
+	const uint16_t divisor = 115200 / SERIAL_BAUD;
+
+	outb(SERIAL_COM1 + SERIAL_IER, 0x00);
+	outb(SERIAL_COM1 + SERIAL_LCR, SERIAL_LCR_DLAB);
+	outb(SERIAL_COM1 + SERIAL_DIVISOR_LOW, divisor & 0xFF);
+	outb(SERIAL_COM1 + SERIAL_DIVISOR_HIGH, divisor >> 8);
+	outb(SERIAL_COM1 + SERIAL_LCR, SERIAL_LCR_8N1);
+	outb(SERIAL_COM1 + SERIAL_FCR, SERIAL_FCR_ENABLE);
+	outb(SERIAL_COM1 + SERIAL_MCR, SERIAL_MCR_LOOP);
+	outb(SERIAL_COM1 + SERIAL_DATA, SERIAL_PROBE_BYTE);
+	if (inb(SERIAL_COM1 + SERIAL_DATA) != SERIAL_PROBE_BYTE) {
+		klog(KLOG_WARN, "serial: no UART at 0x%x", SERIAL_COM1);
+		return;
+	}
+	outb(SERIAL_COM1 + SERIAL_MCR, SERIAL_MCR_NORMAL);
+
+	// Everything logged since boot goes out first
+	klog_reader_init(&serial_reader, true);
+	serial_present = true;
+	klog(KLOG_INFO, "serial: COM1 at %u baud", SERIAL_BAUD);
+}
+
+/* Called from the idle loop: sends what the transmit FIFO takes without
+   waiting, and keeps the rest of the line for the next call. Returns false
+   once everything logged went out. */
+bool serial_poll(void) {
+	if (!serial_present) {
+		return false;
+	}
+	while (inb(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_THRE) {
+		if (serial_sent == serial_len) {
+			const uint32_t lost = serial_reader.lost;
+			klog_record_t record;
+
+			if (!klog_read(&serial_reader, &record)) {
+				return false;
+			}
+			serial_sent = 0;
+			serial_len = 0;
+			if (serial_reader.lost != lost) {
+				serial_len = ksnprintf(serial_line, sizeof(serial_line), "[%u records lost]\r\n",
+					serial_reader.lost - lost);
+			}
+			serial_len += klog_format(&record, serial_line + serial_len, sizeof(serial_line) - serial_len - 2);
+			serial_line[serial_len++] = '\r';
+			serial_line[serial_len++] = '\n';
+		}
+		for (size_t i = 0; i < SERIAL_FIFO_SIZE && serial_sent < serial_len; ++i) {
+			outb(SERIAL_COM1 + SERIAL_DATA, serial_line[serial_sent++]);
+		}
+	}
+	return true;
+}
+
+/* Spins until the log is out, for a panic that stops the kernel right after */
+void serial_flush(void) {
+	while (serial_poll()) {
+	}
+}
+
+/* Raw output, for dumps too large for log records. The log line being sent
+   is finished first, so that they don't mix. */
+void serial_write(const char* data, const size_t len) {
+	if (!serial_present) {
+		return;
+	}
+	serial_flush();
+	for (size_t sent = 0; sent < len;) {
+		while (!(inb(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_THRE)) {
+		}
+		for (size_t i = 0; i < SERIAL_FIFO_SIZE && sent < len; ++i) {
+			outb(SERIAL_COM1 + SERIAL_DATA, data[sent++]);
+		}
+	}
+}
@@ -0,0 +1,261 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "fpu.hpp"
+#include "klog.hpp"
+#include "simd.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+
+/* 16 copies of the same byte pattern, loaded at once in an XMM register */
+typedef struct alignas(16) Pattern {
+	uint8_t	bytes[16];
+} pattern_t;
+
+alignas(16) static uint8_t	bench_src[SIMD_BENCH_SIZE];
+alignas(16) static uint8_t	bench_dest[SIMD_BENCH_SIZE];
+
+
+static void* memcpy_scalar(void* dest, const void* src, size_t n) {
+	return memcpy_rep(dest, src, n);
+}
+
+static void* memset_scalar(void* dest, int value, size_t n) {
+	return memset_rep(dest, value, n);
+}
+
+static const void* memchr_scalar(const void* ptr, int value, size_t n) {
+	const uint8_t* p = (const uint8_t*) ptr;
+
+	for (; n; --n, ++p) {
+		if (*p == (uint8_t) value) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static void fill16_scalar(uint16_t* dest, const uint16_t value, size_t count) {
+	fill16_rep(dest, value, count);
+}
+
+/* The asm below lists no XMM clobbers: the kernel is built with -mno-sse
+   (see CXXFLAGS), so the compiler never keeps anything in those registers.
+   Every SSE instruction runs between fpu_kernel_begin() and fpu_kernel_end().
+   The _sse2 variants are only reached for sizes of at least SIMD_MIN_SIZE. */
+
+/* Forward copy, so memmove() may use it when dest is below src */
+static void* memcpy_sse2(void* dest, const void* src, size_t n) {
+	uint8_t*		d = (uint8_t*) dest;
+	const uint8_t*	s = (const uint8_t*) src;
+	const size_t	head = -(uintptr_t) d & 15;
+
+	memcpy_rep(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+
+	size_t blocks = n / 64;
+
+	if (blocks) {
+		const uint32_t flags = fpu_kernel_begin();
+
+		// Loads are unaligned, stores aligned, 64 bytes per iteration
+		__asm__ volatile (
+			"1:\n\t"
+			"movdqu (%1), %%xmm0\n\t"
+			"movdqu 16(%1), %%xmm1\n\t"
+			"movdqu 32(%1), %%xmm2\n\t"
+			"movdqu 48(%1), %%xmm3\n\t"
+			"movdqa %%xmm0, (%0)\n\t"
+			"movdqa %%xmm1, 16(%0)\n\t"
+			"movdqa %%xmm2, 32(%0)\n\t"
+			"movdqa %%xmm3, 48(%0)\n\t"
+			"add $64, %1\n\t"
+			"add $64, %0\n\t"
+			"dec %2\n\t"
+			"jnz 1b"
+			: "+r"(d), "+r"(s), "+r"(blocks) : : "memory", "cc");
+		fpu_kernel_end(flags);
+	}
+	memcpy_rep(d, s, n & 63);
+	return dest;
+}
+
+/* Stores pattern from the 16-byte aligned dest, 64 bytes at a time */
+static void store_sse2(uint8_t* dest, const pattern_t* pattern, size_t blocks) {
+	const uint32_t flags = fpu_kernel_begin();
+
+	__asm__ volatile (
+		"movdqa %2, %%xmm0\n"
+		"1:\n\t"
+		"movdqa %%xmm0, (%0)\n\t"
+		"movdqa %%xmm0, 16(%0)\n\t"
+		"movdqa %%xmm0, 32(%0)\n\t"
+		"movdqa %%xmm0, 48(%0)\n\t"
+		"add $64, %0\n\t"
+		"dec %1\n\t"
+		"jnz 1b"
+		: "+r"(dest), "+r"(blocks) : "m"(*pattern) : "memory", "cc");
+	fpu_kernel_end(flags);
+}
+
+static void* memset_sse2(void* dest, int value, size_t n) {
+	uint8_t*		d = (uint8_t*) dest;
+	const size_t	head = -(uintptr_t) d & 15;
+	pattern_t		pattern;
+
+	memset_rep(d, value, head);
+	d += head;
+	n -= head;
+
+	if (n / 64) {
+		memset_rep(pattern.bytes, value, sizeof(pattern.bytes));
+		store_sse2(d, &pattern, n / 64);
+		d += n & ~(size_t) 63;
+	}
+	memset_rep(d, value, n & 63);
+	return dest;
+}
+
+/* 16-bit cells, like VGA entries: a screen clear */
+static void fill16_sse2(uint16_t* dest, const uint16_t value, size_t count) {
+	if ((uintptr_t) dest & 1) {
+		fill16_rep(dest, value, count);
+		return;
+	}
+
+	const size_t	head = (-(uintptr_t) dest & 15) / 2;
+	pattern_t		pattern;
+
+	fill16_rep(dest, value, head);
+	dest += head;
+	count -= head;
+
+	if (count / 32) {
+		fill16_rep((uint16_t*) pattern.bytes, value, sizeof(pattern.bytes) / 2);
+		store_sse2((uint8_t*) dest, &pattern, count / 32);
+		dest += count & ~(size_t) 31;
+	}
+	fill16_rep(dest, value, count & 31);
+}
+
+/* 16 bytes compared at once, the byte mask tells where the match is */
+static const void* memchr_sse2(const void* ptr, int value, size_t n) {
+	const uint8_t*	p = (const uint8_t*) ptr;
+	const uint8_t*	found = NULL;
+	pattern_t		pattern;
+
+	memset_rep(pattern.bytes, value, sizeof(pattern.bytes));
+
+	const uint32_t flags = fpu_kernel_begin();
+
+	__asm__ volatile ("movdqa %0, %%xmm1" : : "m"(pattern));
+	for (; n >= 16; p += 16, n -= 16) {
+		uint32_t mask;
+
+		__asm__ volatile (
+			"movdqu (%1), %%xmm0\n\t"
+			"pcmpeqb %%xmm1, %%xmm0\n\t"
+			"pmovmskb %%xmm0, %0"
+			: "=r"(mask) : "r"(p) : "memory");
+		if (mask) {
+			found = p + __builtin_ctz(mask);
+			break;
+		}
+	}
+	fpu_kernel_end(flags);
+
+	if (found) {
+		return found;
+	}
+	return memchr_scalar(p, value, n);
+}
+
+void*				(*memcpy_large)(void* dest, const void* src, size_t n) = memcpy_scalar;
+void*				(*memset_large)(void* dest, int value, size_t n) = memset_scalar;
+static const void*	(*memchr_large)(const void* ptr, int value, size_t n) = memchr_scalar;
+static void			(*fill16_large)(uint16_t* dest, const uint16_t value, size_t count) = fill16_scalar;
+static const char*	simd_name = "rep";
+
+
+extern "C" void* memchr(const void* ptr, int value, size_t n) {
+	if (n >= SIMD_MIN_SIZE) {
+		return const_cast<void *>(memchr_large(ptr, value, n));
+	}
+	return const_cast<void *>(memchr_scalar(ptr, value, n));
+}
+
+void fill16(uint16_t* dest, const uint16_t value, const size_t count) {
+	if (count * sizeof(uint16_t) >= SIMD_MIN_SIZE) {
+		fill16_large(dest, value, count);
+	} else {
+		fill16_rep(dest, value, count);
+	}
+}
+
+/* Must run after fpu_init() */
+__init void simd_init(void) {
+	if (fpu_has_sse2()) {
+		memcpy_large = memcpy_sse2;
+		memset_large = memset_sse2;
+		memchr_large = memchr_sse2;
+		fill16_large = fill16_sse2;
+		simd_name = "SSE2";
+	}
+	klog(KLOG_INFO, "simd: %s memory primitives", simd_name);
+}
+
+static uint32_t bench_rate(const uint64_t cycles) {
+	const uint64_t ns = tsc_to_ns(cycles);
+
+	return ns ? (uint64_t) SIMD_BENCH_SIZE * SIMD_BENCH_ROUNDS * 1000 / ns : 0;
+}
+
+static uint64_t bench_copy(void* (*copy)(void*, const void*, size_t)) {
+	const uint64_t start = rdtsc();
+
+	for (size_t i = 0; i < SIMD_BENCH_ROUNDS; ++i) {
+		copy(bench_dest, bench_src, SIMD_BENCH_SIZE);
+	}
+	return rdtsc() - start;
+}
+
+static uint64_t bench_set(void* (*set)(void*, int, size_t)) {
+	const uint64_t start = rdtsc();
+
+	for (size_t i = 0; i < SIMD_BENCH_ROUNDS; ++i) {
+		set(bench_dest, i, SIMD_BENCH_SIZE);
+	}
+	return rdtsc() - start;
+}
+
+static uint64_t bench_fill16(void (*fill)(uint16_t*, const uint16_t, size_t)) {
+	const uint64_t start = rdtsc();
+
+	for (size_t i = 0; i < SIMD_BENCH_ROUNDS; ++i) {
+		fill((uint16_t*) bench_dest, i, SIMD_BENCH_SIZE / 2);
+	}
+	return rdtsc() - start;
+}
+
+static uint64_t bench_chr(const void* (*chr)(const void*, int, size_t)) {
+	const uint64_t start = rdtsc();
+
+	// The byte searched for is never there: the whole buffer is scanned
+	for (size_t i = 0; i < SIMD_BENCH_ROUNDS; ++i) {
+		chr(bench_src, 0xFF, SIMD_BENCH_SIZE);
+	}
+	return rdtsc() - start;
+}
+
+/* Throughput of the generic and the dispatched primitives on 64 KB */
+void simd_bench(void) {
+	memset_rep(bench_src, 0x5A, sizeof(bench_src));
+
+	terminal_printf("%u KB buffers, %u rounds, MB/s      rep  %s", SIMD_BENCH_SIZE / 1024, SIMD_BENCH_ROUNDS, simd_name);
+	terminal_printf("memcpy  %8u  %8u", bench_rate(bench_copy(memcpy_scalar)), bench_rate(bench_copy(memcpy_large)));
+	terminal_printf("memset  %8u  %8u", bench_rate(bench_set(memset_scalar)), bench_rate(bench_set(memset_large)));
+	terminal_printf("fill16  %8u  %8u", bench_rate(bench_fill16(fill16_scalar)), bench_rate(bench_fill16(fill16_large)));
+	terminal_printf("memchr  %8u  %8u", bench_rate(bench_chr(memchr_scalar)), bench_rate(bench_chr(memchr_large)));
+}
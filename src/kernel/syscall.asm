@@ -0,0 +1,101 @@
+section .text
+bits 32
+
+extern syscall_dispatch
+
+global user_enter
+global user_return
+global sysenter_entry
+global syscall_int80_entry
+
+; Must match kernel.hpp
+KERNEL_DATA     equ 0x10        ; GDT_DATA_SEGMENT
+USER_CODE       equ 0x4B        ; GDT_USER_CODE
+USER_DATA       equ 0x53        ; GDT_USER_DATA
+EFLAGS_IF       equ 0x200
+EFLAGS_IOPL     equ 0x3000
+
+; int user_enter(uint32_t eip, uint32_t esp)
+; Runs eip in ring 3 on the stack esp, and returns the status later given
+; to user_return()
+user_enter:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    pushfd
+    mov [kernel_esp], esp
+    mov eax, [esp + 24]         ; eip
+    mov ecx, [esp + 28]         ; esp
+    mov dx, USER_DATA
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+    push dword USER_DATA        ; ss
+    push ecx                    ; esp
+    pushfd
+    or dword [esp], EFLAGS_IF
+    and dword [esp], ~EFLAGS_IOPL
+    push dword USER_CODE        ; cs
+    push eax                    ; eip
+    ; Don't leak kernel values to ring 3
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    iretd
+
+; void user_return(int status)
+; Leaves ring 3 for good: drops the syscall stack and returns status from
+; user_enter()
+user_return:
+    mov eax, [esp + 4]
+    mov esp, [kernel_esp]
+    mov dx, KERNEL_DATA
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+    popfd
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; SYSENTER lands here on the syscall stack with interrupts disabled, the
+; user stack in ecx and the return address in edx
+sysenter_entry:
+    cld
+    push ecx
+    push edx
+    push edi
+    push esi
+    push ebx
+    push eax
+    call syscall_dispatch
+    add esp, 16
+    pop edx
+    pop ecx
+    sti                         ; only effective after sysexit, still on the user stack
+    sysexit
+
+; int 0x80, through an interrupt gate: same convention as sysenter_entry
+syscall_int80_entry:
+    cld
+    push edi
+    push esi
+    push ebx
+    push eax
+    call syscall_dispatch
+    add esp, 16
+    iretd
+
+section .bss
+align 4
+kernel_esp:
+    resd 1
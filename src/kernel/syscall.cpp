@@ -0,0 +1,264 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "elf.hpp"
+#include "fpu.hpp"
+#include "initrd.hpp"
+#include "paging.hpp"
+#include "syscall.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+
+typedef uint32_t (*syscall_t)(const uint32_t arg1, const uint32_t arg2, const uint32_t arg3);
+
+typedef struct SyscallBench {
+	uint64_t	sysenter;
+	uint64_t	int80;
+} syscall_bench_t;
+
+/* Ring 0 stack for everything that interrupts ring 3: SYSENTER, int 0x80,
+   IRQs and exceptions */
+static uint8_t	syscall_stack[SYSCALL_STACK_SIZE] __attribute__((aligned(16)));
+static bool		sysenter_supported = false;
+static bool		running = false;
+static address_space_t	user_space;
+static fpu_context_t	user_fpu;
+/* Output of the running program, printed one line at a time */
+static char		output[VGA_WIDTH + 1];
+static size_t	output_len = 0;
+
+static __userdata syscall_bench_t	bench;
+
+
+static void output_flush(void) {
+	if (output_len) {
+		output[output_len] = '\0';
+		terminal_print_line(output);
+		output_len = 0;
+	}
+}
+
+static bool user_range(const uint32_t addr, const uint32_t size) {
+	return addr >= USER_BASE && addr <= USER_END && size <= USER_END - addr;
+}
+
+static uint32_t sys_null(const uint32_t, const uint32_t, const uint32_t) {
+	return 0;
+}
+
+static uint32_t sys_exit(const uint32_t status, const uint32_t, const uint32_t) {
+	user_kill(status);
+}
+
+static uint32_t sys_write(const uint32_t buf, const uint32_t len, const uint32_t) {
+	if (!user_range(buf, len)) {
+		return SYSCALL_ERROR;
+	}
+
+	const char* str = (const char *) buf;
+
+	for (uint32_t i = 0; i < len; ++i) {
+		if (str[i] != '\n') {
+			output[output_len++] = str[i];
+		}
+		if (str[i] == '\n' || output_len == VGA_WIDTH) {
+			output_flush();
+		}
+	}
+	return len;
+}
+
+static const syscall_t	syscall_table[SYS_COUNT] = {
+	sys_null,
+	sys_exit,
+	sys_write,
+};
+
+/* Called by sysenter_entry and syscall_int80_entry in syscall.asm, with
+   interrupts disabled */
+extern "C" __hot uint32_t syscall_dispatch(const uint32_t number, const uint32_t arg1, const uint32_t arg2, const uint32_t arg3) {
+	if (number >= SYS_COUNT) {
+		return SYSCALL_ERROR;
+	}
+	return syscall_table[number](arg1, arg2, arg3);
+}
+
+static bool cpu_has_sysenter(void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	if (eax < 1) {
+		return false;
+	}
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+
+	// The Pentium Pro reports SEP without implementing it
+	const uint32_t family = (eax >> 8) & 0xF;
+	const uint32_t model = (eax >> 4) & 0xF;
+	const uint32_t stepping = eax & 0xF;
+
+	if (family == 6 && model < 3 && stepping < 3) {
+		return false;
+	}
+	return edx & CPUID_SEP;
+}
+
+/* Must run after init_gdt() and initialize_idt() */
+__init void syscall_init(void) {
+	tss.esp0 = (uint32_t) (syscall_stack + SYSCALL_STACK_SIZE);
+	set_idt_entry(SYSCALL_VECTOR, syscall_int80_entry, TYPE_INTERRUPT_GATE | DPL_USER | P_PRESENT);
+
+	sysenter_supported = cpu_has_sysenter();
+	if (sysenter_supported) {
+		wrmsr(MSR_SYSENTER_CS, GDT_SYSENTER_CODE);
+		wrmsr(MSR_SYSENTER_ESP, tss.esp0);
+		wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+	}
+}
+
+bool user_running(void) {
+	return running;
+}
+
+/* Ends the running program, from a syscall or an exception in ring 3 */
+void user_kill(const int status) {
+	output_flush();
+	running = false;
+	user_return(status);
+}
+
+/* Address space of the program about to run: the kernel, not reachable from
+   ring 3, plus the user window. Becomes the current one. */
+static bool user_space_create(void) {
+	if (!address_space_create(&user_space)) {
+		return false;
+	}
+
+	for (uintptr_t addr = USER_BASE; addr < USER_END; addr += LARGE_PAGE_SIZE) {
+		if (!paging_map_large(&user_space, addr, addr, PAGE_WRITE | PAGE_USER)) {
+			address_space_destroy(&user_space);
+			return false;
+		}
+	}
+	address_space_switch(&user_space);
+	return true;
+}
+
+static void user_space_destroy(void) {
+	address_space_switch(kernel_space());
+	address_space_destroy(&user_space);
+}
+
+/* Runs entry in ring 3 until it exits. The entry point is called like a
+   function taking the USER_FLAG_* flags, with no return address. */
+static int user_run(const uint32_t entry) {
+	uint32_t* stack = (uint32_t *) USER_STACK_TOP;
+
+	*--stack = sysenter_supported ? USER_FLAG_SYSENTER : 0;
+	*--stack = 0;
+
+	output_len = 0;
+	running = true;
+	fpu_context_init(&user_fpu);
+	fpu_switch(&user_fpu);
+
+	const int status = user_enter(entry, (uint32_t) stack);
+
+	fpu_switch(NULL);
+	fpu_release(&user_fpu);
+	return status;
+}
+
+int user_exec(const char* path) {
+	const initrd_file_t* file = initrd_lookup(path);
+	uint32_t entry;
+
+	if (!file || file->directory) {
+		terminal_printf("exec: %s: no such file", path);
+		return -1;
+	}
+
+	if (!user_space_create()) {
+		terminal_printf("exec: %s: out of memory", path);
+		return -1;
+	}
+
+	const char* error = elf_load(file->data, file->size, USER_BASE, USER_END - USER_STACK_SIZE, &entry);
+
+	if (error) {
+		user_space_destroy();
+		terminal_printf("exec: %s: %s", path, error);
+		return -1;
+	}
+
+	const int status = user_run(entry);
+
+	user_space_destroy();
+
+	terminal_printf("exec: %s exited with status %d", path, status);
+	return status;
+}
+
+/* Ring 3 side of syscallbench: only touches .user.data and its stack */
+__user static void syscall_bench_user(const uint32_t flags) {
+	if (flags & USER_FLAG_SYSENTER) {
+		for (uint32_t i = 0; i < SYSCALL_BENCH_WARMUP; ++i) {
+			syscall_sysenter(SYS_NULL);
+		}
+
+		const uint64_t start = rdtsc();
+
+		for (uint32_t i = 0; i < SYSCALL_BENCH_ITERATIONS; ++i) {
+			syscall_sysenter(SYS_NULL);
+		}
+		bench.sysenter = rdtsc() - start;
+	}
+
+	for (uint32_t i = 0; i < SYSCALL_BENCH_WARMUP; ++i) {
+		syscall_int80(SYS_NULL);
+	}
+
+	const uint64_t start = rdtsc();
+
+	for (uint32_t i = 0; i < SYSCALL_BENCH_ITERATIONS; ++i) {
+		syscall_int80(SYS_NULL);
+	}
+	bench.int80 = rdtsc() - start;
+
+	syscall_int80(SYS_EXIT, 0);
+	for (;;) {
+	}
+}
+
+static void print_bench(const char* name, const uint64_t cycles) {
+	terminal_printf("%s  %u cycles  %u ns", name,
+		(uint32_t) (cycles / SYSCALL_BENCH_ITERATIONS), (uint32_t) (tsc_to_ns(cycles) / SYSCALL_BENCH_ITERATIONS));
+}
+
+/* Null system call round trip from ring 3, on both entry paths */
+void syscall_bench(void) {
+	bench.sysenter = 0;
+	bench.int80 = 0;
+
+	if (!user_space_create()) {
+		terminal_printf("syscallbench: out of memory");
+		return;
+	}
+
+	const int status = user_run((uint32_t) syscall_bench_user);
+
+	user_space_destroy();
+
+	if (status) {
+		terminal_printf("syscallbench: failed with status %d", status);
+		return;
+	}
+
+	terminal_printf("null syscall round trip, %u calls", SYSCALL_BENCH_ITERATIONS);
+	if (sysenter_supported) {
+		print_bench("sysenter/sysexit", bench.sysenter);
+	} else {
+		terminal_printf("sysenter/sysexit  not supported by this CPU");
+	}
+	print_bench("int 0x80/iret   ", bench.int80);
+}
@@ -0,0 +1,70 @@
+#include "kernel.hpp"
+#include "console.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+
+uint32_t			tsc_khz = 1000000;	// assume 1 GHz until calibrated
+volatile uint32_t	timer_ticks = 0;
+
+
+/* Measures the TSC frequency against a one-shot count of the PIT channel 2,
+   whose output can be polled through port 0x61 without any interrupt */
+__init void tsc_calibrate(void) {
+	const uint16_t count = PIT_FREQUENCY * TSC_CALIBRATION_MS / 1000;
+	const uint8_t gate = inb(PIT_GATE_PORT) & ~(PIT_SPEAKER | PIT_GATE);
+
+	// Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+	outb(PIT_GATE_PORT, gate);
+	outb(PIT_COMMAND, 0xB0);
+	outb(PIT_CHANNEL2, count & 0xFF);
+	outb(PIT_CHANNEL2, count >> 8);
+
+	outb(PIT_GATE_PORT, gate | PIT_GATE);
+	const uint64_t start = rdtsc();
+	while (!(inb(PIT_GATE_PORT) & PIT_OUT2)) {
+	}
+	const uint64_t end = rdtsc();
+
+	outb(PIT_GATE_PORT, gate);
+	if (end > start) {
+		tsc_khz = (end - start) / TSC_CALIBRATION_MS;
+	}
+	klog(KLOG_INFO, "timer: TSC at %u kHz", tsc_khz);
+}
+
+static void timer_irq(const uint8_t) {
+	++timer_ticks;
+	console_tick(timer_ticks);
+}
+
+/* Periodic PIT channel 0 tick, waking up the idle loop for background work */
+__init void timer_init(void) {
+	const uint16_t divisor = PIT_FREQUENCY / TIMER_HZ;
+
+	// Channel 0, lobyte/hibyte, mode 3 (square wave generator)
+	outb(PIT_COMMAND, 0x36);
+	outb(PIT_CHANNEL0, divisor & 0xFF);
+	outb(PIT_CHANNEL0, divisor >> 8);
+
+	irq_register(TIMER_IRQ, timer_irq);
+	irq_unmask(TIMER_IRQ);
+}
+
+uint64_t tsc_to_us(const uint64_t cycles) {
+	return cycles * 1000 / tsc_khz;
+}
+
+uint64_t tsc_to_ns(const uint64_t cycles) {
+	return cycles * 1000000 / tsc_khz;
+}
+
+void udelay(const uint32_t us) {
+	const uint64_t end = rdtsc() + (uint64_t) us * tsc_khz / 1000;
+
+	while (rdtsc() < end) {
+		__asm__ volatile ("pause");
+	}
+}
@@ -1,32 +1,27 @@
 #include <stdarg.h>
 
 #include "kernel.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memtype.hpp"
+#include "simd.hpp"
 #include "utils.hpp"
 
 
-static IDTR_t	idt_register;
-static IDT_t	idt[IDT_ENTRIES];
 GDTR_t *	gdt_register = (GDTR_t *) 0x00000800;
 GDT_t		gdt[GDT_ENTRIES];
+tss_t		tss;
 
-inline void outb(const uint16_t port, const uint8_t val) {
-    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port) : "memory");
-}
-
-uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    __asm__ volatile ( "inb %w1, %b0"
-                   : "=a"(ret)
-                   : "Nd"(port)
-                   : "memory");
-    return ret;
-}
+// Descriptor tables and the PIC are left out of the host build
+#ifndef KFS_HOST
+static IDTR_t	idt_register;
+static IDT_t	idt[IDT_ENTRIES];
 
 static inline void io_wait(void) {
     outb(0x80, 0);
 }
 
-void PIC_remap(void) {
+__init void PIC_remap(void) {
 	// starts the initialization sequence (in cascade mode)
 	outb(PIC1_COMMAND, ICW1_INIT | ICW1_ICW4);
 	io_wait();
@@ -54,22 +49,35 @@ void PIC_remap(void) {
 	outb(PIC2_DATA, ICW4_8086);
 	io_wait();
 
-	// Mask all interrupts except keyboard
-	outb(PIC1_DATA, 0xFD);
+	// Mask all interrupts except keyboard, cascade and the two ATA channels (IRQ14/15)
+	outb(PIC1_DATA, 0xF9);
 	io_wait();
-	outb(PIC2_DATA, 0xFF);
+	outb(PIC2_DATA, 0x3F);
 	io_wait();
 }
 
-void initialize_idt(void) {
-	idt[IRQ_START + KEYBOARD_INTERRUPT_IRQ].offset_1 = (uintptr_t) isr_wrapper & 0xFFFF;
-	idt[IRQ_START + KEYBOARD_INTERRUPT_IRQ].selector = GDT_CODE_SEGMENT;
-	idt[IRQ_START + KEYBOARD_INTERRUPT_IRQ].zero = 0;
-	idt[IRQ_START + KEYBOARD_INTERRUPT_IRQ].type_attributes = DEFAULT_FLAG;
-	idt[IRQ_START + KEYBOARD_INTERRUPT_IRQ].offset_2 = ((uintptr_t) isr_wrapper >> 16) & 0xFFFF;
+void set_idt_entry(const uint8_t vector, void (*handler)(), const uint8_t flags) {
+	idt[vector].offset_1 = (uintptr_t) handler & 0xFFFF;
+	idt[vector].selector = GDT_CODE_SEGMENT;
+	idt[vector].zero = 0;
+	idt[vector].type_attributes = flags;
+	idt[vector].offset_2 = ((uintptr_t) handler >> 16) & 0xFFFF;
+}
+
+__init void initialize_idt(void) {
+	for (uint8_t vector = 0; vector < EXCEPTION_COUNT; ++vector) {
+		set_idt_entry(vector, exception_stubs[vector], DEFAULT_FLAG);
+	}
+
+	// Every PIC line gets a vector so that an unexpected IRQ is acknowledged instead of faulting
+	for (uint8_t irq = 0; irq < IRQ_COUNT; ++irq) {
+		set_idt_entry(IRQ_START + irq, irq_stubs[irq], DEFAULT_FLAG);
+	}
+
+	set_idt_entry(IRQ_START + KEYBOARD_INTERRUPT_IRQ, isr_wrapper, DEFAULT_FLAG);
 }
 
-void load_idt(void) {
+__init void load_idt(void) {
     idt_register.size = (sizeof(IDT_t) * IDT_ENTRIES) - 1;
 	idt_register.idt = (uint32_t) &idt;
 
@@ -77,7 +85,7 @@ void load_idt(void) {
 }
 
 
-void set_gdt_entry(const int index, const uint32_t base, const uint32_t limit,
+__init void set_gdt_entry(const int index, const uint32_t base, const uint32_t limit,
 		const uint8_t access, const uint8_t granularity) {
     gdt[index].base_low = (base & 0xFFFF);
     gdt[index].base_middle = (base >> 16) & 0xFF;
@@ -89,7 +97,7 @@ void set_gdt_entry(const int index, const uint32_t base, const uint32_t limit,
 }
 
 
-void init_gdt() {
+__init void init_gdt() {
 	const uint32_t	base = 0;
     const uint32_t	limit = 0xFFFFF;
 
@@ -118,138 +126,242 @@ void init_gdt() {
 	// Segment 6: User stack, same as User data
     set_gdt_entry(6, base, limit, 0xF2, 0xCF);
 
+	// Segments 7 to 10: SYSENTER takes its code and stack segments from
+	// SYSENTER_CS and SYSENTER_CS + 8, SYSEXIT the user ones from + 16 and + 24.
+	// Entries 3 and 4 don't fit that order, so ring 3 runs on this copy.
+    set_gdt_entry(7, base, limit, 0x9A, 0xCF);
+    set_gdt_entry(8, base, limit, 0x92, 0xCF);
+    set_gdt_entry(9, base, limit, 0xFA, 0xCF);
+    set_gdt_entry(10, base, limit, 0xF2, 0xCF);
+
+	// Segment 11: TSS, only used for the ring 0 stack on interrupts from ring 3
+	tss.ss0 = GDT_DATA_SEGMENT;
+	tss.iomap_base = sizeof(tss_t);
+    set_gdt_entry(11, (uint32_t) &tss, sizeof(tss_t) - 1, 0x89, 0x00);
+
     // Load the new GDT
     __asm__ volatile ("lgdt %0" : : "m"(*gdt_register));
+    __asm__ volatile ("ltr %w0" : : "r"(GDT_TSS));
 	// Reload the segment registers to the new Kernel Data segment:  index 2 = 0x10
     __asm__ volatile (
-        "mov $0x10, %ax\n"
-        "mov %ax, %ds\n"
-        "mov %ax, %es\n"
-        "mov %ax, %fs\n"
-        "mov %ax, %gs\n"
-        "mov %ax, %ss\n"
+        "mov $0x10, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%gs\n"
+        "mov %%ax, %%ss\n"
 		// Jump to provoke a segment change to make sure the segment registers are reloaded properly
-        "jmp $0x08, $.1\n"
-        ".1:\n"
+        "ljmp $0x08, $1f\n"
+        "1:\n"
+        : : : "eax", "memory"
     );
 }
+#endif
+
+__hot void update_cursor(size_t x, size_t y) {
+	++cpu_stats.cursor_updates;
+#ifdef CONSOLE_FB
+	console_cursor(x, y);
+#else
+	// The screen is write-combining: flush it before the cursor moves
+	wc_barrier();
+	// Like the start address, the cursor counts cells from the start of the aperture
+	crtc_cursor(terminal_buffer - (uint16_t*) CONSOLE_TEXT_BUFFER + tty_t::index(x, y));
+#endif
+}
 
-void update_cursor(size_t x, size_t y) {
-	uint16_t pos = y * VGA_WIDTH + x;
+__hot void move_cursor_left(void) {
+	tty_t * const	t = curr_tty;
 
-	outb(0x3D4, 0x0F);
-	outb(0x3D5, (uint8_t) (pos & 0xFF));
-	outb(0x3D4, 0x0E);
-	outb(0x3D5, (uint8_t) ((pos >> 8) & 0xFF));
+	if (t->column > 0) {
+		--t->column;
+		update_cursor(t->column, t->row);
+	}
 }
 
-void move_cursor_left(void) {
-	if (terminal_column[curr_tty] > 0) {
-		--terminal_column[curr_tty];
-		update_cursor(terminal_column[curr_tty], terminal_row[curr_tty]);
+__hot void move_cursor_right(void) {
+	tty_t * const	t = curr_tty;
+
+	if (t->column < tty_t::width - 1) {
+		++t->column;
+		update_cursor(t->column, t->row);
 	}
 }
 
-void move_cursor_right(void) {
-	if (terminal_column[curr_tty] < VGA_WIDTH - 1) {
-		++terminal_column[curr_tty];
-		update_cursor(terminal_column[curr_tty], terminal_row[curr_tty]);
+#ifndef KFS_HOST
+/* The compiler may emit calls to these even in a freestanding build (struct
+   copies, loops recognized as idioms), so they must exist and must not be
+   written as plain loops themselves. The host build takes the C library's. */
+extern "C" void* memset(void* dest, int value, size_t n) {
+	if (n >= SIMD_MIN_SIZE) {
+		return memset_large(dest, value, n);
 	}
+	return memset_rep(dest, value, n);
 }
 
-size_t terminal_putnbr_base(int n, const char* base, const size_t base_len, size_t pos) {
-	long nb = n;
-
-	if (nb < 0) {
-		terminal_putentryat('-', DEFAULT_COLOR, pos % VGA_WIDTH, pos / VGA_WIDTH);
-		++pos;
-		nb *= -1;
+extern "C" void* memcpy(void* dest, const void* src, size_t n) {
+	if (n >= SIMD_MIN_SIZE) {
+		return memcpy_large(dest, src, n);
 	}
+	return memcpy_rep(dest, src, n);
+}
 
-	if (nb >= base_len) {
-		pos = terminal_putnbr_base((int)(nb / base_len), base, base_len, pos);
+extern "C" void* memmove(void* dest, const void* src, size_t n) {
+	// memcpy() always copies forward, which is fine for a lower dest
+	if (dest <= src || (const uint8_t*) src + n <= (uint8_t*) dest) {
+		return memcpy(dest, src, n);
 	}
 
-	terminal_putentryat(base[(nb % base_len)], DEFAULT_COLOR, pos % VGA_WIDTH, pos / VGA_WIDTH);
-	return ++pos;
+	void*		d = (uint8_t*) dest + n - 1;
+	const void*	s = (const uint8_t*) src + n - 1;
+
+	__asm__ volatile ("std\n\trep movsb\n\tcld" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+	return dest;
 }
 
-void kmemset(void* ptr, const int8_t value, const size_t num) {
-	int8_t* c_ptr = reinterpret_cast<int8_t *>(ptr);
+extern "C" int memcmp(const void* s1, const void* s2, size_t n) {
+	const uint8_t*	a = (const uint8_t*) s1;
+	const uint8_t*	b = (const uint8_t*) s2;
 
-	for (size_t i = 0; i < num; ++i) {
-		c_ptr[i] = value;
+	for (size_t i = 0; i < n; ++i) {
+		if (a[i] != b[i]) {
+			return a[i] - b[i];
+		}
 	}
+	return 0;
 }
+#endif
 
+void kmemset(void* ptr, const int8_t value, const size_t num) {
+	memset(ptr, (uint8_t) value, num);
+}
+
+/* Debug output goes to the kernel log, where dmesg and the serial port read
+   it, rather than over whatever the top of the screen holds */
 void kprintf(const char* format, ...) {
 	va_list	va_params;
-	size_t	buffer_index = 0;
-	char	c, f;
-	const char *s;
 
 	va_start(va_params, format);
-	for (int i = 0; format[i]; ++i) {
-		c = format[i];
-		if (c == '%') {
+	vklog(KLOG_DEBUG, format, va_params);
+	va_end(va_params);
+}
+
+static size_t format_number(char* out, uintptr_t nb, const uint32_t base_len, const char* base) {
+	char	digits[32];
+	size_t	len = 0;
+
+	do {
+		digits[len++] = base[nb % base_len];
+		nb /= base_len;
+	} while (nb);
+
+	for (size_t i = 0; i < len; ++i) {
+		out[i] = digits[len - 1 - i];
+	}
+	return len;
+}
+
+/* Formats into buf, always NUL terminated, and returns the formatted length.
+   Supports %c %s %d %u %x %X %p %% with an optional '0' flag and width. */
+size_t kvsnprintf(char* buf, const size_t size, const char* format, va_list va_params) {
+	size_t	len = 0;
+	char	number[32];
+
+	if (!size) {
+		return 0;
+	}
+
+	for (int i = 0; format[i] && len < size - 1; ++i) {
+		if (format[i] != '%') {
+			buf[len++] = format[i];
+			continue;
+		}
+
+		char	pad = ' ';
+		size_t	width = 0;
+		size_t	number_len = 0;
+		const char* s = NULL;
+
+		++i;
+		if (format[i] == '0') {
+			pad = '0';
+			++i;
+		}
+		while (format[i] >= '0' && format[i] <= '9') {
+			width = width * 10 + (format[i++] - '0');
+		}
+		while (format[i] == 'l') {
 			++i;
-			if (!(f = format[i])) {
+		}
+
+		switch (format[i]) {
+			case '\0':
+				--i;
+				continue;
+			case 'c':
+				number[number_len++] = (char) va_arg(va_params, int);
+				break;
+			case 's':
+				s = va_arg(va_params, const char*);
+				break;
+			case 'd': {
+				const int n = va_arg(va_params, int);
+
+				if (n < 0) {
+					number[number_len++] = '-';
+				}
+				number_len += format_number(number + number_len, n < 0 ? -(uint32_t) n : n, 10, "0123456789");
 				break;
 			}
-			switch (f) {
-				case '%':
-					terminal_putentryat('%', DEFAULT_COLOR, buffer_index % VGA_WIDTH, buffer_index / VGA_WIDTH);
-					++buffer_index;
-					break;
-				case 'c':
-					terminal_putentryat((char) va_arg(va_params, int), DEFAULT_COLOR, buffer_index % VGA_WIDTH, buffer_index / VGA_WIDTH);
-					++buffer_index;
-					break;
-				case 'd':
-					buffer_index = terminal_putnbr_base((int) va_arg(va_params, int), "0123456789", 10, buffer_index);
-					break;
-				case 'x':
-					buffer_index = terminal_putnbr_base((int) va_arg(va_params, int), "0123456789abcdef", 16, buffer_index);
-					break;
-				case 'X':
-					buffer_index = terminal_putnbr_base((int) va_arg(va_params, int), "0123456789ABCDEF", 16, buffer_index);
-					break;
-				case 's':
-					s = (char *) va_arg(va_params, char *);
-					for (int s_i = 0; s[s_i]; ++s_i) {
-						terminal_putentryat(s[s_i], DEFAULT_COLOR, buffer_index % VGA_WIDTH, buffer_index / VGA_WIDTH);
-						++buffer_index;
-					}
-					break;
-				default:
-					break;
-			}
-		} else if (c == '\n') {
-			buffer_index -= buffer_index % VGA_WIDTH;
-			buffer_index += VGA_WIDTH;
-		} else {
-			terminal_putentryat(c, DEFAULT_COLOR, buffer_index % VGA_WIDTH, buffer_index / VGA_WIDTH);
-			++buffer_index;
+			case 'u':
+				number_len = format_number(number, va_arg(va_params, uint32_t), 10, "0123456789");
+				break;
+			case 'p':
+				// A full pointer wide, 64 bits in the host build
+				number_len = format_number(number, va_arg(va_params, uintptr_t), 16, "0123456789abcdef");
+				pad = '0';
+				width = sizeof(uintptr_t) * 2;
+				break;
+			case 'x':
+				number_len = format_number(number, va_arg(va_params, uint32_t), 16, "0123456789abcdef");
+				break;
+			case 'X':
+				number_len = format_number(number, va_arg(va_params, uint32_t), 16, "0123456789ABCDEF");
+				break;
+			default:
+				number[number_len++] = format[i];
+				break;
 		}
-	}
-	va_end(va_params);
 
-	while (buffer_index % VGA_WIDTH) {
-		terminal_putentryat(EMPTY, DEFAULT_COLOR, buffer_index % VGA_WIDTH, buffer_index / VGA_WIDTH);
-		++buffer_index;
+		if (!s) {
+			number[number_len] = '\0';
+			s = number;
+		}
+
+		for (size_t field = kstrlen(s); field < width && len < size - 1; ++field) {
+			buf[len++] = pad;
+		}
+		for (; *s && len < size - 1; ++s) {
+			buf[len++] = *s;
+		}
 	}
+
+	buf[len] = '\0';
+	return len;
 }
 
-void* kmemcpy(void *dest, const void *src, size_t n) {
-	size_t				i = -1;
-	unsigned char		*destcpy = reinterpret_cast<unsigned char *>(dest);
-	const unsigned char	*srccpy = reinterpret_cast<const unsigned char *>(src);
+size_t ksnprintf(char* buf, const size_t size, const char* format, ...) {
+	va_list	va_params;
+	size_t	len;
 
-	while (++i < n) {
-		destcpy[i] = srccpy[i];
-	}
+	va_start(va_params, format);
+	len = kvsnprintf(buf, size, format, va_params);
+	va_end(va_params);
+	return len;
+}
 
-	return (dest);
+void* kmemcpy(void *dest, const void *src, size_t n) {
+	return memcpy(dest, src, n);
 }
 
 int	kstrncmp(const uint16_t *s1, const char *s2, const size_t n) {
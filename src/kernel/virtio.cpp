@@ -0,0 +1,224 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "pci.hpp"
+#include "utils.hpp"
+#include "virtio.hpp"
+
+
+static virtio_device_t	devices[VIRTIO_MAX_DEVICES];
+static size_t			device_count = 0;
+static uint8_t			queue_memory[VIRTIO_MAX_QUEUES][VIRTQ_BYTES] __attribute__((aligned(VIRTQ_ALIGN)));
+static size_t			queue_count = 0;
+
+
+/* The event indexes sit right after the rings */
+static inline volatile uint16_t* used_event(virtqueue_t* vq) {
+	return (volatile uint16_t*) &vq->avail->ring[vq->size];
+}
+
+static inline volatile uint16_t* avail_event(virtqueue_t* vq) {
+	return (volatile uint16_t*) &vq->used->ring[vq->size];
+}
+
+/* The lines are level triggered and may be shared: every virtio device on
+   the line is asked, reading its ISR status acknowledges it */
+static void virtio_irq(const uint8_t irq) {
+	for (size_t i = 0; i < device_count; ++i) {
+		virtio_device_t* const dev = &devices[i];
+
+		if (dev->pci->irq == irq && (inb(dev->io_base + VIRTIO_REG_ISR) & VIRTIO_ISR_QUEUE) && dev->interrupt) {
+			dev->interrupt(dev);
+		}
+	}
+}
+
+/* Resets the device and acknowledges it, keeping the features both sides
+   know. The driver then sets its queues up and calls virtio_ready(). */
+virtio_device_t* virtio_probe(pci_device_t* pci, const uint32_t wanted_features,
+		void (*interrupt)(virtio_device_t* dev), void* driver) {
+	if (device_count == VIRTIO_MAX_DEVICES || !(pci->bars[0].flags & PCI_BAR_IO) || !pci->bars[0].base) {
+		return NULL;
+	}
+
+	virtio_device_t* const dev = &devices[device_count++];
+
+	dev->name = NULL;
+	dev->pci = pci;
+	dev->io_base = pci->bars[0].base;
+	dev->interrupt = interrupt;
+	dev->driver = driver;
+	pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+	outb(dev->io_base + VIRTIO_REG_STATUS, 0);
+	outb(dev->io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+	outb(dev->io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+	dev->features = inl(dev->io_base + VIRTIO_REG_DEVICE_FEATURES) & wanted_features;
+	outl(dev->io_base + VIRTIO_REG_DRIVER_FEATURES, dev->features);
+
+	// Without a line, completions are only seen by polling
+	if (irq_register(pci->irq, virtio_irq)) {
+		irq_unmask(pci->irq);
+	}
+	return dev;
+}
+
+/* Lays the queue out in one of the static areas, with the descriptors all
+   chained in the free list */
+bool virtio_queue_init(virtio_device_t* dev, const uint16_t index, virtqueue_t* vq) {
+	outw(dev->io_base + VIRTIO_REG_QUEUE_SELECT, index);
+
+	const uint16_t size = inw(dev->io_base + VIRTIO_REG_QUEUE_SIZE);
+
+	if (!size || size > VIRTQ_MAX_SIZE || queue_count == VIRTIO_MAX_QUEUES) {
+		outb(dev->io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+		klog(KLOG_WARN, "virtio: queue %u of %u entries not supported", index, size);
+		return false;
+	}
+
+	uint8_t* const memory = queue_memory[queue_count++];
+	const size_t used_offset = (sizeof(virtq_desc_t) * size + sizeof(virtq_avail_t) + sizeof(uint16_t) * (size + 1)
+		+ VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+
+	memset(memory, 0, VIRTQ_BYTES);
+	memset(vq, 0, sizeof(*vq));
+	vq->index = index;
+	vq->size = size;
+	vq->free_count = size;
+	vq->event_idx = dev->features & VIRTIO_F_EVENT_IDX;
+	vq->notify_port = dev->io_base + VIRTIO_REG_QUEUE_NOTIFY;
+	vq->desc = (virtq_desc_t*) memory;
+	vq->avail = (virtq_avail_t*) (memory + sizeof(virtq_desc_t) * size);
+	vq->used = (virtq_used_t*) (memory + used_offset);
+	for (uint16_t i = 0; i < size; ++i) {
+		vq->desc[i].next = i + 1;
+	}
+
+	outl(dev->io_base + VIRTIO_REG_QUEUE_PFN, (uintptr_t) memory / VIRTQ_ALIGN);
+	return true;
+}
+
+void virtio_ready(virtio_device_t* dev) {
+	outb(dev->io_base + VIRTIO_REG_STATUS,
+		VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+}
+
+uint32_t virtio_config_read32(const virtio_device_t* dev, const uint8_t offset) {
+	return inl(dev->io_base + VIRTIO_REG_CONFIG + offset);
+}
+
+/* Chains the buffers into one request, readable ones first as the device
+   expects, without telling the device yet. Called with interrupts disabled;
+   false if there aren't enough free descriptors. */
+bool virtqueue_add(virtqueue_t* vq, const virtio_buffer_t* buffers, const size_t count, void* cookie) {
+	if (!count || count > vq->free_count) {
+		return false;
+	}
+
+	const uint16_t head = vq->free_head;
+	uint16_t i = head;
+
+	for (size_t n = 0; n < count; ++n) {
+		virtq_desc_t* const desc = &vq->desc[i];
+
+		desc->addr = (uintptr_t) buffers[n].data;
+		desc->len = buffers[n].len;
+		desc->flags = (buffers[n].device_writes ? VIRTQ_DESC_F_WRITE : 0) | (n + 1 < count ? VIRTQ_DESC_F_NEXT : 0);
+		i = desc->next;
+	}
+	vq->free_head = i;
+	vq->free_count -= count;
+	vq->cookies[head] = cookie;
+	vq->avail->ring[vq->avail_idx % vq->size] = head;
+	++vq->avail_idx;
+	return true;
+}
+
+/* Publishes everything added since the last kick at once, and notifies the
+   device only if it asked for it. With event indexes, the device is also
+   told to interrupt once, when the last published request completes. */
+void virtqueue_kick(virtqueue_t* vq) {
+	const uint16_t old = vq->kicked_idx;
+	const uint16_t next = vq->avail_idx;
+
+	if (old == next) {
+		return;
+	}
+	// Set before the index is published, for the device to see both together
+	if (vq->event_idx) {
+		*used_event(vq) = next - 1;
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	*(volatile uint16_t*) &vq->avail->idx = next;
+	// The device may have gone idle meanwhile: its event index is read after the store
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	vq->kicked_idx = next;
+
+	const bool notify = vq->event_idx
+		? (uint16_t) (next - *avail_event(vq) - 1) < (uint16_t) (next - old)
+		: !(*(volatile uint16_t*) &vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+
+	if (notify) {
+		outw(vq->notify_port, vq->index);
+		++vq->kicks;
+	}
+}
+
+/* Returns the cookie of the next completed request and frees its
+   descriptors, NULL when there's none. Called with interrupts disabled. */
+void* virtqueue_get(virtqueue_t* vq, uint32_t* len) {
+	if (vq->last_used == *(volatile uint16_t*) &vq->used->idx) {
+		return NULL;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	const virtq_used_elem_t* const elem = &vq->used->ring[vq->last_used % vq->size];
+	const uint16_t head = elem->id;
+	uint16_t tail = head;
+	uint16_t count = 1;
+
+	if (len) {
+		*len = elem->len;
+	}
+	while (vq->desc[tail].flags & VIRTQ_DESC_F_NEXT) {
+		tail = vq->desc[tail].next;
+		++count;
+	}
+	vq->desc[tail].next = vq->free_head;
+	vq->free_head = head;
+	vq->free_count += count;
+	++vq->last_used;
+	return vq->cookies[head];
+}
+
+/* Legacy (transitional) devices only: their ID tells the type */
+__init void virtio_init(void) {
+	for (pci_device_t* pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_LEGACY_BLK, NULL); pci;
+			pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_LEGACY_BLK, pci)) {
+		virtio_blk_init(pci);
+	}
+	for (pci_device_t* pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_LEGACY_CONSOLE, NULL); pci;
+			pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_LEGACY_CONSOLE, pci)) {
+		virtio_console_init(pci);
+	}
+}
+
+void virtio_list(void) {
+	if (!device_count) {
+		terminal_printf("virtio: no device found");
+	}
+	for (size_t i = 0; i < device_count; ++i) {
+		const virtio_device_t* const dev = &devices[i];
+
+		terminal_printf("%s  %02x:%02x.%u  io 0x%x  irq %u  features 0x%08x%s", dev->name ? dev->name : "-",
+			dev->pci->address.bus, dev->pci->address.device, dev->pci->address.function,
+			dev->io_base, dev->pci->irq, dev->features, dev->features & VIRTIO_F_EVENT_IDX ? "  event idx" : "");
+	}
+}
+
+void virtio_bench(void) {
+	virtio_blk_bench();
+	virtio_console_bench();
+}
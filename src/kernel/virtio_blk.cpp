@@ -0,0 +1,232 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "block.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+#include "virtio.hpp"
+
+
+typedef struct VirtioBlkHeader {
+	uint32_t	type;
+	uint32_t	reserved;
+	uint64_t	sector;
+} __attribute__((packed)) virtio_blk_header_t;
+
+/* One request covers a run of adjacent blocks, each one a data descriptor
+   pointing at the caller's buffer */
+typedef struct VirtioBlkRequest {
+	virtio_blk_header_t	header;
+	volatile uint8_t	status;
+	block_io_t*			ios;
+	size_t				count;
+} virtio_blk_request_t;
+
+typedef struct VirtioBlk {
+	virtio_device_t*		dev;
+	block_device_t*			block;
+	virtqueue_t				vq;
+	uint32_t				seg_max;
+	volatile uint32_t		pending;
+	uint32_t				requests;
+	virtio_blk_request_t	slots[VIRTIO_BLK_MAX_REQUESTS];
+} virtio_blk_t;
+
+static virtio_blk_t		disks[VIRTIO_MAX_DEVICES];
+static size_t			disk_count = 0;
+
+
+/* Called with interrupts disabled */
+static void virtio_blk_drain(virtio_blk_t* blk) {
+	virtio_blk_request_t* r;
+
+	while ((r = (virtio_blk_request_t*) virtqueue_get(&blk->vq, NULL))) {
+		for (size_t i = 0; i < r->count; ++i) {
+			r->ios[i].error = r->status != VIRTIO_BLK_S_OK;
+		}
+		--blk->pending;
+	}
+}
+
+static void virtio_blk_interrupt(virtio_device_t* dev) {
+	virtio_blk_t* const blk = (virtio_blk_t*) dev->driver;
+
+	++blk->vq.interrupts;
+	virtio_blk_drain(blk);
+}
+
+/* Block device backend. Adjacent blocks of the batch become one request,
+   all the requests that fit in the queue are published with one kick, and
+   the device interrupts once, when the last of them completes. */
+static size_t virtio_blk_transfer(block_device_t* bdev, block_io_t* ios, const size_t count) {
+	virtio_blk_t* const blk = (virtio_blk_t*) bdev->data;
+	virtio_buffer_t buffers[VIRTIO_BLK_MAX_SEGMENTS + 2];
+	size_t errors = 0;
+	size_t i = 0;
+
+	while (i < count) {
+		const uint32_t flags = irq_save();
+		size_t slots = 0;
+
+		while (i < count && slots < VIRTIO_BLK_MAX_REQUESTS) {
+			if (ios[i].block >= bdev->blocks || (ios[i].write && bdev->read_only)) {
+				ios[i].error = true;
+				++i;
+				continue;
+			}
+
+			size_t n = 1;
+
+			while (i + n < count && n < blk->seg_max && ios[i + n].write == ios[i].write
+					&& ios[i + n].block == ios[i].block + n && ios[i + n].block < bdev->blocks) {
+				++n;
+			}
+			if (blk->vq.free_count < n + 2) {
+				break;
+			}
+
+			virtio_blk_request_t* const r = &blk->slots[slots++];
+
+			r->header.type = ios[i].write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+			r->header.reserved = 0;
+			r->header.sector = ios[i].block * VIRTIO_BLK_SECTORS_PER_BLOCK;
+			r->status = 0xFF;
+			r->ios = &ios[i];
+			r->count = n;
+
+			buffers[0] = { &r->header, sizeof(r->header), false };
+			for (size_t b = 0; b < n; ++b) {
+				buffers[b + 1] = { ios[i + b].buffer, BLOCK_SIZE, !ios[i].write };
+			}
+			buffers[n + 1] = { (const void*) &r->status, 1, true };
+
+			virtqueue_add(&blk->vq, buffers, n + 2, r);
+			++blk->pending;
+			++blk->requests;
+			i += n;
+		}
+		virtqueue_kick(&blk->vq);
+
+		// Polled as well: a shared line may be served by another device's handler first
+		for (virtio_blk_drain(blk); blk->pending; virtio_blk_drain(blk)) {
+			if (flags & EFLAGS_IF) {
+				irq_wait();
+			}
+		}
+		irq_restore(flags);
+	}
+
+	for (size_t k = 0; k < count; ++k) {
+		errors += ios[k].error;
+	}
+	return errors;
+}
+
+__init void virtio_blk_init(pci_device_t* pci) {
+	if (disk_count == VIRTIO_MAX_DEVICES) {
+		return;
+	}
+
+	virtio_blk_t* const blk = &disks[disk_count];
+	virtio_device_t* const dev = virtio_probe(pci, VIRTIO_F_EVENT_IDX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO,
+		virtio_blk_interrupt, blk);
+
+	if (!dev || !virtio_queue_init(dev, 0, &blk->vq)) {
+		return;
+	}
+
+	const uint64_t sectors = virtio_config_read32(dev, VIRTIO_BLK_CONFIG_CAPACITY)
+		| (uint64_t) virtio_config_read32(dev, VIRTIO_BLK_CONFIG_CAPACITY + 4) << 32;
+	const char name[] = { 'v', 'd', (char) ('a' + disk_count), '\0' };
+
+	blk->dev = dev;
+	blk->seg_max = 1;
+	if (dev->features & VIRTIO_BLK_F_SEG_MAX) {
+		const uint32_t seg_max = virtio_config_read32(dev, VIRTIO_BLK_CONFIG_SEG_MAX);
+
+		blk->seg_max = seg_max < VIRTIO_BLK_MAX_SEGMENTS ? (seg_max ? seg_max : 1) : VIRTIO_BLK_MAX_SEGMENTS;
+	}
+	if (blk->seg_max + 2 > blk->vq.size) {
+		blk->seg_max = blk->vq.size - 2;
+	}
+
+	blk->block = block_register(name, sectors / VIRTIO_BLK_SECTORS_PER_BLOCK, dev->features & VIRTIO_BLK_F_RO,
+		blk, virtio_blk_transfer);
+	if (!blk->block) {
+		return;
+	}
+	dev->name = blk->block->name;
+	++disk_count;
+	virtio_ready(dev);
+	klog(KLOG_INFO, "virtio: %s: %u MB, queue of %u, %u segments per request", dev->name,
+		(uint32_t) (sectors / 2048), blk->vq.size, blk->seg_max);
+}
+
+/* Reads ops blocks, VIRTIO_BENCH_DEPTH per transfer, through the block
+   device interface the block cache uses */
+static void bench_pattern(const char* name, virtio_blk_t* blk, void* pages[VIRTIO_BENCH_DEPTH],
+		const uint32_t ops, const uint32_t span, const bool random) {
+	static block_io_t ios[VIRTIO_BENCH_DEPTH];
+	const uint32_t requests = blk->requests;
+	const uint32_t kicks = blk->vq.kicks;
+	const uint32_t interrupts = blk->vq.interrupts;
+	uint32_t seed = 0x2545F491;
+	uint32_t errors = 0;
+	uint64_t cycles = 0;
+
+	for (uint32_t done = 0; done < ops; done += VIRTIO_BENCH_DEPTH) {
+		const uint32_t batch = ops - done < VIRTIO_BENCH_DEPTH ? ops - done : VIRTIO_BENCH_DEPTH;
+
+		for (uint32_t i = 0; i < batch; ++i) {
+			seed = seed * 1664525 + 1013904223;
+			ios[i].block = random ? seed % span : done + i;
+			ios[i].buffer = pages[i];
+			ios[i].write = false;
+			ios[i].error = false;
+		}
+
+		const uint64_t start = rdtsc();
+		errors += blk->block->transfer(blk->block, ios, batch);
+		cycles += rdtsc() - start;
+	}
+
+	const uint64_t us = tsc_to_us(cycles) ? tsc_to_us(cycles) : 1;
+	const uint32_t mb_s_10 = (uint64_t) ops * BLOCK_SIZE * 10 * 1000000 / us / (1024 * 1024);
+
+	terminal_printf("%s %5u x 4K %5u.%u MB/s %7u IO/s %5u req %4u kick %4u irq %u err", name, ops,
+		mb_s_10 / 10, mb_s_10 % 10, (uint32_t) ((uint64_t) ops * 1000000 / us), blk->requests - requests,
+		blk->vq.kicks - kicks, blk->vq.interrupts - interrupts, errors);
+}
+
+void virtio_blk_bench(void) {
+	void* pages[VIRTIO_BENCH_DEPTH];
+	size_t allocated = 0;
+
+	if (!disk_count) {
+		terminal_printf("virtio bench: no virtio-blk disk");
+		return;
+	}
+
+	virtio_blk_t* const blk = &disks[0];
+	const uint32_t span = blk->block->blocks < VIRTIO_BENCH_SEQ_PAGES ? blk->block->blocks : VIRTIO_BENCH_SEQ_PAGES;
+
+	for (; allocated < VIRTIO_BENCH_DEPTH; ++allocated) {
+		if (!(pages[allocated] = page_alloc())) {
+			break;
+		}
+	}
+
+	if (allocated < VIRTIO_BENCH_DEPTH || !span) {
+		terminal_printf("virtio bench: not enough memory or disk space");
+	} else {
+		terminal_printf("%s, %u blocks per transfer", blk->block->name, VIRTIO_BENCH_DEPTH);
+		bench_pattern("seq read ", blk, pages, span, span, false);
+		bench_pattern("rand read", blk, pages, VIRTIO_BENCH_RANDOM_OPS, span, true);
+	}
+
+	while (allocated) {
+		page_free(pages[--allocated]);
+	}
+}
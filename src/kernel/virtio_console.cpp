@@ -0,0 +1,164 @@
+#include "kernel.hpp"
+#include "keyboard.hpp"
+#include "interrupts.hpp"
+#include "klog.hpp"
+#include "memory.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+#include "virtio.hpp"
+
+
+/* The first virtio console, without the multiport feature: one port, hvc0.
+   It only transmits, the kernel log and the benchmark. */
+typedef struct VirtioConsole {
+	virtio_device_t*	dev;
+	virtqueue_t			rx;
+	virtqueue_t			tx;
+	volatile uint32_t	pending;
+	klog_reader_t		reader;
+	char				lines[VIRTIO_CONSOLE_LOG_BATCH][VIRTIO_CONSOLE_LINE];
+} virtio_console_t;
+
+static virtio_console_t	console;
+static bool				console_present = false;
+
+
+static void virtio_console_drain(void) {
+	while (virtqueue_get(&console.tx, NULL)) {
+		--console.pending;
+	}
+}
+
+static void virtio_console_interrupt(virtio_device_t*) {
+	++console.tx.interrupts;
+	virtio_console_drain();
+}
+
+/* Queues every buffer, kicks once and waits until the device is done with
+   them, as it reads them in place */
+static bool virtio_console_send(const virtio_buffer_t* buffers, const size_t count) {
+	const uint32_t flags = irq_save();
+	bool queued = true;
+
+	for (size_t i = 0; i < count && queued; ++i) {
+		queued = virtqueue_add(&console.tx, &buffers[i], 1, NULL);
+		console.pending += queued;
+	}
+	virtqueue_kick(&console.tx);
+	for (virtio_console_drain(); console.pending; virtio_console_drain()) {
+		if (flags & EFLAGS_IF) {
+			irq_wait();
+		}
+	}
+	irq_restore(flags);
+	return queued;
+}
+
+__init void virtio_console_init(pci_device_t* pci) {
+	if (console_present) {
+		return;
+	}
+
+	virtio_device_t* const dev = virtio_probe(pci, VIRTIO_F_EVENT_IDX, virtio_console_interrupt, &console);
+
+	if (!dev || !virtio_queue_init(dev, VIRTIO_CONSOLE_RECEIVEQ, &console.rx)
+			|| !virtio_queue_init(dev, VIRTIO_CONSOLE_TRANSMITQ, &console.tx)) {
+		return;
+	}
+	console.dev = dev;
+	dev->name = "hvc0";
+	virtio_ready(dev);
+
+	// Everything logged since boot goes out first, as on the serial port
+	klog_reader_init(&console.reader, true);
+	console_present = true;
+	klog(KLOG_INFO, "virtio: hvc0: transmit queue of %u", console.tx.size);
+}
+
+bool virtio_console_write(const void* data, const size_t len) {
+	const virtio_buffer_t buffer = { data, (uint32_t) len, false };
+
+	return console_present && len && virtio_console_send(&buffer, 1);
+}
+
+/* Called from the idle loop: sends the new log records, a batch of them
+   per kick */
+void virtio_console_poll(void) {
+	if (!console_present) {
+		return;
+	}
+
+	for (;;) {
+		virtio_buffer_t buffers[VIRTIO_CONSOLE_LOG_BATCH];
+		klog_record_t record;
+		size_t count = 0;
+
+		while (count < VIRTIO_CONSOLE_LOG_BATCH) {
+			const uint32_t lost = console.reader.lost;
+
+			if (!klog_read(&console.reader, &record)) {
+				break;
+			}
+
+			char* const line = console.lines[count];
+			size_t len = 0;
+
+			if (console.reader.lost != lost) {
+				len = ksnprintf(line, VIRTIO_CONSOLE_LINE, "[%u records lost]\r\n", console.reader.lost - lost);
+			}
+			len += klog_format(&record, line + len, VIRTIO_CONSOLE_LINE - len - 2);
+			line[len++] = '\r';
+			line[len++] = '\n';
+			buffers[count++] = { line, (uint32_t) len, false };
+		}
+		if (!count) {
+			return;
+		}
+		virtio_console_send(buffers, count);
+	}
+}
+
+void virtio_console_bench(void) {
+	static virtio_buffer_t buffers[VIRTIO_BENCH_DEPTH];
+
+	if (!console_present) {
+		terminal_printf("virtio bench: no virtio console");
+		return;
+	}
+
+	char* const page = (char*) page_alloc();
+
+	if (!page) {
+		terminal_printf("virtio bench: not enough memory");
+		return;
+	}
+
+	// Lines of dots, so that whatever reads hvc0 isn't flooded with garbage
+	memset(page, '.', PAGE_SIZE);
+	for (size_t i = 79; i < PAGE_SIZE; i += 80) {
+		page[i] = '\n';
+	}
+
+	const size_t depth = console.tx.size < VIRTIO_BENCH_DEPTH ? console.tx.size : VIRTIO_BENCH_DEPTH;
+	const uint32_t kicks = console.tx.kicks;
+	const uint32_t interrupts = console.tx.interrupts;
+	const uint64_t start = rdtsc();
+
+	for (size_t i = 0; i < depth; ++i) {
+		buffers[i] = { page, PAGE_SIZE, false };
+	}
+	for (uint32_t done = 0; done < VIRTIO_BENCH_CONSOLE_OPS; done += depth) {
+		const size_t batch = VIRTIO_BENCH_CONSOLE_OPS - done < depth ? VIRTIO_BENCH_CONSOLE_OPS - done : depth;
+
+		virtio_console_send(buffers, batch);
+	}
+
+	const uint64_t cycles = rdtsc() - start;
+	const uint64_t us = tsc_to_us(cycles) ? tsc_to_us(cycles) : 1;
+	const uint32_t mb_s_10 = (uint64_t) VIRTIO_BENCH_CONSOLE_OPS * PAGE_SIZE * 10 * 1000000 / us / (1024 * 1024);
+
+	terminal_printf("hvc0 write %5u x 4K %5u.%u MB/s %7u IO/s %4u kick %4u irq", VIRTIO_BENCH_CONSOLE_OPS,
+		mb_s_10 / 10, mb_s_10 % 10, (uint32_t) ((uint64_t) VIRTIO_BENCH_CONSOLE_OPS * 1000000 / us),
+		console.tx.kicks - kicks, console.tx.interrupts - interrupts);
+	page_free(page);
+}
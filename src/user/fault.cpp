@@ -0,0 +1,10 @@
+#include "user.hpp"
+
+
+/* Tries what ring 3 must not do: the kernel kills it on the first one */
+int main(void) {
+	write("writing to a PIC port from ring 3...\n");
+	__asm__ volatile ("outb %0, $0x21" : : "a"((uint8_t) 0xFF));
+	write("still alive, the port is not protected\n");
+	return 1;
+}
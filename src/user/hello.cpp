@@ -0,0 +1,8 @@
+#include "user.hpp"
+
+
+int main(void) {
+	write("Hello from ring 3\n");
+	write(user_sysenter ? "system calls go through sysenter\n" : "system calls go through int 0x80\n");
+	return 0;
+}
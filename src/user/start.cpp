@@ -0,0 +1,11 @@
+#include "user.hpp"
+
+
+bool	user_sysenter = false;
+
+
+/* Entry point of every user program, see user_run() in the kernel */
+extern "C" __attribute__((noreturn)) void _start(const uint32_t flags) {
+	user_sysenter = flags & USER_FLAG_SYSENTER;
+	exit(main());
+}
@@ -0,0 +1,40 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "syscall.hpp"
+
+#ifndef _USER_H_
+# define _USER_H_
+
+/* Set by _start from the flags given by the kernel */
+extern bool	user_sysenter;
+
+int	main(void);
+
+inline uint32_t syscall(const uint32_t number, const uint32_t arg1 = 0, const uint32_t arg2 = 0, const uint32_t arg3 = 0) {
+	if (user_sysenter) {
+		return syscall_sysenter(number, arg1, arg2, arg3);
+	}
+	return syscall_int80(number, arg1, arg2, arg3);
+}
+
+inline size_t strlen(const char* str) {
+	size_t len = 0;
+
+	while (str[len]) {
+		++len;
+	}
+	return len;
+}
+
+inline uint32_t write(const char* str) {
+	return syscall(SYS_WRITE, (uint32_t) str, strlen(str));
+}
+
+__attribute__((noreturn)) inline void exit(const int status) {
+	syscall(SYS_EXIT, status);
+	for (;;) {
+	}
+}
+
+#endif // _USER_H_